@@ -1,6 +1,8 @@
 #ifndef AABBH
 #define AABBH
 
+#include "stats.h"
+
 inline float ffmin(float a, float b) { return a < b ? a : b; }
 inline float ffmax(float a, float b) { return a > b ? a : b; }
 
@@ -12,6 +14,7 @@ class AABB {
         Vector3 max() const {return _max; }
 
         bool hit(const Ray& r, float tmin, float tmax) const {
+            STAT_INC(boxTests);
             for (int a = 0; a < 3; a++) {
                 float t0 = ffmin((_min[a] - r.origin()[a]) / r.direction()[a],
                                 (_max[a] - r.origin()[a]) / r.direction()[a]);
@@ -0,0 +1,96 @@
+#ifndef ARENAH
+#define ARENAH
+
+#include <stdlib.h>
+
+#include <new>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+/*
+    Owns every object of a scene. Objects are bump allocated out of large blocks
+    so things built together sit together in memory, and everything (running
+    destructors where a type needs one) is released when the arena is dropped.
+*/
+class SceneArena {
+    public:
+        explicit SceneArena(size_t _blockSize = 256*1024) : blockSize(_blockSize), used(0), available(0), current(NULL) {}
+        ~SceneArena() { clear(); }
+
+        template <typename T, typename... Args>
+        T* make(Args&&... args) {
+            void *p = allocate(sizeof(T), alignof(T));
+            T *object = new (p) T(std::forward<Args>(args)...);
+            if (!std::is_trivially_destructible<T>::value)
+                own(object, destroy<T>);
+            return object;
+        }
+
+        // uninitialised storage for n plain values, e.g. the Hitable* lists
+        template <typename T>
+        T* makeArray(size_t n) {
+            static_assert(std::is_trivially_destructible<T>::value, "arena arrays hold plain values");
+            return (T*)allocate(n*sizeof(T), alignof(T));
+        }
+
+        // hands memory that was allocated elsewhere (e.g. by stbi_load) to the arena
+        void own(void *p, void (*release)(void*)) {
+            Cleanup cleanup = { p, release };
+            cleanups.push_back(cleanup);
+        }
+
+        void* allocate(size_t size, size_t align) {
+            size_t padding = (align - (size_t)current % align) % align;
+            if (current == NULL || padding + size > available) {
+                size_t size0 = size + align > blockSize ? size + align : blockSize;
+                char *block = (char*)malloc(size0);
+                if (block == NULL)
+                    throw std::bad_alloc();
+                blocks.push_back(block);
+                current = block;
+                available = size0;
+                padding = (align - (size_t)current % align) % align;
+            }
+            char *p = current + padding;
+            current += padding + size;
+            available -= padding + size;
+            used += size;
+            return p;
+        }
+
+        void clear() {
+            for (size_t i = cleanups.size(); i > 0; i--)
+                cleanups[i-1].release(cleanups[i-1].object);
+            cleanups.clear();
+            for (size_t i = 0; i < blocks.size(); i++)
+                free(blocks[i]);
+            blocks.clear();
+            current = NULL;
+            available = 0;
+            used = 0;
+        }
+
+        size_t bytesUsed() const { return used; }
+
+    private:
+        struct Cleanup {
+            void *object;
+            void (*release)(void*);
+        };
+
+        template <typename T>
+        static void destroy(void *p) { static_cast<T*>(p)->~T(); }
+
+        SceneArena(const SceneArena&);
+        SceneArena& operator=(const SceneArena&);
+
+        size_t blockSize;
+        size_t used;
+        size_t available;
+        char *current;
+        std::vector<char*> blocks;
+        std::vector<Cleanup> cleanups;
+};
+
+#endif
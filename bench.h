@@ -0,0 +1,83 @@
+#ifndef BENCHH
+#define BENCHH
+
+#include <stdint.h>
+
+#include <iomanip>
+#include <ostream>
+#include <string>
+#include <vector>
+
+#include "stats.h"
+
+/*
+    The reference renders behind --bench: built-in scenes at a fixed size,
+    sample count and seed, so that numbers from different versions of the
+    renderer can be compared. The seed also goes to srand48 before the scene
+    is built, for the scenes that place things at random.
+*/
+struct BenchCase {
+    const char *scene;
+    int xResolution, yResolution, nSamples;
+    uint64_t seed;
+};
+
+const BenchCase benchCases[] = {
+    { "random",    200, 100, 16, 1 },
+    { "cornell",   160, 160,  4, 1 },
+    { "final",     200, 200, 16, 1 },
+    { "boxes",     200, 200, 16, 1 },
+    { "volume",    200, 200, 16, 1 },
+    { "textured",  200, 200, 16, 1 },
+    { "instanced", 200, 200, 16, 1 },
+};
+
+struct BenchResult {
+    BenchCase bench;
+    double buildSeconds;  // building and compiling the scene
+    double renderSeconds;
+    uint64_t rays;        // camera rays and every bounce
+    double meanValue;     // the average of every channel of every pixel, to notice a render that changed
+    RenderStats stats;    // only counted with JRAY_STATS
+};
+
+inline std::string jsonString(const std::string& s) {
+    std::string out = "\"";
+    for (size_t i = 0; i < s.size(); i++) {
+        if (s[i] == '"' || s[i] == '\\')
+            out += '\\';
+        if ((unsigned char)s[i] >= 0x20)
+            out += s[i];
+    }
+    return out + "\"";
+}
+
+// one object: the label, thread count and whether the counters slowed it, then a record per scene
+void writeBenchJSON(std::ostream& out, const std::string& label, unsigned threads, const std::vector<BenchResult>& results) {
+#ifdef JRAY_STATS
+    bool counted = true;
+#else
+    bool counted = false;
+#endif
+    out << std::setprecision(6);
+    out << "{\n  \"label\": " << jsonString(label) << ",\n  \"threads\": " << threads
+        << ",\n  \"stats\": " << (counted ? "true" : "false") << ",\n  \"scenes\": [";
+    for (size_t i = 0; i < results.size(); i++) {
+        const BenchResult& r = results[i];
+        double samples = double(r.bench.xResolution)*r.bench.yResolution*r.bench.nSamples;
+        out << (i ? ",\n" : "\n") << "    { \"scene\": " << jsonString(r.bench.scene)
+            << ", \"width\": " << r.bench.xResolution << ", \"height\": " << r.bench.yResolution
+            << ", \"samplesPerPixel\": " << r.bench.nSamples << ", \"seed\": " << r.bench.seed
+            << ", \"buildSeconds\": " << r.buildSeconds << ", \"wallSeconds\": " << r.renderSeconds
+            << ", \"rays\": " << r.rays << ", \"mraysPerSecond\": " << r.rays / r.renderSeconds / 1e6
+            << ", \"samplesPerSecond\": " << samples / r.renderSeconds << ", \"meanValue\": " << r.meanValue;
+        if (counted) {
+            out << ",\n      \"stats\": ";
+            r.stats.writeJSON(out);
+        }
+        out << " }";
+    }
+    out << "\n  ]\n}\n";
+}
+
+#endif
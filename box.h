@@ -4,34 +4,105 @@
 #include "hitable.h"
 #include "material.h"
 
+/*
+    Entry and exit distances of r through the box [lo, hi] and the axes they
+    were found on. False when the ray misses the box's line entirely.
+*/
+inline bool boxSlabs(const Vector3& lo, const Vector3& hi, const Ray& r, float& tNear, float& tFar, int& nearAxis, int& farAxis) {
+    tNear = -FLT_MAX;
+    tFar = FLT_MAX;
+    nearAxis = farAxis = 0;
+    for (int a = 0; a < 3; a++) {
+        float invD = 1.0f / r.direction()[a];
+        float t0 = (lo[a] - r.origin()[a]) * invD;
+        float t1 = (hi[a] - r.origin()[a]) * invD;
+        if (invD < 0.0f)
+            std::swap(t0, t1);
+        if (t0 > tNear) {
+            tNear = t0;
+            nearAxis = a;
+        }
+        if (t1 < tFar) {
+            tFar = t1;
+            farAxis = a;
+        }
+    }
+    return tNear <= tFar;
+}
+
+// faces are numbered 2*axis, plus one for the face on the max side
+inline int boxFace(const Ray& r, int axis, bool entering) {
+    bool positive = r.direction()[axis] > 0;
+    return 2*axis + (positive == entering ? 0 : 1);
+}
+
+inline bool hitBox(const Vector3& lo, const Vector3& hi, const Ray& r, float tMin, float tMax, HitRecord& rec) {
+    float tNear, tFar;
+    int nearAxis, farAxis;
+    if (!boxSlabs(lo, hi, r, tNear, tFar, nearAxis, farAxis))
+        return false;
+    // from inside the box the exit face is hit, like a closed set of rects
+    if (tNear > tMin && tNear < tMax) {
+        rec.t = tNear;
+        rec.primitive = boxFace(r, nearAxis, true);
+    } else if (tFar > tMin && tFar < tMax) {
+        rec.t = tFar;
+        rec.primitive = boxFace(r, farAxis, false);
+    } else {
+        return false;
+    }
+    return true;
+}
+
+// outward normal, uv across the face the same way the matching AARect maps it
+inline void boxSurface(const Vector3& lo, const Vector3& hi, int face, const Ray& r, HitRecord& rec) {
+    int axis = face / 2;
+    int axisA = axis == 0 ? 1 : 0;
+    int axisB = axis == 2 ? 1 : 2;
+    rec.p = r.pointAtParameter(rec.t);
+    rec.u = (rec.p[axisA] - lo[axisA]) / (hi[axisA] - lo[axisA]);
+    rec.v = (rec.p[axisB] - lo[axisB]) / (hi[axisB] - lo[axisB]);
+    rec.normal = Vector3(0,0,0);
+    rec.normal[axis] = face & 1 ? 1 : -1;
+    rec.dpdu = rec.dpdv = Vector3(0,0,0);
+    rec.dpdu[axisA] = hi[axisA] - lo[axisA];
+    rec.dpdv[axisB] = hi[axisB] - lo[axisB];
+}
+
+/*
+    Closed axis-aligned box. Intersected with one slab test; the face that was
+    hit is kept in HitRecord::primitive until the surface is needed.
+*/
 class Box: public Hitable {
     public:
         Box() {}
-        Box(const Vector3& p0, const Vector3& p1, Material *ptr);
+        Box(const Vector3& p0, const Vector3& p1, Material *ptr) : pmin(p0), pmax(p1), matPtr(ptr) {}
         virtual bool hit(const Ray& r, float t0, float t1, HitRecord& rec) const;
+        virtual void computeSurfaceInteraction(const Ray& r, HitRecord& rec) const;
+        virtual bool hitInterval(const Ray& r, float tMin, float tMax, float& tEnter, float& tExit) const {
+            int nearAxis, farAxis;
+            return boxSlabs(pmin, pmax, r, tEnter, tExit, nearAxis, farAxis) && tExit > tMin && tEnter < tMax;
+        }
         virtual bool boundingBox(float t0, float t1, AABB& box) const {
             box = AABB(pmin, pmax);
             return true;
         }
         Vector3 pmin, pmax;
-        Hitable *listPtr;
+        Material *matPtr;
 };
 
-Box::Box(const Vector3& p0, const Vector3& p1, Material *ptr) {
-    pmin = p0;
-    pmax = p1;
-    Hitable **list = new Hitable*[6];
-    list[0] = new XYRect(p0.x(), p1.x(), p0.y(), p1.y(), p1.z(), ptr);
-    list[1] = new FlipNormals(new XYRect(p0.x(), p1.x(), p0.y(), p1.y(), p0.z(), ptr));
-    list[2] = new XZRect(p0.x(), p1.x(), p0.z(), p1.z(), p1.y(), ptr);
-    list[3] = new FlipNormals(new XZRect(p0.x(), p1.x(), p0.z(), p1.z(), p0.y(), ptr));
-    list[4] = new YZRect(p0.y(), p1.y(), p0.z(), p1.z(), p1.x(), ptr);
-    list[5] = new FlipNormals(new YZRect(p0.y(), p1.y(), p0.z(), p1.z(), p0.x(), ptr));
-    listPtr = new HitableList(list, 6);
+bool Box::hit(const Ray& r, float t0, float t1, HitRecord& rec) const {
+    STAT_INC(primitiveTests[STAT_BOX]);
+    if (!hitBox(pmin, pmax, r, t0, t1, rec))
+        return false;
+    rec.object = this;
+    rec.flipped = false;
+    return true;
 }
 
-bool Box::hit(const Ray& r, float t0, float t1, HitRecord& rec) const {
-    return listPtr->hit(r, t0, t1, rec);
+void Box::computeSurfaceInteraction(const Ray& r, HitRecord& rec) const {
+    boxSurface(pmin, pmax, rec.primitive, r, rec);
+    rec.matPtr = matPtr;
 }
 
-#endif
\ No newline at end of file
+#endif
@@ -0,0 +1,210 @@
+#ifndef BOXSETH
+#define BOXSETH
+
+#include <unordered_map>
+#include <vector>
+#ifdef __AVX2__
+#include <immintrin.h>
+#endif
+
+#include "hitable.h"
+#include "leafBVH.h"
+#include "material.h"
+#include "box.h"
+
+/*
+    Many axis-aligned boxes stored as structure-of-arrays. Leaves of up to 8
+    boxes are slab tested together, with AVX2 when it is available. Only the
+    distance is found per leaf; the face is worked out for the closest box.
+*/
+class BoxSet: public Hitable {
+    public:
+        static const int leafSize = 8;
+        static const int flatLimit = 32;
+
+        BoxSet() {}
+        int addMaterial(Material *m);
+        void add(const Vector3& p0, const Vector3& p1, int material, bool flipped = false);
+        void add(const Vector3& p0, const Vector3& p1, Material *m, bool flipped = false) {
+            add(p0, p1, addMaterial(m), flipped);
+        }
+        void add(const Box& box, bool flipped = false) { add(box.pmin, box.pmax, box.matPtr, flipped); }
+        void build();
+        int size() const { return int(matId.size()); }
+        virtual bool hit(const Ray& r, float tMin, float tMax, HitRecord& rec) const;
+        virtual void computeSurfaceInteraction(const Ray& r, HitRecord& rec) const;
+        virtual bool boundingBox(float t0, float t1, AABB& box) const;
+
+        std::vector<float> minX, minY, minZ, maxX, maxY, maxZ;
+        std::vector<int> matId;
+        std::vector<unsigned char> flipped;
+        std::vector<Material*> materials;
+        QuantizedBVH bvh;
+
+    private:
+        bool hitLeaf(const Ray& r, int offset, int count, float tMin, float& tMax, int& closest) const;
+        Vector3 lo(int i) const { return Vector3(minX[i], minY[i], minZ[i]); }
+        Vector3 hi(int i) const { return Vector3(maxX[i], maxY[i], maxZ[i]); }
+        std::unordered_map<Material*, int> materialIds;
+        int nBoxes = 0;
+};
+
+int BoxSet::addMaterial(Material *m) {
+    auto found = materialIds.find(m);
+    if (found != materialIds.end())
+        return found->second;
+    int id = int(materials.size());
+    materials.push_back(m);
+    materialIds[m] = id;
+    return id;
+}
+
+void BoxSet::add(const Vector3& p0, const Vector3& p1, int material, bool _flipped) {
+    minX.push_back(p0.x());
+    minY.push_back(p0.y());
+    minZ.push_back(p0.z());
+    maxX.push_back(p1.x());
+    maxY.push_back(p1.y());
+    maxZ.push_back(p1.z());
+    matId.push_back(material);
+    flipped.push_back(_flipped);
+}
+
+void BoxSet::build() {
+    nBoxes = size();
+    for (std::vector<float> *v : {&minX, &minY, &minZ, &maxX, &maxY, &maxZ})
+        v->resize(nBoxes);
+    std::vector<LeafBVHNode> nodes;
+    if (nBoxes > flatLimit) {
+        std::vector<AABB> boxes(nBoxes);
+        for (int i = 0; i < nBoxes; i++)
+            boxes[i] = AABB(lo(i), hi(i));
+        std::vector<int> order;
+        buildLeafBVH(boxes, leafSize, nodes, order);
+
+        std::vector<float> ominX(minX), ominY(minY), ominZ(minZ), omaxX(maxX), omaxY(maxY), omaxZ(maxZ);
+        std::vector<int> omat(matId);
+        std::vector<unsigned char> oflipped(flipped);
+        for (int i = 0; i < nBoxes; i++) {
+            minX[i] = ominX[order[i]];
+            minY[i] = ominY[order[i]];
+            minZ[i] = ominZ[order[i]];
+            maxX[i] = omaxX[order[i]];
+            maxY[i] = omaxY[order[i]];
+            maxZ[i] = omaxZ[order[i]];
+            matId[i] = omat[order[i]];
+            flipped[i] = oflipped[order[i]];
+        }
+    }
+    bvh.build(nodes);
+    // pad so the last leaf can always be loaded as a full group of 8
+    for (std::vector<float> *v : {&minX, &minY, &minZ, &maxX, &maxY, &maxZ})
+        v->resize(nBoxes + leafSize, 0);
+}
+
+bool BoxSet::hitLeaf(const Ray& r, int offset, int count, float tMin, float& tMax, int& closest) const {
+    STAT_ADD(primitiveTests[STAT_BOX], count);
+    bool hitAnything = false;
+#ifdef __AVX2__
+    const __m256 ox = _mm256_set1_ps(r.origin().x());
+    const __m256 oy = _mm256_set1_ps(r.origin().y());
+    const __m256 oz = _mm256_set1_ps(r.origin().z());
+    const __m256 invX = _mm256_set1_ps(1.0f / r.direction().x());
+    const __m256 invY = _mm256_set1_ps(1.0f / r.direction().y());
+    const __m256 invZ = _mm256_set1_ps(1.0f / r.direction().z());
+    const __m256 lanes = _mm256_castsi256_ps(_mm256_cmpgt_epi32(_mm256_set1_epi32(count), _mm256_setr_epi32(0,1,2,3,4,5,6,7)));
+
+    __m256 x0 = _mm256_mul_ps(_mm256_sub_ps(_mm256_loadu_ps(&minX[offset]), ox), invX);
+    __m256 x1 = _mm256_mul_ps(_mm256_sub_ps(_mm256_loadu_ps(&maxX[offset]), ox), invX);
+    __m256 y0 = _mm256_mul_ps(_mm256_sub_ps(_mm256_loadu_ps(&minY[offset]), oy), invY);
+    __m256 y1 = _mm256_mul_ps(_mm256_sub_ps(_mm256_loadu_ps(&maxY[offset]), oy), invY);
+    __m256 z0 = _mm256_mul_ps(_mm256_sub_ps(_mm256_loadu_ps(&minZ[offset]), oz), invZ);
+    __m256 z1 = _mm256_mul_ps(_mm256_sub_ps(_mm256_loadu_ps(&maxZ[offset]), oz), invZ);
+    __m256 tNear = _mm256_max_ps(_mm256_max_ps(_mm256_min_ps(x0, x1), _mm256_min_ps(y0, y1)), _mm256_min_ps(z0, z1));
+    __m256 tFar = _mm256_min_ps(_mm256_min_ps(_mm256_max_ps(x0, x1), _mm256_max_ps(y0, y1)), _mm256_max_ps(z0, z1));
+
+    __m256 lo = _mm256_set1_ps(tMin);
+    __m256 hi = _mm256_set1_ps(tMax);
+    __m256 entering = _mm256_cmp_ps(tNear, lo, _CMP_GT_OQ);
+    __m256 t = _mm256_blendv_ps(tFar, tNear, entering);
+    __m256 valid = _mm256_and_ps(lanes, _mm256_cmp_ps(tNear, tFar, _CMP_LE_OQ));
+    valid = _mm256_and_ps(valid, _mm256_and_ps(_mm256_cmp_ps(t, lo, _CMP_GT_OQ), _mm256_cmp_ps(t, hi, _CMP_LT_OQ)));
+    int mask = _mm256_movemask_ps(valid);
+    if (mask == 0)
+        return false;
+
+    float ts[8];
+    _mm256_storeu_ps(ts, t);
+    for (int i = 0; i < 8; i++) {
+        if ((mask & (1 << i)) && ts[i] < tMax) {
+            tMax = ts[i];
+            closest = offset + i;
+            hitAnything = true;
+        }
+    }
+#else
+    for (int i = offset; i < offset + count; i++) {
+        float tNear, tFar;
+        int nearAxis, farAxis;
+        if (!boxSlabs(lo(i), hi(i), r, tNear, tFar, nearAxis, farAxis))
+            continue;
+        float t = tNear > tMin ? tNear : tFar;
+        if (t > tMin && t < tMax) {
+            tMax = t;
+            closest = i;
+            hitAnything = true;
+        }
+    }
+#endif
+    return hitAnything;
+}
+
+bool BoxSet::hit(const Ray& r, float tMin, float tMax, HitRecord& rec) const {
+    int closest = -1;
+    bool hitAnything = false;
+    if (bvh.empty()) {
+        for (int offset = 0; offset < nBoxes; offset += leafSize) {
+            if (hitLeaf(r, offset, std::min(leafSize, nBoxes - offset), tMin, tMax, closest))
+                hitAnything = true;
+        }
+    } else {
+        hitAnything = traverseLeafBVH(bvh, r, tMin, tMax, [&](int offset, int count, float t0, float& t1) {
+            return hitLeaf(r, offset, count, t0, t1, closest);
+        });
+    }
+    if (!hitAnything)
+        return false;
+    rec.t = tMax;
+    rec.primitive = closest;
+    rec.object = this;
+    rec.flipped = false;
+    return true;
+}
+
+void BoxSet::computeSurfaceInteraction(const Ray& r, HitRecord& rec) const {
+    int i = rec.primitive;
+    float tNear, tFar;
+    int nearAxis, farAxis;
+    boxSlabs(lo(i), hi(i), r, tNear, tFar, nearAxis, farAxis);
+    // whichever end of the slab interval the leaf test picked
+    bool entering = fabs(rec.t - tNear) <= fabs(rec.t - tFar);
+    boxSurface(lo(i), hi(i), boxFace(r, entering ? nearAxis : farAxis, entering), r, rec);
+    if (flipped[i])
+        rec.normal = -rec.normal;
+    rec.matPtr = materials[matId[i]];
+}
+
+bool BoxSet::boundingBox(float t0, float t1, AABB& box) const {
+    if (nBoxes == 0)
+        return false;
+    if (!bvh.empty()) {
+        box = bvh.bounds;
+        return true;
+    }
+    box = AABB(lo(0), hi(0));
+    for (int i = 1; i < nBoxes; i++)
+        box = surroundingBox(box, AABB(lo(i), hi(i)));
+    return true;
+}
+
+#endif
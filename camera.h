@@ -2,6 +2,7 @@
 #define CAMERAH
 
 #include "ray.h"
+#include "random.h"
 
 Vector3 randomInUnitDisk() {
     Vector3 p;
@@ -28,12 +29,24 @@ class Camera {
             horizontal = 2*halfWidth*focusDist*u;
             vertical = 2*halfHeight*focusDist*v;
         }
-        Ray getRay(float s, float t) {
+        Ray getRay(float s, float t) const {
             Vector3 rd = lensRadius*randomInUnitDisk();
             Vector3 offset = u * rd.x() + v * rd.y();
-            float time = time0 + (drand48()* (time1-time0));
+            float time = time0 + (randomFloat()* (time1-time0));
             return Ray(origin + offset, lowerLeftCorner+s*horizontal + t*vertical - origin - offset, time);
         }
+        // the same ray, plus the rays ds and dt further across the image through the same lens point
+        Ray getRay(float s, float t, float ds, float dt, RayDifferential& diff) const {
+            Vector3 rd = lensRadius*randomInUnitDisk();
+            Vector3 offset = u * rd.x() + v * rd.y();
+            float time = time0 + (randomFloat()* (time1-time0));
+            Vector3 o = origin + offset;
+            Vector3 target = lowerLeftCorner+s*horizontal + t*vertical;
+            diff.rxOrigin = diff.ryOrigin = o;
+            diff.rxDirection = target + ds*horizontal - o;
+            diff.ryDirection = target + dt*vertical - o;
+            return Ray(o, target - o, time);
+        }
 
         Vector3 origin;
         Vector3 lowerLeftCorner;
@@ -0,0 +1,116 @@
+#ifndef CHECKPOINTH
+#define CHECKPOINTH
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <iostream>
+#include <string>
+#include <vector>
+
+/*
+    The state of an unfinished render: the running sum of every pixel's
+    samples and how many each has taken. Samples draw their random numbers
+    from seedSample(seed, pixel, sample), so nothing else is needed to carry
+    on exactly where the render stopped: resuming adds the same samples in
+    the same order and ends with the same image as a render that was never
+    interrupted. settingsHash covers the scene name, the scene file and
+    every file it names, and the view, so a checkpoint is not resumed into
+    a different render.
+
+    On disk: a header, the float sums, then the counts, left out when every
+    pixel has the same one (which progressive passes always give).
+*/
+class Checkpoint {
+    public:
+        static const uint32_t version = 1;
+
+        Checkpoint() : width(0), height(0), seed(0), settingsHash(0) {}
+        void reset(int w, int h, uint64_t _seed, uint64_t _settingsHash);
+        bool write(const std::string& fileName) const;
+        bool read(const std::string& fileName);
+
+        int width, height;
+        uint64_t seed, settingsHash;
+        std::vector<float> sum;       // RGB per pixel, top row first
+        std::vector<uint32_t> count;  // samples per pixel
+
+    private:
+        struct Header {
+            char magic[8];
+            uint32_t version;
+            int32_t width, height;
+            uint32_t uniformCount; // the count of every pixel, or 0 when the counts follow the sums
+            uint64_t seed, settingsHash;
+        };
+};
+
+void Checkpoint::reset(int w, int h, uint64_t _seed, uint64_t _settingsHash) {
+    width = w;
+    height = h;
+    seed = _seed;
+    settingsHash = _settingsHash;
+    sum.assign(size_t(3)*w*h, 0.0f);
+    count.assign(size_t(w)*h, 0);
+}
+
+// written beside the target and renamed over it, so a kill mid-write keeps the last good checkpoint
+bool Checkpoint::write(const std::string& fileName) const {
+    Header header;
+    memcpy(header.magic, "JRAYCKP", 8);
+    header.version = version;
+    header.width = width;
+    header.height = height;
+    header.uniformCount = count.empty() ? 0 : count[0];
+    for (size_t i = 0; i < count.size() && header.uniformCount; i++) {
+        if (count[i] != header.uniformCount)
+            header.uniformCount = 0;
+    }
+    header.seed = seed;
+    header.settingsHash = settingsHash;
+
+    std::string temporary = fileName + ".tmp";
+    FILE *out = fopen(temporary.c_str(), "wb");
+    if (out == NULL) {
+        std::cerr << "Error: could not write checkpoint " << fileName << std::endl;
+        return false;
+    }
+    bool ok = fwrite(&header, sizeof(header), 1, out) == 1 && fwrite(sum.data(), sizeof(float), sum.size(), out) == sum.size();
+    if (header.uniformCount == 0)
+        ok = ok && fwrite(count.data(), sizeof(uint32_t), count.size(), out) == count.size();
+    ok = fflush(out) == 0 && fsync(fileno(out)) == 0 && ok;
+    ok = fclose(out) == 0 && ok;
+    if (!ok || rename(temporary.c_str(), fileName.c_str()) != 0) {
+        std::cerr << "Error: could not write checkpoint " << fileName << std::endl;
+        remove(temporary.c_str());
+        return false;
+    }
+    return true;
+}
+
+bool Checkpoint::read(const std::string& fileName) {
+    FILE *in = fopen(fileName.c_str(), "rb");
+    if (in == NULL) {
+        std::cerr << "Error: could not open checkpoint " << fileName << std::endl;
+        return false;
+    }
+    Header header;
+    bool ok = fread(&header, sizeof(header), 1, in) == 1 && memcmp(header.magic, "JRAYCKP", 8) == 0 &&
+              header.version == version && header.width > 0 && header.height > 0;
+    if (ok) {
+        reset(header.width, header.height, header.seed, header.settingsHash);
+        ok = fread(sum.data(), sizeof(float), sum.size(), in) == sum.size();
+        if (header.uniformCount)
+            count.assign(count.size(), header.uniformCount);
+        else
+            ok = ok && fread(count.data(), sizeof(uint32_t), count.size(), in) == count.size();
+    }
+    fclose(in);
+    if (!ok)
+        std::cerr << "Error: " << fileName << " is not a valid checkpoint" << std::endl;
+    return ok;
+}
+
+#endif
@@ -0,0 +1,551 @@
+#ifndef COMPILEDSCENEH
+#define COMPILEDSCENEH
+
+#include <memory>
+#include <vector>
+
+#include "hitable.h"
+#include "hitableList.h"
+#include "leafBVH.h"
+#include "sphere.h"
+#include "sphereSet.h"
+#include "triangleMesh.h"
+#include "rectangle.h"
+#include "rectSet.h"
+#include "box.h"
+#include "boxSet.h"
+#include "transform.h"
+#include "sceneCache.h"
+
+enum PrimitiveType {
+    PRIMITIVE_SPHERE,
+    PRIMITIVE_MOVING_SPHERE,
+    PRIMITIVE_YZ_RECT, // the rect types are ordered by the axis they face
+    PRIMITIVE_XZ_RECT,
+    PRIMITIVE_XY_RECT,
+    PRIMITIVE_BOX,
+    PRIMITIVE_SPHERE_SET,
+    PRIMITIVE_MESH,
+    PRIMITIVE_RECT_SET,
+    PRIMITIVE_BOX_SET,
+    PRIMITIVE_INSTANCE,
+    PRIMITIVE_HITABLE
+};
+
+/*
+    One primitive of a compiled scene. Simple shapes keep their data inline;
+    sphere, rect and box sets and meshes keep a pointer but are called without
+    a virtual hop.
+    PRIMITIVE_HITABLE holds anything else and goes through Hitable::hit.
+*/
+struct PrimitiveRecord {
+    struct SphereData { float center[3]; float radius; };
+    struct MovingSphereData { float center0[3]; float center1[3]; float time0, time1, radius; };
+    struct RectData { float a0, a1, b0, b1, k; };
+    struct BoxData { float min[3]; float max[3]; };
+
+    unsigned char type;
+    bool flipped;
+    union {
+        Material *material;
+        const Hitable *object;
+    };
+    union {
+        SphereData sphere;
+        MovingSphereData moving;
+        RectData rect;
+        BoxData box;
+    };
+};
+
+/*
+    Closed-set version of a Hitable scene for the render loop. The Hitable
+    classes stay the way scenes are built; compiling flattens lists, BVHs,
+    boxes, FlipNormals and translations into a flat array of tagged
+    records under one BVH, which hit() walks with a switch per record. Other
+    transforms stay as instance records that move the ray once. Only
+    the closest record gets its normal, uv and material filled in.
+*/
+class CompiledScene {
+    public:
+        static const int leafSize = 4;
+        static const int flatLimit = 8;
+        static const int rectSetMin = 4;
+        static const int boxSetMin = 4;
+
+        CompiledScene() {}
+        CompiledScene(const Hitable *world, float time0, float time1, SceneCache *cache = NULL) { compile(world, time0, time1, cache); }
+        void compile(const Hitable *world, float time0, float time1, SceneCache *cache = NULL);
+        float refit();
+        bool hit(const Ray& r, float tMin, float tMax, HitRecord& rec) const;
+
+        std::vector<PrimitiveRecord> primitives;
+        std::vector<LeafBVHNode> nodes; // built, refit and cached
+        QuantizedBVH bvh; // what hit() walks, made from nodes
+        std::vector<int> unbounded;
+        std::unique_ptr<RectSet> rectSet; // the scene's rects once there are rectSetMin of them
+        std::unique_ptr<BoxSet> boxSet; // likewise for boxes
+        float builtCost; // leafBVHCost when the tree was built
+
+    private:
+        bool flattenable(const Hitable *h) const;
+        void add(const Hitable *h, const Vector3& offset, bool flipped);
+        void gatherRects();
+        void gatherBoxes();
+        void addRect(PrimitiveType type, float a0, float a1, float b0, float b1, float k, Material *m, const Vector3& offset, bool flipped);
+        bool primitiveBox(const PrimitiveRecord& p, AABB& box) const;
+        bool hitPrimitive(const PrimitiveRecord& p, const Ray& r, float tMin, float tMax, HitRecord& rec) const;
+        void surfaceInteraction(const PrimitiveRecord& p, const Ray& r, HitRecord& rec) const;
+
+        float time0, time1;
+};
+
+// whether h can be folded into plain records under a FlipNormals or a translation
+bool CompiledScene::flattenable(const Hitable *h) const {
+    if (dynamic_cast<const Sphere*>(h) || dynamic_cast<const movingSphere*>(h) || dynamic_cast<const XYRect*>(h) ||
+        dynamic_cast<const XZRect*>(h) || dynamic_cast<const YZRect*>(h) || dynamic_cast<const Box*>(h))
+        return true;
+    if (const FlipNormals *flip = dynamic_cast<const FlipNormals*>(h))
+        return flattenable(flip->ptr);
+    if (const Transform *transform = dynamic_cast<const Transform*>(h))
+        return !transform->animated && transform->toWorld.isTranslation() && flattenable(transform->ptr);
+    if (const HitableList *list = dynamic_cast<const HitableList*>(h)) {
+        for (int i = 0; i < list->listSize; i++) {
+            if (!flattenable(list->list[i]))
+                return false;
+        }
+        return true;
+    }
+    return false;
+}
+
+void CompiledScene::addRect(PrimitiveType type, float a0, float a1, float b0, float b1, float k, Material *m, const Vector3& offset, bool flipped) {
+    int axis = type - PRIMITIVE_YZ_RECT;
+    int axisA = axis == 0 ? 1 : 0;
+    int axisB = axis == 2 ? 1 : 2;
+    PrimitiveRecord p;
+    p.type = type;
+    p.flipped = flipped;
+    p.material = m;
+    p.rect.a0 = a0 + offset[axisA];
+    p.rect.a1 = a1 + offset[axisA];
+    p.rect.b0 = b0 + offset[axisB];
+    p.rect.b1 = b1 + offset[axisB];
+    p.rect.k = k + offset[axis];
+    primitives.push_back(p);
+}
+
+void CompiledScene::add(const Hitable *h, const Vector3& offset, bool flipped) {
+    PrimitiveRecord p;
+    p.flipped = flipped;
+    if (const Sphere *s = dynamic_cast<const Sphere*>(h)) {
+        p.type = PRIMITIVE_SPHERE;
+        p.material = s->matPtr;
+        for (int a = 0; a < 3; a++)
+            p.sphere.center[a] = s->center[a] + offset[a];
+        p.sphere.radius = s->radius;
+        primitives.push_back(p);
+    } else if (const movingSphere *s = dynamic_cast<const movingSphere*>(h)) {
+        p.type = PRIMITIVE_MOVING_SPHERE;
+        p.material = s->matPtr;
+        for (int a = 0; a < 3; a++) {
+            p.moving.center0[a] = s->center0[a] + offset[a];
+            p.moving.center1[a] = s->center1[a] + offset[a];
+        }
+        p.moving.time0 = s->time0;
+        p.moving.time1 = s->time1;
+        p.moving.radius = s->radius;
+        primitives.push_back(p);
+    } else if (const XYRect *rect = dynamic_cast<const XYRect*>(h)) {
+        addRect(PRIMITIVE_XY_RECT, rect->a0, rect->a1, rect->b0, rect->b1, rect->k, rect->mp, offset, flipped);
+    } else if (const XZRect *rect = dynamic_cast<const XZRect*>(h)) {
+        addRect(PRIMITIVE_XZ_RECT, rect->a0, rect->a1, rect->b0, rect->b1, rect->k, rect->mp, offset, flipped);
+    } else if (const YZRect *rect = dynamic_cast<const YZRect*>(h)) {
+        addRect(PRIMITIVE_YZ_RECT, rect->a0, rect->a1, rect->b0, rect->b1, rect->k, rect->mp, offset, flipped);
+    } else if (const Box *box = dynamic_cast<const Box*>(h)) {
+        p.type = PRIMITIVE_BOX;
+        p.material = box->matPtr;
+        for (int a = 0; a < 3; a++) {
+            p.box.min[a] = box->pmin[a] + offset[a];
+            p.box.max[a] = box->pmax[a] + offset[a];
+        }
+        primitives.push_back(p);
+    } else if (const HitableList *list = dynamic_cast<const HitableList*>(h)) {
+        for (int i = 0; i < list->listSize; i++)
+            add(list->list[i], offset, flipped);
+    } else if (const BVHNode *node = dynamic_cast<const BVHNode*>(h)) {
+        add(node->left, offset, flipped);
+        if (node->right != node->left)
+            add(node->right, offset, flipped);
+    } else if (const FlipNormals *flip = dynamic_cast<const FlipNormals*>(h)) {
+        if (flattenable(flip->ptr)) {
+            add(flip->ptr, offset, !flipped);
+        } else {
+            p.type = PRIMITIVE_HITABLE;
+            p.object = h;
+            primitives.push_back(p);
+        }
+    } else if (const Transform *transform = dynamic_cast<const Transform*>(h)) {
+        if (flattenable(transform)) {
+            add(transform->ptr, offset + transform->toWorld.translationPart(), flipped);
+        } else {
+            p.type = PRIMITIVE_INSTANCE;
+            p.object = h;
+            primitives.push_back(p);
+        }
+    } else if (dynamic_cast<const SphereSet*>(h)) {
+        p.type = PRIMITIVE_SPHERE_SET;
+        p.object = h;
+        primitives.push_back(p);
+    } else if (dynamic_cast<const TriangleMesh*>(h)) {
+        p.type = PRIMITIVE_MESH;
+        p.object = h;
+        primitives.push_back(p);
+    } else {
+        p.type = PRIMITIVE_HITABLE;
+        p.object = h;
+        primitives.push_back(p);
+    }
+}
+
+// many rects are cheaper as one batched RectSet record than one record each
+void CompiledScene::gatherRects() {
+    rectSet.reset();
+    int nRects = 0;
+    for (size_t i = 0; i < primitives.size(); i++) {
+        if (primitives[i].type >= PRIMITIVE_YZ_RECT && primitives[i].type <= PRIMITIVE_XY_RECT)
+            nRects++;
+    }
+    if (nRects < rectSetMin)
+        return;
+
+    rectSet.reset(new RectSet());
+    std::vector<PrimitiveRecord> others;
+    for (size_t i = 0; i < primitives.size(); i++) {
+        const PrimitiveRecord& p = primitives[i];
+        if (p.type >= PRIMITIVE_YZ_RECT && p.type <= PRIMITIVE_XY_RECT)
+            rectSet->add(p.type - PRIMITIVE_YZ_RECT, p.rect.a0, p.rect.a1, p.rect.b0, p.rect.b1, p.rect.k, p.material, p.flipped);
+        else
+            others.push_back(p);
+    }
+    rectSet->build();
+    PrimitiveRecord p;
+    p.type = PRIMITIVE_RECT_SET;
+    p.flipped = false;
+    p.object = rectSet.get();
+    others.push_back(p);
+    primitives.swap(others);
+}
+
+void CompiledScene::gatherBoxes() {
+    boxSet.reset();
+    int nBoxes = 0;
+    for (size_t i = 0; i < primitives.size(); i++)
+        nBoxes += primitives[i].type == PRIMITIVE_BOX;
+    if (nBoxes < boxSetMin)
+        return;
+
+    boxSet.reset(new BoxSet());
+    std::vector<PrimitiveRecord> others;
+    for (size_t i = 0; i < primitives.size(); i++) {
+        const PrimitiveRecord& p = primitives[i];
+        if (p.type == PRIMITIVE_BOX)
+            boxSet->add(Vector3(p.box.min[0], p.box.min[1], p.box.min[2]), Vector3(p.box.max[0], p.box.max[1], p.box.max[2]),
+                       p.material, p.flipped);
+        else
+            others.push_back(p);
+    }
+    boxSet->build();
+    PrimitiveRecord p;
+    p.type = PRIMITIVE_BOX_SET;
+    p.flipped = false;
+    p.object = boxSet.get();
+    others.push_back(p);
+    primitives.swap(others);
+}
+
+bool CompiledScene::primitiveBox(const PrimitiveRecord& p, AABB& box) const {
+    switch (p.type) {
+        case PRIMITIVE_SPHERE: {
+            Vector3 c(p.sphere.center[0], p.sphere.center[1], p.sphere.center[2]);
+            Vector3 rad(p.sphere.radius, p.sphere.radius, p.sphere.radius);
+            box = AABB(c - rad, c + rad);
+            return true;
+        }
+        case PRIMITIVE_MOVING_SPHERE: {
+            movingSphere s(Vector3(p.moving.center0[0], p.moving.center0[1], p.moving.center0[2]),
+                           Vector3(p.moving.center1[0], p.moving.center1[1], p.moving.center1[2]),
+                           p.moving.time0, p.moving.time1, p.moving.radius, NULL);
+            return s.boundingBox(time0, time1, box);
+        }
+        case PRIMITIVE_YZ_RECT:
+        case PRIMITIVE_XZ_RECT:
+        case PRIMITIVE_XY_RECT: {
+            int axis = p.type - PRIMITIVE_YZ_RECT;
+            int axisA = axis == 0 ? 1 : 0;
+            int axisB = axis == 2 ? 1 : 2;
+            Vector3 lo, hi;
+            lo[axis] = p.rect.k - 0.0001;
+            hi[axis] = p.rect.k + 0.0001;
+            lo[axisA] = p.rect.a0;
+            hi[axisA] = p.rect.a1;
+            lo[axisB] = p.rect.b0;
+            hi[axisB] = p.rect.b1;
+            box = AABB(lo, hi);
+            return true;
+        }
+        case PRIMITIVE_BOX:
+            box = AABB(Vector3(p.box.min[0], p.box.min[1], p.box.min[2]), Vector3(p.box.max[0], p.box.max[1], p.box.max[2]));
+            return true;
+        default:
+            return p.object->boundingBox(time0, time1, box);
+    }
+}
+
+// the BVH over the records is the slow part, so that is what a scene cache keeps
+void CompiledScene::compile(const Hitable *world, float t0, float t1, SceneCache *cache) {
+    time0 = t0;
+    time1 = t1;
+    primitives.clear();
+    unbounded.clear();
+    add(world, Vector3(0,0,0), false);
+    gatherRects();
+    gatherBoxes();
+
+    std::vector<AABB> boxes;
+    std::vector<PrimitiveRecord> bounded;
+    for (size_t i = 0; i < primitives.size(); i++) {
+        AABB box;
+        if (primitiveBox(primitives[i], box)) {
+            boxes.push_back(box);
+            bounded.push_back(primitives[i]);
+        } else {
+            unbounded.push_back(int(i));
+        }
+    }
+    std::vector<PrimitiveRecord> unboundedRecords;
+    for (size_t i = 0; i < unbounded.size(); i++)
+        unboundedRecords.push_back(primitives[unbounded[i]]);
+
+    // records are stored in leaf order, followed by anything without a box;
+    // a handful of records is cheaper to scan than to put under a tree
+    std::vector<int> order;
+    if (int(boxes.size()) > flatLimit) {
+        if (!cache || !cache->get(CACHE_SCENE, 0, 0, nodes) || !cache->get(CACHE_SCENE, 0, 1, order) || order.size() != boxes.size()) {
+            buildLeafBVH(boxes, leafSize, nodes, order);
+            if (cache) {
+                cache->put(CACHE_SCENE, 0, 0, nodes);
+                cache->put(CACHE_SCENE, 0, 1, order);
+            }
+        }
+    } else {
+        nodes.clear();
+        for (size_t i = 0; i < boxes.size(); i++)
+            order.push_back(int(i));
+    }
+    primitives.clear();
+    for (size_t i = 0; i < order.size(); i++)
+        primitives.push_back(bounded[order[i]]);
+    for (size_t i = 0; i < unboundedRecords.size(); i++) {
+        unbounded[i] = int(primitives.size());
+        primitives.push_back(unboundedRecords[i]);
+    }
+    if (nodes.empty())
+        unbounded.clear();
+    bvh.build(nodes);
+    builtCost = leafBVHCost(nodes);
+}
+
+/*
+    For animation: after transforms inside the scene have changed, updates
+    the record boxes and the tree above them without building anything.
+    Flattened records never move (animated transforms stay instances), but
+    any record may contain one, so all are boxed again. Returns how much
+    looser the tree has become than when it was built; the caller compiles
+    again when that grows too large.
+*/
+float CompiledScene::refit() {
+    refitLeafBVH(nodes, [this](int offset, int count) {
+        AABB box;
+        primitiveBox(primitives[offset], box);
+        for (int i = offset + 1; i < offset + count; i++) {
+            AABB b;
+            primitiveBox(primitives[i], b);
+            box = surroundingBox(box, b);
+        }
+        return box;
+    });
+    bvh.build(nodes);
+    return builtCost > 0 ? leafBVHCost(nodes) / builtCost : 1;
+}
+
+template <int axis>
+inline bool hitRectRecord(const PrimitiveRecord& p, const Ray& r, float tMin, float tMax, HitRecord& rec) {
+    const int axisA = axis == 0 ? 1 : 0;
+    const int axisB = axis == 2 ? 1 : 2;
+    float t = (p.rect.k - r.A.e[axis]) / r.B.e[axis];
+    if (t < tMin || t > tMax)
+        return false;
+    float a = r.A.e[axisA] + t*r.B.e[axisA];
+    float b = r.A.e[axisB] + t*r.B.e[axisB];
+    if (a < p.rect.a0 || a > p.rect.a1 || b < p.rect.b0 || b > p.rect.b1)
+        return false;
+    rec.t = t;
+    rec.b0 = a;
+    rec.b1 = b;
+    return true;
+}
+
+template <int axis>
+inline void rectSurface(const PrimitiveRecord& p, const Ray& r, HitRecord& rec) {
+    rec.u = (rec.b0 - p.rect.a0) / (p.rect.a1 - p.rect.a0);
+    rec.v = (rec.b1 - p.rect.b0) / (p.rect.b1 - p.rect.b0);
+    rec.p = r.pointAtParameter(rec.t);
+    rec.normal = Vector3(0,0,0);
+    rec.normal[axis] = 1;
+    rec.dpdu = rec.dpdv = Vector3(0,0,0);
+    rec.dpdu[AARect<axis>::axisA] = p.rect.a1 - p.rect.a0;
+    rec.dpdv[AARect<axis>::axisB] = p.rect.b1 - p.rect.b0;
+}
+
+inline bool hitSphereRecord(const Vector3& center, float radius, const Ray& r, float tMin, float tMax, HitRecord& rec) {
+    Vector3 oc = r.origin() - center;
+    float a = dot(r.direction(), r.direction());
+    float b = dot(oc, r.direction());
+    float c = dot(oc, oc) - radius*radius;
+    float discriminant = b*b - a*c;
+    if (discriminant <= 0)
+        return false;
+    float root = sqrt(discriminant);
+    float temp = (-b - root) / a;
+    if (!(temp < tMax && temp > tMin))
+        temp = (-b + root) / a;
+    if (!(temp < tMax && temp > tMin))
+        return false;
+    rec.t = temp;
+    return true;
+}
+
+inline Vector3 movingCenter(const PrimitiveRecord& p, float time) {
+    Vector3 c0(p.moving.center0[0], p.moving.center0[1], p.moving.center0[2]);
+    Vector3 c1(p.moving.center1[0], p.moving.center1[1], p.moving.center1[2]);
+    return c0 + ((time - p.moving.time0) / (p.moving.time1 - p.moving.time0)) * (c1 - c0);
+}
+
+// only fills in t (and whatever the record needs later); see surfaceInteraction
+// sets, instances and other hitables count their own tests
+inline bool CompiledScene::hitPrimitive(const PrimitiveRecord& p, const Ray& r, float tMin, float tMax, HitRecord& rec) const {
+    switch (p.type) {
+        case PRIMITIVE_SPHERE:
+            STAT_INC(primitiveTests[STAT_SPHERE]);
+            return hitSphereRecord(Vector3(p.sphere.center[0], p.sphere.center[1], p.sphere.center[2]), p.sphere.radius,
+                                   r, tMin, tMax, rec);
+        case PRIMITIVE_MOVING_SPHERE:
+            STAT_INC(primitiveTests[STAT_MOVING_SPHERE]);
+            return hitSphereRecord(movingCenter(p, r.time()), p.moving.radius, r, tMin, tMax, rec);
+        case PRIMITIVE_YZ_RECT:
+            STAT_INC(primitiveTests[STAT_RECT]);
+            return hitRectRecord<0>(p, r, tMin, tMax, rec);
+        case PRIMITIVE_XZ_RECT:
+            STAT_INC(primitiveTests[STAT_RECT]);
+            return hitRectRecord<1>(p, r, tMin, tMax, rec);
+        case PRIMITIVE_XY_RECT:
+            STAT_INC(primitiveTests[STAT_RECT]);
+            return hitRectRecord<2>(p, r, tMin, tMax, rec);
+        case PRIMITIVE_BOX:
+            STAT_INC(primitiveTests[STAT_BOX]);
+            return hitBox(Vector3(p.box.min[0], p.box.min[1], p.box.min[2]), Vector3(p.box.max[0], p.box.max[1], p.box.max[2]),
+                          r, tMin, tMax, rec);
+        case PRIMITIVE_SPHERE_SET:
+            return static_cast<const SphereSet*>(p.object)->SphereSet::hit(r, tMin, tMax, rec);
+        case PRIMITIVE_MESH:
+            return static_cast<const TriangleMesh*>(p.object)->TriangleMesh::hit(r, tMin, tMax, rec);
+        case PRIMITIVE_RECT_SET:
+            return static_cast<const RectSet*>(p.object)->RectSet::hit(r, tMin, tMax, rec);
+        case PRIMITIVE_BOX_SET:
+            return static_cast<const BoxSet*>(p.object)->BoxSet::hit(r, tMin, tMax, rec);
+        case PRIMITIVE_INSTANCE:
+            return static_cast<const Transform*>(p.object)->Transform::hit(r, tMin, tMax, rec);
+        default:
+            return p.object->hit(r, tMin, tMax, rec);
+    }
+}
+
+// runs once per ray, for the closest record
+void CompiledScene::surfaceInteraction(const PrimitiveRecord& p, const Ray& r, HitRecord& rec) const {
+    switch (p.type) {
+        case PRIMITIVE_SPHERE: {
+            Vector3 center(p.sphere.center[0], p.sphere.center[1], p.sphere.center[2]);
+            rec.p = r.pointAtParameter(rec.t);
+            rec.normal = (rec.p - center) / p.sphere.radius;
+            getSphereUV(rec.normal, rec.u, rec.v);
+            getSphereTangents(rec.normal, p.sphere.radius, rec.dpdu, rec.dpdv);
+            break;
+        }
+        case PRIMITIVE_MOVING_SPHERE:
+            rec.p = r.pointAtParameter(rec.t);
+            rec.normal = (rec.p - movingCenter(p, r.time())) / p.moving.radius;
+            rec.u = rec.v = 0;
+            rec.dpdu = rec.dpdv = Vector3(0,0,0);
+            break;
+        case PRIMITIVE_YZ_RECT:
+            rectSurface<0>(p, r, rec);
+            break;
+        case PRIMITIVE_XZ_RECT:
+            rectSurface<1>(p, r, rec);
+            break;
+        case PRIMITIVE_XY_RECT:
+            rectSurface<2>(p, r, rec);
+            break;
+        case PRIMITIVE_BOX:
+            boxSurface(Vector3(p.box.min[0], p.box.min[1], p.box.min[2]), Vector3(p.box.max[0], p.box.max[1], p.box.max[2]),
+                       rec.primitive, r, rec);
+            break;
+        default:
+            completeHit(r, rec);
+            break;
+    }
+    if (p.type < PRIMITIVE_SPHERE_SET) {
+        rec.matPtr = p.material;
+        rec.object = NULL;
+        rec.flipped = false;
+    }
+    if (p.flipped)
+        rec.normal = -rec.normal;
+}
+
+bool CompiledScene::hit(const Ray& r, float tMin, float tMax, HitRecord& rec) const {
+    int closest = -1;
+    if (bvh.empty()) {
+        for (size_t i = 0; i < primitives.size(); i++) {
+            if (hitPrimitive(primitives[i], r, tMin, tMax, rec)) {
+                tMax = rec.t;
+                closest = int(i);
+            }
+        }
+    } else {
+        traverseLeafBVH(bvh, r, tMin, tMax, [&](int offset, int count, float t0, float& t1) {
+            bool hitLeaf = false;
+            for (int i = offset; i < offset + count; i++) {
+                if (hitPrimitive(primitives[i], r, t0, t1, rec)) {
+                    t1 = rec.t;
+                    closest = i;
+                    hitLeaf = true;
+                }
+            }
+            return hitLeaf;
+        });
+        for (size_t i = 0; i < unbounded.size(); i++) {
+            if (hitPrimitive(primitives[unbounded[i]], r, tMin, tMax, rec)) {
+                tMax = rec.t;
+                closest = unbounded[i];
+            }
+        }
+    }
+    if (closest < 0)
+        return false;
+    surfaceInteraction(primitives[closest], r, rec);
+    return true;
+}
+
+#endif
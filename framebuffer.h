@@ -0,0 +1,344 @@
+#ifndef FRAMEBUFFERH
+#define FRAMEBUFFERH
+
+#include <ctype.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "stb_image.h"
+#include "stb_image_write.h"
+#include "vector.h"
+
+/*
+    The render target: linear RGB floats straight out of the integrator,
+    row 0 at the top. Nothing is clamped or gamma corrected here, so the
+    float formats keep every value the render produced and an 8-bit image
+    can be made from them later with other tone mapping settings.
+
+    The pixels live in memory, or with map() in an unlinked scratch file
+    next to the output that the OS pages in and out, for images larger
+    than memory.
+*/
+class Framebuffer {
+    public:
+        Framebuffer() : width(0), height(0), pixels(NULL), mapping(NULL), mappedBytes(0) {}
+        Framebuffer(int w, int h) : Framebuffer() { allocate(w, h); }
+        ~Framebuffer() { release(); }
+        void allocate(int w, int h);
+        bool map(int w, int h, const std::string& nextTo);
+        size_t size() const { return size_t(3)*width*height; }
+        void set(int x, int y, const Vector3& c) {
+            float *p = &pixels[3*(size_t(y)*width + x)];
+            p[0] = c[0];
+            p[1] = c[1];
+            p[2] = c[2];
+        }
+        Vector3 get(int x, int y) const {
+            const float *p = &pixels[3*(size_t(y)*width + x)];
+            return Vector3(p[0], p[1], p[2]);
+        }
+
+        int width, height;
+        float *pixels;
+
+    private:
+        Framebuffer(const Framebuffer&);
+        Framebuffer& operator=(const Framebuffer&);
+        void release();
+
+        std::vector<float> storage;
+        void *mapping;
+        size_t mappedBytes;
+};
+
+void Framebuffer::release() {
+    if (mapping)
+        munmap(mapping, mappedBytes);
+    mapping = NULL;
+    mappedBytes = 0;
+    std::vector<float>().swap(storage);
+    pixels = NULL;
+    width = height = 0;
+}
+
+void Framebuffer::allocate(int w, int h) {
+    release();
+    width = w;
+    height = h;
+    storage.assign(size(), 0.0f);
+    pixels = storage.data();
+}
+
+// the scratch file goes next to nextTo, since /tmp is often memory itself
+bool Framebuffer::map(int w, int h, const std::string& nextTo) {
+    release();
+    std::string name = nextTo + ".XXXXXX";
+    std::vector<char> path(name.begin(), name.end());
+    path.push_back(0);
+    int fd = mkstemp(path.data());
+    if (fd < 0)
+        return false;
+    unlink(path.data());
+    size_t bytes = size_t(3)*w*h*sizeof(float);
+    void *p = ftruncate(fd, off_t(bytes)) == 0 ? mmap(NULL, bytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0) : MAP_FAILED;
+    close(fd);
+    if (p == MAP_FAILED)
+        return false;
+    mapping = p;
+    mappedBytes = bytes;
+    width = w;
+    height = h;
+    pixels = (float*)p;
+    return true;
+}
+
+enum ToneMapOperator { TONEMAP_CLAMP, TONEMAP_REINHARD, TONEMAP_ACES };
+
+struct ToneMapSettings {
+    float exposure = 0;  // in stops
+    ToneMapOperator op = TONEMAP_CLAMP;
+    float gamma = 2;
+};
+
+inline bool parseToneMapOperator(const std::string& name, ToneMapOperator& op) {
+    if (name == "clamp")
+        op = TONEMAP_CLAMP;
+    else if (name == "reinhard")
+        op = TONEMAP_REINHARD;
+    else if (name == "aces")
+        op = TONEMAP_ACES;
+    else
+        return false;
+    return true;
+}
+
+// one linear channel value to display range [0,1]
+inline float toneMapValue(float x, const ToneMapSettings& settings, float scale) {
+    x = std::isfinite(x) ? std::max(x*scale, 0.0f) : 0.0f;
+    switch (settings.op) {
+        case TONEMAP_REINHARD:
+            x = x / (1 + x);
+            break;
+        case TONEMAP_ACES:
+            // Narkowicz's fit of the ACES filmic curve
+            x = (x*(2.51f*x + 0.03f)) / (x*(2.43f*x + 0.59f) + 0.14f);
+            break;
+        default:
+            break;
+    }
+    x = std::min(x, 1.0f);
+    return settings.gamma == 1 ? x : powf(x, 1.0f / settings.gamma);
+}
+
+// 8-bit RGB, top row first
+inline std::vector<unsigned char> toneMap(const Framebuffer& image, const ToneMapSettings& settings) {
+    std::vector<unsigned char> out(image.size());
+    float scale = powf(2.0f, settings.exposure);
+    for (size_t i = 0; i < out.size(); i++)
+        out[i] = (unsigned char)(255.99f*toneMapValue(image.pixels[i], settings, scale));
+    return out;
+}
+
+inline bool hasExtension(const std::string& fileName, const char *extension) {
+    size_t n = strlen(extension);
+    if (fileName.size() < n)
+        return false;
+    for (size_t i = 0; i < n; i++) {
+        if (tolower(fileName[fileName.size() - n + i]) != extension[i])
+            return false;
+    }
+    return true;
+}
+
+// little-endian PFM, which stores its rows bottom first
+inline std::string pfmHeader(int width, int height) {
+    return "PF\n" + std::to_string(width) + " " + std::to_string(height) + "\n-1.0\n";
+}
+
+inline bool writePFM(const Framebuffer& image, const std::string& fileName) {
+    FILE *out = fopen(fileName.c_str(), "wb");
+    if (out == NULL)
+        return false;
+    std::string header = pfmHeader(image.width, image.height);
+    bool ok = fwrite(header.data(), 1, header.size(), out) == header.size();
+    for (int y = image.height - 1; ok && y >= 0; y--)
+        ok = fwrite(&image.pixels[size_t(3)*y*image.width], sizeof(float)*3, image.width, out) == size_t(image.width);
+    return fclose(out) == 0 && ok;
+}
+
+inline bool readPFM(const std::string& fileName, Framebuffer& image) {
+    FILE *in = fopen(fileName.c_str(), "rb");
+    if (in == NULL)
+        return false;
+    char kind[3] = { 0 };
+    int w, h;
+    float scale;
+    bool ok = fscanf(in, "%2s %d %d %f", kind, &w, &h, &scale) == 4 && strcmp(kind, "PF") == 0 && w > 0 && h > 0 && scale < 0;
+    ok = ok && fgetc(in) != EOF; // the single whitespace before the data
+    if (ok) {
+        image.allocate(w, h);
+        for (int y = h - 1; ok && y >= 0; y--)
+            ok = fread(&image.pixels[size_t(3)*y*w], sizeof(float)*3, w, in) == size_t(w);
+    }
+    fclose(in);
+    return ok;
+}
+
+inline bool writeHDR(const Framebuffer& image, const std::string& fileName) {
+    return stbi_write_hdr(fileName.c_str(), image.width, image.height, 3, image.pixels) != 0;
+}
+
+inline uint16_t floatToHalf(float f) {
+    uint32_t x;
+    memcpy(&x, &f, 4);
+    uint32_t sign = (x >> 16) & 0x8000;
+    int exponent = int((x >> 23) & 0xff);
+    uint32_t mantissa = x & 0x7fffff;
+    if (exponent == 0xff)
+        return uint16_t(sign | 0x7c00 | (mantissa ? 0x200 : 0));
+    exponent += 15 - 127;
+    if (exponent >= 31)
+        return uint16_t(sign | 0x7c00);
+    if (exponent <= 0) {
+        // denormal, or too small for a half
+        if (exponent < -10)
+            return uint16_t(sign);
+        mantissa |= 0x800000;
+        int shift = 14 - exponent;
+        uint32_t h = mantissa >> shift;
+        if ((mantissa >> (shift - 1)) & 1)
+            h++;
+        return uint16_t(sign | h);
+    }
+    // a rounding carry out of the mantissa moves correctly into the exponent
+    uint32_t h = (uint32_t(exponent) << 10) | (mantissa >> 13);
+    if (mantissa & 0x1000)
+        h++;
+    return uint16_t(sign | h);
+}
+
+/*
+    OpenEXR with half float B, G, R channels, uncompressed, one scanline
+    per block: the smallest file every EXR reader has to understand. Every
+    block has the same size, so where each pixel goes is known up front:
+    the header and line offset table come first, then line y's block at
+    exrLineStart(), holding y, its byte count and the B, G and R halves of
+    the line one channel after another.
+*/
+inline std::vector<unsigned char> exrHeader(int width, int height) {
+    std::vector<unsigned char> header;
+    auto bytes = [&](const void *p, size_t n) { header.insert(header.end(), (const unsigned char*)p, (const unsigned char*)p + n); };
+    auto int32 = [&](int32_t v) { bytes(&v, 4); };
+    auto text = [&](const char *s) { bytes(s, strlen(s) + 1); };
+    auto attribute = [&](const char *name, const char *type, int32_t size) { text(name); text(type); int32(size); };
+
+    int32(20000630);
+    int32(2);
+    const char *channels[3] = { "B", "G", "R" }; // names sorted, as the format requires
+    attribute("channels", "chlist", 3*(2 + 16) + 1);
+    for (int c = 0; c < 3; c++) {
+        text(channels[c]);
+        int32(1);   // HALF
+        int32(0);   // pLinear and reserved bytes
+        int32(1);   // x sampling
+        int32(1);   // y sampling
+    }
+    header.push_back(0);
+    attribute("compression", "compression", 1);
+    header.push_back(0);
+    int32_t window[4] = { 0, 0, width - 1, height - 1 };
+    attribute("dataWindow", "box2i", 16);
+    bytes(window, 16);
+    attribute("displayWindow", "box2i", 16);
+    bytes(window, 16);
+    attribute("lineOrder", "lineOrder", 1);
+    header.push_back(0);
+    float one = 1, zero[2] = { 0, 0 };
+    attribute("pixelAspectRatio", "float", 4);
+    bytes(&one, 4);
+    attribute("screenWindowCenter", "v2f", 8);
+    bytes(zero, 8);
+    attribute("screenWindowWidth", "float", 4);
+    bytes(&one, 4);
+    header.push_back(0);
+
+    uint64_t offset = header.size() + size_t(height)*8;
+    for (int y = 0; y < height; y++) {
+        bytes(&offset, 8);
+        offset += 8 + size_t(width)*3*2;
+    }
+    return header;
+}
+
+inline uint64_t exrLineStart(size_t headerSize, int width, int y) {
+    return headerSize + uint64_t(y)*(8 + uint64_t(width)*3*2);
+}
+
+inline bool writeEXR(const Framebuffer& image, const std::string& fileName) {
+    std::vector<unsigned char> header = exrHeader(image.width, image.height);
+    size_t lineBytes = size_t(image.width)*3*2;
+    FILE *out = fopen(fileName.c_str(), "wb");
+    if (out == NULL)
+        return false;
+    bool ok = fwrite(header.data(), 1, header.size(), out) == header.size();
+    std::vector<uint16_t> line(size_t(image.width)*3);
+    for (int y = 0; ok && y < image.height; y++) {
+        const float *row = &image.pixels[size_t(3)*y*image.width];
+        for (int c = 0; c < 3; c++) {
+            for (int x = 0; x < image.width; x++)
+                line[size_t(c)*image.width + x] = floatToHalf(row[3*x + 2 - c]);
+        }
+        int32_t block[2] = { y, int32_t(lineBytes) };
+        ok = fwrite(block, 4, 2, out) == 2 && fwrite(line.data(), 1, lineBytes, out) == lineBytes;
+    }
+    return fclose(out) == 0 && ok;
+}
+
+/*
+    Writes image in the format its extension names: .pfm, .hdr and .exr
+    keep the linear floats, .png, .bmp, .tga and .jpg (anything else) get
+    the tone mapped 8-bit version.
+*/
+inline bool writeImage(const Framebuffer& image, const std::string& fileName, const ToneMapSettings& settings) {
+    if (hasExtension(fileName, ".pfm"))
+        return writePFM(image, fileName);
+    if (hasExtension(fileName, ".hdr"))
+        return writeHDR(image, fileName);
+    if (hasExtension(fileName, ".exr"))
+        return writeEXR(image, fileName);
+    std::vector<unsigned char> ldr = toneMap(image, settings);
+    if (hasExtension(fileName, ".png"))
+        return stbi_write_png(fileName.c_str(), image.width, image.height, 3, ldr.data(), image.width*3) != 0;
+    if (hasExtension(fileName, ".bmp"))
+        return stbi_write_bmp(fileName.c_str(), image.width, image.height, 3, ldr.data()) != 0;
+    if (hasExtension(fileName, ".tga"))
+        return stbi_write_tga(fileName.c_str(), image.width, image.height, 3, ldr.data()) != 0;
+    return stbi_write_jpg(fileName.c_str(), image.width, image.height, 3, ldr.data(), 100) != 0;
+}
+
+// a float image written earlier, to tone map again without rendering
+inline bool readImage(const std::string& fileName, Framebuffer& image) {
+    if (hasExtension(fileName, ".pfm"))
+        return readPFM(fileName, image);
+    if (!hasExtension(fileName, ".hdr"))
+        return false;
+    int w, h, n;
+    float *data = stbi_loadf(fileName.c_str(), &w, &h, &n, 3);
+    if (data == NULL)
+        return false;
+    image.allocate(w, h);
+    std::copy(data, data + image.size(), image.pixels);
+    stbi_image_free(data);
+    return true;
+}
+
+#endif
@@ -0,0 +1,251 @@
+#ifndef GRIDMEDIUMH
+#define GRIDMEDIUMH
+
+#include <stdio.h>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "hitable.h"
+#include "material.h"
+#include "box.h"
+#include "perlin.h"
+
+/*
+    Density voxels over an axis-aligned box, stored as 8x8x8 bricks. Bricks
+    that were never written hold no memory and read as zero, so a large grid
+    with a small plume in it stays small. Each brick also keeps a majorant:
+    the largest density any lookup inside it can return.
+*/
+class DensityGrid {
+    public:
+        static const int brickSize = 8;
+
+        DensityGrid() : nx(0), ny(0), nz(0) {}
+        DensityGrid(int _nx, int _ny, int _nz, const AABB& _bounds);
+        void set(int x, int y, int z, float density);
+        float voxel(int x, int y, int z) const;
+        float lookup(const Vector3& p) const;
+        void buildMajorants();
+
+        int nx, ny, nz;
+        int bx, by, bz; // bricks along each axis
+        AABB bounds;
+        std::vector<int> brickIndex; // -1 for bricks that are empty
+        std::vector<float> bricks;
+        std::vector<float> majorant;
+};
+
+DensityGrid::DensityGrid(int _nx, int _ny, int _nz, const AABB& _bounds) :
+    nx(_nx), ny(_ny), nz(_nz), bounds(_bounds) {
+    bx = (nx + brickSize - 1) / brickSize;
+    by = (ny + brickSize - 1) / brickSize;
+    bz = (nz + brickSize - 1) / brickSize;
+    brickIndex.assign(bx*by*bz, -1);
+}
+
+void DensityGrid::set(int x, int y, int z, float density) {
+    int b = ((z/brickSize)*by + y/brickSize)*bx + x/brickSize;
+    if (brickIndex[b] < 0) {
+        if (density == 0)
+            return;
+        brickIndex[b] = int(bricks.size() / (brickSize*brickSize*brickSize));
+        bricks.resize(bricks.size() + brickSize*brickSize*brickSize, 0);
+    }
+    bricks[brickIndex[b]*brickSize*brickSize*brickSize + ((z%brickSize)*brickSize + y%brickSize)*brickSize + x%brickSize] = density;
+}
+
+inline float DensityGrid::voxel(int x, int y, int z) const {
+    int b = brickIndex[((z/brickSize)*by + y/brickSize)*bx + x/brickSize];
+    if (b < 0)
+        return 0;
+    return bricks[b*brickSize*brickSize*brickSize + ((z%brickSize)*brickSize + y%brickSize)*brickSize + x%brickSize];
+}
+
+// trilinear between voxel centres, clamped at the edges
+float DensityGrid::lookup(const Vector3& p) const {
+    int n[3] = { nx, ny, nz };
+    int i0[3], i1[3];
+    float f[3];
+    for (int a = 0; a < 3; a++) {
+        float g = (p[a] - bounds.min()[a]) / (bounds.max()[a] - bounds.min()[a]) * n[a] - 0.5f;
+        float fl = floor(g);
+        f[a] = g - fl;
+        i0[a] = int(fl);
+        i1[a] = i0[a] + 1;
+        i0[a] = i0[a] < 0 ? 0 : (i0[a] >= n[a] ? n[a]-1 : i0[a]);
+        i1[a] = i1[a] < 0 ? 0 : (i1[a] >= n[a] ? n[a]-1 : i1[a]);
+    }
+    float c00 = voxel(i0[0], i0[1], i0[2])*(1-f[0]) + voxel(i1[0], i0[1], i0[2])*f[0];
+    float c10 = voxel(i0[0], i1[1], i0[2])*(1-f[0]) + voxel(i1[0], i1[1], i0[2])*f[0];
+    float c01 = voxel(i0[0], i0[1], i1[2])*(1-f[0]) + voxel(i1[0], i0[1], i1[2])*f[0];
+    float c11 = voxel(i0[0], i1[1], i1[2])*(1-f[0]) + voxel(i1[0], i1[1], i1[2])*f[0];
+    float c0 = c00*(1-f[1]) + c10*f[1];
+    float c1 = c01*(1-f[1]) + c11*f[1];
+    return c0*(1-f[2]) + c1*f[2];
+}
+
+void DensityGrid::buildMajorants() {
+    // interpolation inside a brick also reads the voxels one step outside it
+    majorant.assign(bx*by*bz, 0);
+    for (int k = 0; k < bz; k++) {
+        for (int j = 0; j < by; j++) {
+            for (int i = 0; i < bx; i++) {
+                float m = 0;
+                for (int z = std::max(k*brickSize-1, 0); z < std::min((k+1)*brickSize+1, nz); z++) {
+                    for (int y = std::max(j*brickSize-1, 0); y < std::min((j+1)*brickSize+1, ny); y++) {
+                        for (int x = std::max(i*brickSize-1, 0); x < std::min((i+1)*brickSize+1, nx); x++)
+                            m = ffmax(m, voxel(x, y, z));
+                    }
+                }
+                majorant[(k*by + j)*bx + i] = m;
+            }
+        }
+    }
+}
+
+/*
+    Heterogeneous participating medium over a DensityGrid. Collisions are
+    found with delta tracking against the brick majorants: the ray walks the
+    brick grid with a DDA, steps over bricks whose majorant is zero, and
+    inside the others samples tentative collisions at the brick's majorant
+    rate, accepting each with probability density/majorant.
+*/
+class GridMedium : public Hitable {
+    public:
+        GridMedium(const DensityGrid& g, float scale, Texture *a) : grid(g), densityScale(scale), phase(a), phaseFunction(&phase) {
+            grid.buildMajorants();
+        }
+        // a copy would point phaseFunction at the original's phase
+        GridMedium(const GridMedium&) = delete;
+        GridMedium& operator=(const GridMedium&) = delete;
+        virtual bool hit(const Ray& r, float tMin, float tMax, HitRecord& rec) const;
+        virtual bool boundingBox(float t0, float t1, AABB& box) const {
+            box = grid.bounds;
+            return true;
+        }
+
+        DensityGrid grid;
+        float densityScale;
+        Isotropic phase;
+        Material *phaseFunction;
+};
+
+bool GridMedium::hit(const Ray& r, float tMin, float tMax, HitRecord& rec) const {
+    STAT_INC(primitiveTests[STAT_MEDIUM]);
+    float tNear, tFar;
+    int nearAxis, farAxis;
+    if (!boxSlabs(grid.bounds.min(), grid.bounds.max(), r, tNear, tFar, nearAxis, farAxis))
+        return false;
+    float t0 = ffmax(tNear, tMin);
+    float t1 = ffmin(tFar, tMax);
+    if (t0 >= t1)
+        return false;
+
+    // DDA setup over the brick grid, starting in the brick that contains t0.
+    // A brick is brickSize voxels wide, so the last one can reach past the
+    // bounds; crossing it ends at t1 instead
+    int n[3] = { grid.nx, grid.ny, grid.nz };
+    int nBricks[3] = { grid.bx, grid.by, grid.bz };
+    int cell[3], step[3];
+    float tNext[3], tDelta[3];
+    Vector3 start = r.pointAtParameter(t0);
+    for (int a = 0; a < 3; a++) {
+        float size = DensityGrid::brickSize * (grid.bounds.max()[a] - grid.bounds.min()[a]) / n[a];
+        int c = int((start[a] - grid.bounds.min()[a]) / size);
+        cell[a] = c < 0 ? 0 : (c >= nBricks[a] ? nBricks[a]-1 : c);
+        float d = r.direction()[a];
+        if (d > 0) {
+            step[a] = 1;
+            tNext[a] = (grid.bounds.min()[a] + (cell[a]+1)*size - r.origin()[a]) / d;
+            tDelta[a] = size / d;
+        } else if (d < 0) {
+            step[a] = -1;
+            tNext[a] = (grid.bounds.min()[a] + cell[a]*size - r.origin()[a]) / d;
+            tDelta[a] = -size / d;
+        } else {
+            step[a] = 0;
+            tNext[a] = FLT_MAX;
+            tDelta[a] = FLT_MAX;
+        }
+    }
+
+    float invLength = 1 / r.direction().length();
+    float t = t0;
+    while (true) {
+        int axis = tNext[0] < tNext[1] ? (tNext[0] < tNext[2] ? 0 : 2) : (tNext[1] < tNext[2] ? 1 : 2);
+        float tExit = ffmin(tNext[axis], t1); // clamped, for the last partial brick
+        float m = grid.majorant[(cell[2]*grid.by + cell[1])*grid.bx + cell[0]] * densityScale;
+        if (m > 0) {
+            while (true) {
+                t -= log(1 - randomFloat()) * invLength / m;
+                if (t >= tExit)
+                    break;
+                Vector3 p = r.pointAtParameter(t);
+                if (randomFloat() * m < grid.lookup(p) * densityScale) {
+                    rec.t = t;
+                    rec.p = p;
+                    rec.normal = Vector3(1,0,0); // arbitrary
+                    rec.matPtr = phaseFunction;
+                    rec.u = rec.v = 0;
+                    rec.dpdu = rec.dpdv = Vector3(0,0,0);
+                    rec.object = NULL;
+                    return true;
+                }
+            }
+        }
+        // free flight is memoryless, so tracking restarts cleanly at the brick boundary
+        if (tExit >= t1)
+            return false;
+        t = tExit;
+        cell[axis] += step[axis];
+        if (cell[axis] < 0 || cell[axis] >= nBricks[axis])
+            return false;
+        tNext[axis] += tDelta[axis];
+    }
+}
+
+// a turbulent column of smoke rising from the middle of the floor of the grid and widening as it climbs
+void plumeDensity(DensityGrid& g, int octaves = 5) {
+    Perlin noise;
+    for (int z = 0; z < g.nz; z++) {
+        for (int y = 0; y < g.ny; y++) {
+            for (int x = 0; x < g.nx; x++) {
+                Vector3 p((x + 0.5f) / g.nx, (y + 0.5f) / g.ny, (z + 0.5f) / g.nz);
+                float h = p.y();
+                float swayX = 0.08f*sin(6*h), swayZ = 0.08f*cos(5*h);
+                float dx = p.x() - 0.5f - swayX*h, dz = p.z() - 0.5f - swayZ*h;
+                float radius = 0.1f + 0.3f*h;
+                float falloff = 1 - sqrt(dx*dx + dz*dz) / radius;
+                if (falloff <= 0)
+                    continue;
+                float d = falloff * (1 - h) * noise.turbulence(p*6, octaves);
+                g.set(x, y, z, d);
+            }
+        }
+    }
+}
+
+// nx*ny*nz raw 32-bit floats in native byte order, x varying fastest
+bool loadDensityRaw(const std::string& fileName, DensityGrid& g) {
+    FILE *in = fopen(fileName.c_str(), "rb");
+    if (in == NULL) {
+        std::cerr << "Error: could not open " << fileName << std::endl;
+        return false;
+    }
+    std::vector<float> row(g.nx);
+    bool ok = true;
+    for (int z = 0; z < g.nz && ok; z++) {
+        for (int y = 0; y < g.ny && ok; y++) {
+            ok = fread(row.data(), sizeof(float), row.size(), in) == row.size();
+            for (int x = 0; x < g.nx && ok; x++)
+                g.set(x, y, z, row[x] > 0 ? row[x] : 0);
+        }
+    }
+    fclose(in);
+    if (!ok)
+        std::cerr << "Error: " << fileName << " holds fewer than " << g.nx << "x" << g.ny << "x" << g.nz << " densities" << std::endl;
+    return ok;
+}
+
+#endif
@@ -1,26 +1,123 @@
 #ifndef HITABLEH
 #define HITABLEH
 
+#include "arena.h"
 #include "ray.h"
 #include "aabb.h"
 #include "float.h"
 
 class Material;
 
+/*
+    hit() only has to fill in t. Primitives that defer the rest also set object,
+    and whatever they need later in primitive and b0/b1 (barycentric or local
+    coordinates); completeHit then calls object->computeSurfaceInteraction once,
+    for the closest hit only, to fill in p, normal, matPtr, u and v, and the
+    surface derivatives dpdu/dpdv that texture filtering needs. An instance
+    that defers its child's hit becomes object itself and keeps the child in
+    instances[] at its nesting depth, so the chain is walked on completion.
+*/
 struct HitRecord {
+    static const int maxInstanceDepth = 4; // instances nested deeper complete their hits at once
+
+    HitRecord() : object(NULL), flipped(false), instanceDepth(0) {}
+
     float t;
     Vector3 p;
     Vector3 normal;
     Material *matPtr;
     float u, v;
+    Vector3 dpdu, dpdv;          // zero where the surface has no uv parameterisation
+    float uvWidth;               // texture footprint, set by the caller from ray differentials (0 = point sample)
+
+    const class Hitable *object; // pending surface interaction, NULL once everything is filled in
+    int primitive;
+    float b0, b1;
+    bool flipped;                // negate the normal when the interaction is computed
+    int instanceDepth;           // instances entered by the current query or completion, 0 outside them
+    const class Hitable *instances[maxInstanceDepth]; // the pending child of the instance at each depth
 };
 
 class Hitable {
     public:
     virtual bool hit(const Ray& r, float tMin, float tMax, HitRecord& rec) const = 0;
     virtual bool boundingBox(float t0, float t1, AABB& box) const = 0;
+    virtual void computeSurfaceInteraction(const Ray& r, HitRecord& rec) const {}
+    virtual bool hitInterval(const Ray& r, float tMin, float tMax, float& tEnter, float& tExit) const;
 };
 
+/*
+    Entry and exit of the first span of r inside the object that overlaps
+    [tMin, tMax]. The bounds are not clamped, so tEnter is behind tMin when
+    the ray starts inside. This fallback finds them with two closest-hit
+    queries; shapes that know their own span override it.
+*/
+bool Hitable::hitInterval(const Ray& r, float tMin, float tMax, float& tEnter, float& tExit) const {
+    HitRecord rec1, rec2;
+    if (!hit(r, -FLT_MAX, FLT_MAX, rec1) || !hit(r, rec1.t+0.0001, FLT_MAX, rec2))
+        return false;
+    tEnter = rec1.t;
+    tExit = rec2.t;
+    return tExit > tMin && tEnter < tMax;
+}
+
+// folds a child's span into the span found so far: the earlier entry wins, and
+// the other child's entry can cut its exit short, like a second surface hit would
+inline void mergeInterval(bool& found, float& tEnter, float& tExit, float childEnter, float childExit) {
+    if (!found) {
+        tEnter = childEnter;
+        tExit = childExit;
+        found = true;
+    } else if (childEnter < tEnter) {
+        tExit = ffmin(childExit, tEnter);
+        tEnter = childEnter;
+    } else {
+        tExit = ffmin(tExit, childEnter);
+    }
+}
+
+// r must be the ray as the deferring object saw it
+inline void completeHit(const Ray& r, HitRecord& rec) {
+    if (rec.object) {
+        rec.object->computeSurfaceInteraction(r, rec);
+        if (rec.flipped)
+            rec.normal = -rec.normal;
+        rec.object = NULL;
+        rec.flipped = false;
+    }
+}
+
+/*
+    Width in uv of the patch a pixel covers at the hit: the differential rays
+    meet the tangent plane, and the steps from rec.p are projected onto
+    dpdu/dpdv by least squares. The larger of the x and y steps is kept.
+*/
+inline float uvFootprint(const RayDifferential& d, const HitRecord& rec) {
+    float uu = dot(rec.dpdu, rec.dpdu);
+    float uv = dot(rec.dpdu, rec.dpdv);
+    float vv = dot(rec.dpdv, rec.dpdv);
+    float det = uu*vv - uv*uv;
+    if (det < 1e-12f)
+        return 0;
+    float planeD = dot(rec.normal, rec.p);
+    const Vector3 *origins[2] = { &d.rxOrigin, &d.ryOrigin };
+    const Vector3 *directions[2] = { &d.rxDirection, &d.ryDirection };
+    float width = 0;
+    for (int k = 0; k < 2; k++) {
+        float dn = dot(rec.normal, *directions[k]);
+        if (dn == 0)
+            return 0;
+        float t = (planeD - dot(rec.normal, *origins[k])) / dn;
+        Vector3 dp = *origins[k] + t * *directions[k] - rec.p;
+        float bu = dot(rec.dpdu, dp);
+        float bv = dot(rec.dpdv, dp);
+        float du = (vv*bu - uv*bv) / det;
+        float dv = (uu*bv - uv*bu) / det;
+        width = ffmax(width, sqrt(du*du + dv*dv));
+    }
+    return width;
+}
+
 int boxXCompare (const void * a, const void *b) {
     AABB boxLeft, boxRight;
     Hitable *ah = *(Hitable**)a;
@@ -60,8 +157,9 @@ int boxZCompare (const void * a, const void *b) {
 class BVHNode : public Hitable {
     public:
         BVHNode() {}
-        BVHNode(Hitable **l, int n , float time0, float time1);
+        BVHNode(Hitable **l, int n , float time0, float time1, SceneArena *arena = NULL);
         virtual bool hit(const Ray& r, float tmin, float tmax, HitRecord& rec) const;
+        virtual bool hitInterval(const Ray& r, float tMin, float tMax, float& tEnter, float& tExit) const;
         virtual bool boundingBox(float t0, float t1, AABB& box) const;
         Hitable *left;
         Hitable *right;
@@ -73,7 +171,7 @@ bool BVHNode::boundingBox(float t0, float t1, AABB& b) const {
     return true;
 }
 
-BVHNode::BVHNode(Hitable **l, int n, float time0, float time1) {
+BVHNode::BVHNode(Hitable **l, int n, float time0, float time1, SceneArena *arena) {
     int axis = int(3*drand48());
     if (axis == 0)
         qsort(l, n, sizeof(Hitable *), boxXCompare);
@@ -87,6 +185,9 @@ BVHNode::BVHNode(Hitable **l, int n, float time0, float time1) {
     } else if (n == 2) {
         left = l[0];
         right = l[1];
+    } else if (arena) {
+        left = arena->make<BVHNode>(l, n/2, time0, time1, arena);
+        right = arena->make<BVHNode>(l + n/2, n-n/2, time0, time1, arena);
     } else {
         left = new BVHNode(l, n/2, time0, time1);
         right = new BVHNode(l + n/2, n-n/2, time0, time1);
@@ -99,7 +200,9 @@ BVHNode::BVHNode(Hitable **l, int n, float time0, float time1) {
 
 bool BVHNode::hit(const Ray& r, float tMin, float tMax, HitRecord& rec) const {
     if (box.hit(r, tMin, tMax)) {
+        STAT_INC(nodesVisited);
         HitRecord leftRec, rightRec;
+        leftRec.instanceDepth = rightRec.instanceDepth = rec.instanceDepth;
         bool hitLeft = left->hit(r, tMin, tMax, leftRec);
         bool hitRight = right->hit(r, tMin, tMax, rightRec);
         if (hitLeft && hitRight) {
@@ -120,17 +223,35 @@ bool BVHNode::hit(const Ray& r, float tMin, float tMax, HitRecord& rec) const {
         return false;
 }
 
+bool BVHNode::hitInterval(const Ray& r, float tMin, float tMax, float& tEnter, float& tExit) const {
+    if (!box.hit(r, tMin, tMax))
+        return false;
+    bool found = false;
+    float t0, t1;
+    if (left->hitInterval(r, tMin, tMax, t0, t1))
+        mergeInterval(found, tEnter, tExit, t0, t1);
+    if (right != left && right->hitInterval(r, tMin, tMax, t0, t1))
+        mergeInterval(found, tEnter, tExit, t0, t1);
+    return found;
+}
+
 class FlipNormals : public Hitable {
     public:
         FlipNormals(Hitable *p) : ptr(p) {}
         virtual bool hit(const Ray& r, float tMin, float tMax, HitRecord& rec) const {
             if (ptr->hit(r, tMin, tMax, rec)) {
-                rec.normal = -rec.normal;
+                if (rec.object)
+                    rec.flipped = !rec.flipped;
+                else
+                    rec.normal = -rec.normal;
                 return true;
             } else {
                 return false;
             }
         }
+        virtual bool hitInterval(const Ray& r, float tMin, float tMax, float& tEnter, float& tExit) const {
+            return ptr->hitInterval(r, tMin, tMax, tEnter, tExit);
+        }
         virtual bool boundingBox(float t0, float t1, AABB& box) const {
             return ptr->boundingBox(t0, t1, box);
         }
@@ -138,98 +259,4 @@ class FlipNormals : public Hitable {
         Hitable *ptr;
 };
 
-class Translate : public Hitable {
-    public:
-        Translate(Hitable *p, const Vector3& displacement) : ptr(p), offset(displacement) {}
-        virtual bool hit(const Ray& r, float tMin, float tMax, HitRecord& rec) const;
-        virtual bool boundingBox(float t0, float t1, AABB& box) const;
-        Hitable *ptr;
-        Vector3 offset;
-};
-
-bool Translate::hit(const Ray& r, float tMin, float tMax, HitRecord& rec) const {
-    Ray movedR(r.origin() - offset, r.direction(), r.time());
-    if (ptr->hit(movedR, tMin, tMax, rec)) {
-        rec.p += offset;
-        return true;
-    } else {
-        return false;
-    }
-}
-
-bool Translate::boundingBox(float t0, float t1, AABB& box) const {
-    if (ptr->boundingBox(t0, t1, box)) {
-        box = AABB(box.min() + offset, box.max() + offset);
-        return true;
-    } else {
-        return false;
-    }
-}
-
-class RotateY : public Hitable {
-    public:
-        RotateY(Hitable *p, float angle);
-        virtual bool hit(const Ray& r, float tMin, float tMax, HitRecord& rec) const;
-        virtual bool boundingBox(float t0, float t1, AABB& box) const {
-            box = bBox; return hasBox;
-        }
-        Hitable *ptr;
-        float sinTheta;
-        float cosTheta;
-        bool hasBox;
-        AABB bBox;
-};
-
-RotateY::RotateY(Hitable *p, float angle) : ptr(p) {
-    float radians = (M_PI / 180) * angle;
-    sinTheta = sin(radians);
-    cosTheta = cos(radians);
-    hasBox = ptr->boundingBox(0, 1, bBox);
-    Vector3 min(FLT_MAX, FLT_MAX, FLT_MAX);
-    Vector3 max(-FLT_MAX, -FLT_MAX, -FLT_MAX);
-    for (int i=0; i < 2; i++) {
-        for (int j = 0; j < 2; j++) {
-            for (int k=0; k < 2; k++) {
-                float x = i*bBox.max().x() + (1-i)*bBox.min().x();
-                float y = j*bBox.max().y() + (1-j)*bBox.min().y();
-                float z = k*bBox.max().z() + (1-k)*bBox.min().z();
-                float newx = cosTheta*x + sinTheta*z;
-                float newz = -sinTheta*x + cosTheta*z;
-                Vector3 tester(newx, y, newz);
-                for (int c = 0; c < 3; c++) {
-                    if (tester[c] > max[c])
-                        max[c] = tester[c];
-                    if (tester[c] < min[c])
-                        min[c] = tester[c];
-                }
-            }
-        }
-    }
-    bBox = AABB(min, max);
-}
-
-bool RotateY::hit(const Ray& r, float tMin, float tMax, HitRecord& rec) const {
-    Vector3 origin = r.origin();
-    Vector3 direction = r.direction();
-    origin[0] = cosTheta*r.origin()[0] - sinTheta*r.origin()[2];
-    origin[2] = sinTheta*r.origin()[0] + cosTheta*r.origin()[2];
-    direction[0] = cosTheta*r.direction()[0] - sinTheta*r.direction()[2];
-    direction[2] = sinTheta*r.direction()[0] + cosTheta*r.direction()[2];
-    Ray rotatedR(origin, direction, r.time());
-
-    if (ptr->hit(rotatedR, tMin, tMax, rec)) {
-        Vector3 p = rec.p;
-        Vector3 normal = rec.normal;
-        p[0] = cosTheta*rec.p[0] + sinTheta*rec.p[2];
-        p[2] = -sinTheta*rec.p[0] + cosTheta*rec.p[2];
-        normal[0] = cosTheta*rec.normal[0] + sinTheta*rec.normal[2];
-        normal[2] = -sinTheta*rec.normal[0] + cosTheta*rec.normal[2];
-        rec.p = p;
-        rec.normal = normal;
-        return true;
-    } else {
-        return false;
-    }
-}
-
 #endif
\ No newline at end of file
@@ -8,6 +8,7 @@ class HitableList: public Hitable {
         HitableList() {}
         HitableList(Hitable **l, int n) {list = l; listSize = n; }
         virtual bool hit(const Ray& r, float tMin, float tMax, HitRecord& rec) const;
+        virtual bool hitInterval(const Ray& r, float tMin, float tMax, float& tEnter, float& tExit) const;
         virtual bool boundingBox(float t0, float t1, AABB& box) const;
         Hitable **list;
         int listSize;
@@ -15,6 +16,7 @@ class HitableList: public Hitable {
 
 bool HitableList::hit(const Ray& r, float tMin, float tMax, HitRecord& rec) const {
     HitRecord tempRec;
+    tempRec.instanceDepth = rec.instanceDepth; // an instance inside keeps its child at the right depth
     bool hitAnything = false;
     double closestSoFar = tMax;
     for (int i = 0; i < listSize; i++) {
@@ -27,6 +29,16 @@ bool HitableList::hit(const Ray& r, float tMin, float tMax, HitRecord& rec) cons
     return hitAnything;
 }
 
+bool HitableList::hitInterval(const Ray& r, float tMin, float tMax, float& tEnter, float& tExit) const {
+    bool found = false;
+    float t0, t1;
+    for (int i = 0; i < listSize; i++) {
+        if (list[i]->hitInterval(r, tMin, tMax, t0, t1))
+            mergeInterval(found, tEnter, tExit, t0, t1);
+    }
+    return found;
+}
+
 bool HitableList::boundingBox(float t0, float t1, AABB& box) const {
     if (listSize < 1 ) return false;
 
@@ -38,7 +50,7 @@ bool HitableList::boundingBox(float t0, float t1, AABB& box) const {
         box = tempBox;
 
     for (int i = 1; i < listSize; i++) {
-        if (list[0]->boundingBox(t0, t1, tempBox)) {
+        if (list[i]->boundingBox(t0, t1, tempBox)) {
             box = surroundingBox(box, tempBox);
         } else
             return false;
@@ -0,0 +1,241 @@
+#ifndef JSONH
+#define JSONH
+
+#include <stdlib.h>
+#include <string.h>
+
+#include <sstream>
+#include <string>
+#include <utility>
+#include <vector>
+
+enum JsonType { JSON_NULL, JSON_BOOL, JSON_NUMBER, JSON_STRING, JSON_ARRAY, JSON_OBJECT };
+
+/*
+    A parsed JSON value. Objects keep their members in file order; get()
+    looks one up by key and returns NULL when it is missing. line is where
+    the value started, for error messages.
+*/
+class JsonValue {
+    public:
+        JsonValue() : type(JSON_NULL), boolean(false), number(0), line(0) {}
+        const JsonValue *get(const std::string& key) const;
+        bool isNumber() const { return type == JSON_NUMBER; }
+        bool isString() const { return type == JSON_STRING; }
+        bool isArray() const { return type == JSON_ARRAY; }
+        bool isObject() const { return type == JSON_OBJECT; }
+
+        JsonType type;
+        bool boolean;
+        double number;
+        std::string string;
+        std::vector<JsonValue> items;
+        std::vector<std::pair<std::string, JsonValue> > members;
+        int line;
+};
+
+const JsonValue *JsonValue::get(const std::string& key) const {
+    for (size_t i = 0; i < members.size(); i++) {
+        if (members[i].first == key)
+            return &members[i].second;
+    }
+    return NULL;
+}
+
+/*
+    Recursive descent over the whole text. Besides strict JSON it accepts
+    // comments to the end of a line, since scene files are written by hand.
+*/
+class JsonParser {
+    public:
+        JsonParser(const std::string& t) : text(t), pos(0), line(1) {}
+        bool parse(JsonValue& value);
+
+        std::string error;
+
+    private:
+        bool parseValue(JsonValue& value);
+        bool parseString(std::string& s);
+        bool parseNumber(double& d);
+        bool fail(const std::string& message);
+        void skipSpace();
+        bool literal(const char *word);
+
+        const std::string& text;
+        size_t pos;
+        int line;
+};
+
+bool JsonParser::fail(const std::string& message) {
+    std::ostringstream out;
+    out << "line " << line << ": " << message;
+    error = out.str();
+    return false;
+}
+
+void JsonParser::skipSpace() {
+    while (pos < text.size()) {
+        char c = text[pos];
+        if (c == '\n') {
+            line++;
+            pos++;
+        } else if (c == ' ' || c == '\t' || c == '\r') {
+            pos++;
+        } else if (c == '/' && pos + 1 < text.size() && text[pos+1] == '/') {
+            while (pos < text.size() && text[pos] != '\n')
+                pos++;
+        } else {
+            break;
+        }
+    }
+}
+
+bool JsonParser::literal(const char *word) {
+    size_t n = strlen(word);
+    if (text.compare(pos, n, word) != 0)
+        return false;
+    pos += n;
+    return true;
+}
+
+bool JsonParser::parse(JsonValue& value) {
+    if (!parseValue(value))
+        return false;
+    skipSpace();
+    if (pos != text.size())
+        return fail("unexpected text after the end of the document");
+    return true;
+}
+
+bool JsonParser::parseValue(JsonValue& value) {
+    skipSpace();
+    value.line = line;
+    if (pos >= text.size())
+        return fail("unexpected end of input");
+    char c = text[pos];
+    if (c == '{') {
+        value.type = JSON_OBJECT;
+        pos++;
+        skipSpace();
+        if (pos < text.size() && text[pos] == '}') {
+            pos++;
+            return true;
+        }
+        while (true) {
+            skipSpace();
+            std::pair<std::string, JsonValue> member;
+            if (pos >= text.size() || text[pos] != '"')
+                return fail("expected a member name");
+            if (!parseString(member.first))
+                return false;
+            skipSpace();
+            if (pos >= text.size() || text[pos] != ':')
+                return fail("expected ':' after \"" + member.first + "\"");
+            pos++;
+            if (!parseValue(member.second))
+                return false;
+            value.members.push_back(member);
+            skipSpace();
+            if (pos < text.size() && text[pos] == ',') {
+                pos++;
+            } else if (pos < text.size() && text[pos] == '}') {
+                pos++;
+                return true;
+            } else {
+                return fail("expected ',' or '}' in object");
+            }
+        }
+    }
+    if (c == '[') {
+        value.type = JSON_ARRAY;
+        pos++;
+        skipSpace();
+        if (pos < text.size() && text[pos] == ']') {
+            pos++;
+            return true;
+        }
+        while (true) {
+            value.items.push_back(JsonValue());
+            if (!parseValue(value.items.back()))
+                return false;
+            skipSpace();
+            if (pos < text.size() && text[pos] == ',') {
+                pos++;
+            } else if (pos < text.size() && text[pos] == ']') {
+                pos++;
+                return true;
+            } else {
+                return fail("expected ',' or ']' in array");
+            }
+        }
+    }
+    if (c == '"') {
+        value.type = JSON_STRING;
+        return parseString(value.string);
+    }
+    if (literal("true")) {
+        value.type = JSON_BOOL;
+        value.boolean = true;
+        return true;
+    }
+    if (literal("false")) {
+        value.type = JSON_BOOL;
+        value.boolean = false;
+        return true;
+    }
+    if (literal("null")) {
+        value.type = JSON_NULL;
+        return true;
+    }
+    value.type = JSON_NUMBER;
+    return parseNumber(value.number);
+}
+
+// escapes other than \uXXXX are decoded; \u keeps only code points below 128
+bool JsonParser::parseString(std::string& s) {
+    pos++;
+    while (pos < text.size() && text[pos] != '"') {
+        char c = text[pos++];
+        if (c == '\n')
+            return fail("newline in string");
+        if (c != '\\') {
+            s += c;
+            continue;
+        }
+        if (pos >= text.size())
+            break;
+        char e = text[pos++];
+        switch (e) {
+            case 'n': s += '\n'; break;
+            case 't': s += '\t'; break;
+            case 'r': s += '\r'; break;
+            case 'b': s += '\b'; break;
+            case 'f': s += '\f'; break;
+            case 'u': {
+                if (pos + 4 > text.size())
+                    return fail("truncated \\u escape");
+                long code = strtol(text.substr(pos, 4).c_str(), NULL, 16);
+                s += code < 128 ? char(code) : '?';
+                pos += 4;
+                break;
+            }
+            default: s += e; break;
+        }
+    }
+    if (pos >= text.size())
+        return fail("unterminated string");
+    pos++;
+    return true;
+}
+
+bool JsonParser::parseNumber(double& d) {
+    const char *start = text.c_str() + pos;
+    char *end;
+    d = strtod(start, &end);
+    if (end == start)
+        return fail(std::string("unexpected character '") + text[pos] + "'");
+    pos += end - start;
+    return true;
+}
+
+#endif
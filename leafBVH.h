@@ -0,0 +1,338 @@
+#ifndef LEAFBVHH
+#define LEAFBVHH
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <vector>
+#ifdef __AVX2__
+#include <immintrin.h>
+#endif
+
+#include "ray.h"
+#include "aabb.h"
+
+/*
+    Flat BVH used inside primitives that own many small shapes (sphere sets,
+    meshes). Leaves are ranges into the owner's arrays rather than Hitables,
+    so a million shapes never means a million virtual objects. This float
+    tree is what gets built and refit; rays walk a QuantizedBVH made from it.
+*/
+struct LeafBVHNode {
+    AABB box;
+    int offset; // leaf: first primitive, interior: index of the right child (left child is the next node)
+    int count;  // primitives in a leaf, 0 for an interior node
+};
+
+int buildLeafBVHRange(const std::vector<AABB>& boxes, std::vector<int>& order, int begin, int end,
+                      int maxLeafSize, std::vector<LeafBVHNode>& nodes) {
+    AABB bounds = boxes[order[begin]];
+    Vector3 cmin = 0.5*(bounds.min() + bounds.max());
+    Vector3 cmax = cmin;
+    for (int i = begin+1; i < end; i++) {
+        const AABB& b = boxes[order[i]];
+        bounds = surroundingBox(bounds, b);
+        Vector3 c = 0.5*(b.min() + b.max());
+        for (int a = 0; a < 3; a++) {
+            cmin[a] = ffmin(cmin[a], c[a]);
+            cmax[a] = ffmax(cmax[a], c[a]);
+        }
+    }
+
+    int index = int(nodes.size());
+    nodes.push_back(LeafBVHNode());
+    nodes[index].box = bounds;
+
+    if (end - begin <= maxLeafSize) {
+        nodes[index].offset = begin;
+        nodes[index].count = end - begin;
+        return index;
+    }
+
+    // split at the centroid median of the widest axis
+    Vector3 extent = cmax - cmin;
+    int axis = 0;
+    if (extent[1] > extent[axis]) axis = 1;
+    if (extent[2] > extent[axis]) axis = 2;
+    int mid = (begin + end) / 2;
+    std::nth_element(order.begin()+begin, order.begin()+mid, order.begin()+end, [&](int a, int b) {
+        return boxes[a].min()[axis] + boxes[a].max()[axis] < boxes[b].min()[axis] + boxes[b].max()[axis];
+    });
+
+    buildLeafBVHRange(boxes, order, begin, mid, maxLeafSize, nodes);
+    int right = buildLeafBVHRange(boxes, order, mid, end, maxLeafSize, nodes);
+    nodes[index].offset = right;
+    nodes[index].count = 0;
+    return index;
+}
+
+/*
+    Builds the tree over the primitive boxes. order receives the permutation
+    that makes every leaf a contiguous range; the owner reorders its arrays by it.
+*/
+void buildLeafBVH(const std::vector<AABB>& boxes, int maxLeafSize, std::vector<LeafBVHNode>& nodes, std::vector<int>& order) {
+    nodes.clear();
+    order.resize(boxes.size());
+    for (int i = 0; i < int(order.size()); i++)
+        order[i] = i;
+    if (boxes.empty())
+        return;
+    nodes.reserve(2*(boxes.size()/maxLeafSize + 1));
+    buildLeafBVHRange(boxes, order, 0, int(boxes.size()), maxLeafSize, nodes);
+}
+
+/*
+    Recomputes every node's box after the primitives moved, keeping the tree's
+    shape: leafBox(offset, count) gives the box of a leaf range, and since a
+    node's children always come after it, one backward pass sees children first.
+*/
+template <typename LeafBox>
+void refitLeafBVH(std::vector<LeafBVHNode>& nodes, LeafBox leafBox) {
+    for (int i = int(nodes.size()) - 1; i >= 0; i--) {
+        LeafBVHNode& node = nodes[i];
+        if (node.count > 0)
+            node.box = leafBox(node.offset, node.count);
+        else
+            node.box = surroundingBox(nodes[i+1].box, nodes[node.offset].box);
+    }
+}
+
+inline float surfaceArea(const AABB& box) {
+    Vector3 d = box.max() - box.min();
+    return 2*(d[0]*d[1] + d[1]*d[2] + d[2]*d[0]);
+}
+
+// expected node visits for a random ray hitting the root: how much a refit has loosened the tree
+inline float leafBVHCost(const std::vector<LeafBVHNode>& nodes) {
+    if (nodes.empty())
+        return 0;
+    float rootArea = surfaceArea(nodes[0].box);
+    if (rootArea <= 0)
+        return 0;
+    float sum = 0;
+    for (size_t i = 0; i < nodes.size(); i++)
+        sum += surfaceArea(nodes[i].box);
+    return sum / rootArea;
+}
+
+// slab test against a precomputed reciprocal direction; entry, if given, receives where the ray enters
+inline bool hitSlabs(const AABB& box, const Vector3& origin, const Vector3& invD, float tMin, float tMax, float *entry = NULL) {
+    STAT_INC(boxTests);
+    for (int a = 0; a < 3; a++) {
+        float t0 = (box._min[a] - origin[a]) * invD[a];
+        float t1 = (box._max[a] - origin[a]) * invD[a];
+        if (invD[a] < 0.0f)
+            std::swap(t0, t1);
+        tMin = t0 > tMin ? t0 : tMin;
+        tMax = t1 < tMax ? t1 : tMax;
+        if (tMax <= tMin)
+            return false;
+    }
+    if (entry)
+        *entry = tMin;
+    return true;
+}
+
+/*
+    The layout traversal reads. A node holds the boxes of both its children
+    as 8 bit offsets into its own decoded box, so there is one 24 byte node
+    per interior node of the LeafBVHNode tree it is built from, against one
+    32 byte node per node there. Boxes are decoded on the way down.
+*/
+struct QuantizedBVHNode {
+    unsigned char planes[3][4]; // per axis: min of child 0, min of child 1, max of child 0, max of child 1
+    unsigned char count[2];     // primitives in a leaf child, 0 when the child is a node
+    int child[2];               // a leaf child's first primitive, a node's index, or -1 for none
+};
+
+// size of one quantization step along an axis, padded so 255 steps always reach the far side
+inline float quantizationStep(float extent) {
+    return extent > 0 ? extent * (1.0f / 255.0f * (1.0f + 1e-5f)) : 0.0f;
+}
+
+// child c's box in steps of its parent's, rounded outwards so the decoded box contains the real one
+inline void quantizeChild(const AABB& parent, const AABB& child, int c, unsigned char planes[3][4]) {
+    for (int a = 0; a < 3; a++) {
+        float base = parent.min()[a];
+        float step = quantizationStep(parent.max()[a] - base);
+        int lo = 0, hi = 255;
+        if (step > 0) {
+            lo = int(floor((child.min()[a] - base) / step));
+            hi = int(ceil((child.max()[a] - base) / step));
+            lo = lo < 0 ? 0 : (lo > 255 ? 255 : lo);
+            hi = hi < 0 ? 0 : (hi > 255 ? 255 : hi);
+            while (lo > 0 && base + lo*step > child.min()[a])
+                lo--;
+            while (hi < 255 && base + hi*step < child.max()[a])
+                hi++;
+        }
+        planes[a][c] = (unsigned char)lo;
+        planes[a][c+2] = (unsigned char)hi;
+    }
+}
+
+inline AABB dequantizeChild(const AABB& parent, int c, const unsigned char planes[3][4]) {
+    Vector3 lo, hi;
+    for (int a = 0; a < 3; a++) {
+        float base = parent.min()[a];
+        float step = quantizationStep(parent.max()[a] - base);
+        lo[a] = base + planes[a][c]*step;
+        hi[a] = base + planes[a][c+2]*step;
+    }
+    return AABB(lo, hi);
+}
+
+class QuantizedBVH {
+    public:
+        QuantizedBVH() {}
+        void build(const std::vector<LeafBVHNode>& tree);
+        bool empty() const { return nodes.empty(); }
+
+        std::vector<QuantizedBVHNode> nodes;
+        AABB bounds;
+
+    private:
+        int compress(const std::vector<LeafBVHNode>& tree, int index, const AABB& decoded);
+};
+
+// children are quantized against the decoded box, which is what traversal sees
+int QuantizedBVH::compress(const std::vector<LeafBVHNode>& tree, int index, const AABB& decoded) {
+    int nodeIndex = int(nodes.size());
+    nodes.push_back(QuantizedBVHNode());
+    int children[2] = { index + 1, tree[index].offset };
+    for (int c = 0; c < 2; c++) {
+        const LeafBVHNode& child = tree[children[c]];
+        quantizeChild(decoded, child.box, c, nodes[nodeIndex].planes);
+        nodes[nodeIndex].count[c] = (unsigned char)child.count;
+        if (child.count > 0)
+            nodes[nodeIndex].child[c] = child.offset;
+        else
+            nodes[nodeIndex].child[c] = compress(tree, children[c], dequantizeChild(decoded, c, nodes[nodeIndex].planes));
+    }
+    return nodeIndex;
+}
+
+// leaves may hold up to 255 primitives
+void QuantizedBVH::build(const std::vector<LeafBVHNode>& tree) {
+    nodes.clear();
+    if (tree.empty())
+        return;
+    bounds = tree[0].box;
+    if (tree[0].count > 0) {
+        // a lone leaf: the root node has it as its only child
+        QuantizedBVHNode node;
+        for (int c = 0; c < 2; c++)
+            quantizeChild(bounds, bounds, c, node.planes);
+        node.count[0] = (unsigned char)tree[0].count;
+        node.count[1] = 0;
+        node.child[0] = tree[0].offset;
+        node.child[1] = -1;
+        nodes.push_back(node);
+        return;
+    }
+    nodes.reserve(tree.size() / 2);
+    compress(tree, 0, bounds);
+}
+
+/*
+    Visits the leaves the ray can reach. leafHit(offset, count, tMin, tMax) tests a
+    leaf range and shrinks tMax when it finds something closer. Both children of
+    a node are decoded and slab tested together, one axis at a time. A stack
+    entry keeps where the ray enters its node, so it is dropped once something
+    closer has been found, and the origin and step its children decode with.
+*/
+template <typename LeafHit>
+bool traverseLeafBVH(const QuantizedBVH& bvh, const Ray& r, float tMin, float& tMax, LeafHit leafHit) {
+    if (bvh.nodes.empty())
+        return false;
+    const Vector3 origin = r.origin();
+    const Vector3 invD(1.0f / r.direction().x(), 1.0f / r.direction().y(), 1.0f / r.direction().z());
+    float tRoot;
+    if (!hitSlabs(bvh.bounds, origin, invD, tMin, tMax, &tRoot))
+        return false;
+    struct Entry { int node; float tNear; float base[3]; float step[3]; };
+    Entry stack[64];
+    int stackSize = 1;
+    stack[0].node = 0;
+    stack[0].tNear = tRoot;
+    for (int a = 0; a < 3; a++) {
+        stack[0].base[a] = bvh.bounds._min[a];
+        stack[0].step[a] = quantizationStep(bvh.bounds._max[a] - bvh.bounds._min[a]);
+    }
+    bool hitAnything = false;
+    while (stackSize > 0) {
+        const Entry& entry = stack[--stackSize];
+        if (entry.tNear >= tMax)
+            continue;
+        const QuantizedBVHNode& node = bvh.nodes[entry.node];
+        // decoded[a] holds the four planes along axis a; lanes 0 and 1 of tNear and tFar are the children's
+        float decoded[3][4], tNear[4], tFar[4];
+#ifdef __AVX2__
+        __m128 tn = _mm_set1_ps(tMin);
+        __m128 tf = _mm_set1_ps(tMax);
+        for (int a = 0; a < 3; a++) {
+            int packed;
+            memcpy(&packed, node.planes[a], 4);
+            __m128 q = _mm_cvtepi32_ps(_mm_cvtepu8_epi32(_mm_cvtsi32_si128(packed)));
+            __m128 d = _mm_add_ps(_mm_set1_ps(entry.base[a]), _mm_mul_ps(q, _mm_set1_ps(entry.step[a])));
+            _mm_storeu_ps(decoded[a], d);
+            __m128 t = _mm_mul_ps(_mm_sub_ps(d, _mm_set1_ps(origin[a])), _mm_set1_ps(invD[a]));
+            if (invD[a] < 0.0f)
+                t = _mm_shuffle_ps(t, t, _MM_SHUFFLE(1, 0, 3, 2));
+            // written so a NaN plane leaves the interval alone, as in hitSlabs
+            tn = _mm_max_ps(t, tn);
+            tf = _mm_min_ps(t, tf);
+        }
+        _mm_storeu_ps(tNear, tn);
+        _mm_storeu_ps(tFar, _mm_shuffle_ps(tf, tf, _MM_SHUFFLE(3, 2, 3, 2)));
+#else
+        for (int c = 0; c < 2; c++) {
+            tNear[c] = tMin;
+            tFar[c] = tMax;
+        }
+        for (int a = 0; a < 3; a++) {
+            for (int k = 0; k < 4; k++)
+                decoded[a][k] = entry.base[a] + node.planes[a][k]*entry.step[a];
+            for (int c = 0; c < 2; c++) {
+                float t0 = (decoded[a][c] - origin[a]) * invD[a];
+                float t1 = (decoded[a][c+2] - origin[a]) * invD[a];
+                if (invD[a] < 0.0f)
+                    std::swap(t0, t1);
+                tNear[c] = t0 > tNear[c] ? t0 : tNear[c];
+                tFar[c] = t1 < tFar[c] ? t1 : tFar[c];
+            }
+        }
+#endif
+        bool visit[2] = { false, false };
+        for (int c = 0; c < 2; c++) {
+            if (node.child[c] < 0)
+                continue;
+            STAT_INC(boxTests);
+            // tMax may have shrunk in the other child's leaf
+            if (tFar[c] <= tNear[c] || tNear[c] >= tMax)
+                continue;
+            STAT_INC(nodesVisited);
+            if (node.count[c] > 0) {
+                if (leafHit(node.child[c], node.count[c], tMin, tMax))
+                    hitAnything = true;
+            } else {
+                visit[c] = true;
+            }
+        }
+        // the left child is popped first; the first push reuses entry's slot, which is not read again
+        for (int c = 1; c >= 0; c--) {
+            if (!visit[c])
+                continue;
+            Entry& push = stack[stackSize++];
+            push.node = node.child[c];
+            push.tNear = tNear[c];
+            for (int a = 0; a < 3; a++) {
+                push.base[a] = decoded[a][c];
+                push.step[a] = quantizationStep(decoded[a][c+2] - decoded[a][c]);
+            }
+        }
+    }
+    return hitAnything;
+}
+
+#endif
@@ -1,19 +1,37 @@
+#include <atomic>
+#include <chrono>
+#include <csignal>
 #include <fstream>
 #include <iostream>
 #include <string>
 #include <time.h>
 #include <vector>
 
+#include "arena.h"
 #include "ray.h"
 #include "sphere.h"
+#include "sphereSet.h"
+#include "triangleMesh.h"
+#include "objLoader.h"
+#include "plyLoader.h"
 #include "rectangle.h"
 #include "box.h"
 #include "hitableList.h"
+#include "transform.h"
+#include "compiledScene.h"
 #include "float.h"
 #include "camera.h"
 #include "material.h"
 #include "parallel.h"
 #include "constantMedium.h"
+#include "gridMedium.h"
+#include "scenes.h"
+#include "framebuffer.h"
+#include "tileOutput.h"
+#include "checkpoint.h"
+#include "outputQueue.h"
+#include "preview.h"
+#include "bench.h"
 
 #define STB_IMAGE_IMPLEMENTATION
 #include "stb_image.h"
@@ -22,131 +40,316 @@
 #include "stb_image_write.h"
 
 struct Options {
-    std::string fileName = "image.jpg";
+    std::string fileName = "image.jpg"; // one or more, separated by commas: image.exr,image.png
+    std::vector<std::string> fileNames;
     int nSamples = 1;
     int xResolution = 600;
     int yResolution = 300;
+    int textureCacheMB = 256;
+    std::string scene = "final"; // a built-in scene name or a .json scene file
+    std::string sceneCache;      // for scene files; defaults to the scene file name plus .cache, "none" turns it off
+    std::string input;           // a .pfm or .hdr to tone map into fileName instead of rendering
+    int tileSize = 0;            // above 0, render in tiles streamed to fileName instead of one framebuffer
+    uint64_t seed = 0;
+    std::string checkpoint;      // where to save progress; defaults to resume
+    std::string resume;          // a checkpoint to carry on from
+    int checkpointInterval = 60; // seconds between checkpoints
+    int writeEvery = 0;          // above 0, also write the image so far every this many seconds
+    std::string frames;          // "N" for frames 0 to N-1, or "A-B"; renders a sequence from one resident scene
+    std::string preview;         // "-", "http:PORT" or a FIFO to stream the image so far to
+    float previewRate = 2;       // preview frames per second at most
+    std::string bench;           // where to write the benchmark results, "-" for stdout; renders nothing else
+    std::string benchLabel;      // names the build in the results, e.g. its git revision
+    std::string stats;           // a JSON file for the counters of a JRAY_STATS build
+    ToneMapSettings toneMap;
 };
 
-Vector3 color(const Ray& r, Hitable *world, int depth) {
+// rays this thread has traced, for the benchmark
+static thread_local uint64_t raysTraced = 0;
+
+// diff is only known for camera rays; bounced rays point-sample their textures
+Vector3 color(const Ray& r, const CompiledScene& world, int depth, const RayDifferential *diff = NULL) {
+    raysTraced++;
+    STAT_INC(rays[depth]);
     HitRecord rec;
-    if (world->hit(r, 0.001,FLT_MAX, rec)) {
+    if (world.hit(r, 0.001,FLT_MAX, rec)) {
+        rec.uvWidth = diff ? uvFootprint(*diff, rec) : 0;
         Ray scatteredRay;
         Vector3 attenuation = Vector3(0.5,0.5,0.5);
-        Vector3 emitted = rec.matPtr->emitted(rec.u, rec.v, rec.p);
-        if (depth < 50 && rec.matPtr->scatter(r, rec, attenuation, scatteredRay)) {
+        Vector3 emitted = emittedMaterial(rec.matPtr, rec.u, rec.v, rec.p);
+        if (depth < 50 && scatterMaterial(rec.matPtr, r, rec, attenuation, scatteredRay)) {
             return emitted + attenuation*color(scatteredRay, world, depth+1);
         } else {
+            STAT_INC(terminations[depth >= 50 ? STAT_DEPTH_LIMIT : emitted.squaredLength() > 0 ? STAT_LIGHT : STAT_ABSORBED]);
             return emitted;
         }
     } else {
+        STAT_INC(terminations[STAT_ESCAPED]);
         return Vector3(0,0,0);
     }
 }
 
-Hitable *randomScene(unsigned char **texData) {
-    Vector3 colors[6] = {
-            Vector3(0.37,0.62,0.58),
-            Vector3(0.24,0.21,0.22),
-            Vector3(0.45,0.21,0.20),
-            Vector3(0.71,0.38,0.22),
-            Vector3(0.69,0.63,0.64),
-            Vector3(0.89,0.85,0.82),
-    };
-
-    int n = 500;
-    Hitable **list = new Hitable*[n+1];
-    list[0] =  new Sphere(Vector3(0,-1000,0), 1000, new DiffuseLight(new ConstantTexture(Vector3(1.1,1.1,1.1))));
-
-    int i = 1;
-    for (int a = -11; a < 11; a++) {
-        for (int b = -11; b < 11; b++) {
-            float chooseMat = drand48();
-            Vector3 center(a+0.9*drand48(),0.2,b+0.9*drand48());
-            Vector3 color;
-            color = colors[ int(drand48()*5) ];
-
-            if ((center-Vector3(4,0.2,0)).length() > 0.9) { 
-                if (chooseMat < 0.3) {  // diffuse
-                    list[i++] = new Sphere(center, 0.2, new Lambertian(new ConstantTexture(color)));
-                }
-                else if (chooseMat < 0.6) { // metal
-                    list[i++] = new Sphere(center, 0.2, new Metal(Vector3(0.5*(1 + drand48()), 0.5*(1 + drand48()), 0.5*(1 + drand48())),  0.5*drand48()));
-                }
-                else {  // glass
-                    list[i++] = new Sphere(center, 0.2, new Dielectric(1.5));
-                }
+// adds samples first to first+count-1 of pixel i, j (counting j up from the bottom) to col
+Vector3 renderPixel(const Camera& cam, const CompiledScene& scene, const Options& options, int i, int j, int first, int count, Vector3 col) {
+    uint64_t pixel = uint64_t(options.yResolution - 1 - j)*options.xResolution + i;
+    for (int s=first; s < first + count; s++) {
+        seedSample(options.seed, pixel, s);
+        float u = float(i + randomFloat()) / float(options.xResolution);
+        float v = float(j + randomFloat()) / float(options.yResolution);
+        RayDifferential diff;
+        Ray r = cam.getRay(u, v, 1.0f / options.xResolution, 1.0f / options.yResolution, diff);
+        col += color(r, scene, 0, &diff);
+    }
+    return col;
+}
+
+// tiles go to the output as they finish, so memory does not grow with the image
+bool renderTiled(const Camera& cam, const CompiledScene& scene, const Options& options) {
+    std::vector<std::unique_ptr<TileOutput> > outputs;
+    for (size_t f = 0; f < options.fileNames.size(); f++) {
+        outputs.push_back(std::unique_ptr<TileOutput>(openTileOutput(options.fileNames[f], options.xResolution, options.yResolution, options.toneMap)));
+        if (!outputs.back())
+            return false;
+    }
+    int size = options.tileSize;
+    int tilesX = (options.xResolution + size - 1) / size;
+    int tilesY = (options.yResolution + size - 1) / size;
+    std::atomic<bool> ok(true);
+    parallelForEach(0, tilesX*tilesY, [&](int t){
+        int x0 = (t % tilesX)*size, y0 = (t / tilesX)*size;
+        int w = std::min(size, options.xResolution - x0), h = std::min(size, options.yResolution - y0);
+        std::vector<float> tile(size_t(3)*w*h);
+        for (int y = 0; y < h; y++) {
+            for (int x = 0; x < w; x++) {
+                Vector3 col = renderPixel(cam, scene, options, x0 + x, options.yResolution - 1 - (y0 + y), 0, options.nSamples, Vector3(0,0,0))
+                              / float(options.nSamples);
+                for (int c = 0; c < 3; c++)
+                    tile[3*(y*w + x) + c] = col[c];
             }
         }
+        for (size_t f = 0; f < outputs.size(); f++) {
+            if (!outputs[f]->writeTile(x0, y0, w, h, tile.data()))
+                ok = false;
+        }
+    });
+    for (size_t f = 0; f < outputs.size(); f++) {
+        if (!outputs[f]->finish())
+            ok = false;
     }
+    return ok;
+}
 
-    list[i++] = new Sphere(Vector3(0, 1, 0), 1.0, new Dielectric(1.5));
-
-    int nx, ny, nn;
-    *texData = stbi_load("textures/earth.jpg", &nx, &ny, &nn, 0);
-    if (texData == NULL) {
-        std::cout << "Error: texture could not be loaded!" << std::endl;
-        return NULL;
+// the image so far: each pixel's sum over its sample count
+std::shared_ptr<Framebuffer> averageImage(const Checkpoint& progress) {
+    std::shared_ptr<Framebuffer> image(new Framebuffer(progress.width, progress.height));
+    for (size_t p = 0; p < progress.count.size(); p++) {
+        float n = float(std::max(progress.count[p], 1u));
+        for (int c = 0; c < 3; c++)
+            image->pixels[3*p + c] = progress.sum[3*p + c] / n;
     }
-
-    Material *mat = new Lambertian(new ImageTexture(*texData, nx, ny));
-    list[i++] = new Sphere(Vector3(4, 1, 0), 1.0, mat);
-
-    list[i++] = new Sphere(Vector3(-4, 1, 0), 1.0, new Metal(colors[4], 0.0));
-    return new BVHNode(list,i,0.0, 1.0);
+    return image;
 }
 
-Hitable *cornellBox() {
-    Hitable **list = new Hitable*[6];
-    int i = 0;
-    Material *white = new Lambertian(new ConstantTexture(Vector3(0.73, 0.73, 0.73)));
-
-    list[i++] = new FlipNormals(new YZRect(0, 700, 0, 700, 700, white));
-    list[i++] = new YZRect(0, 700, 0, 700, -700, white);
-    list[i++] = new FlipNormals(new XZRect(-700, 700, -700, 700, 700, white));
-    list[i++] = new XZRect(-700, 700, -700, 700, 0, white);
-    list[i++] = new FlipNormals(new XYRect(-700, 700, 0, 700, 700, white));
-
-    return new HitableList(list,i);
+// a run of #s becomes the frame number padded to as many digits; without one, .NNNN goes before the extension
+std::string frameFileName(const std::string& fileName, int frame) {
+    size_t end = fileName.rfind('#');
+    if (end != std::string::npos) {
+        size_t start = end;
+        while (start > 0 && fileName[start-1] == '#')
+            start--;
+        std::string number = std::to_string(frame);
+        if (number.size() < end + 1 - start)
+            number.insert(0, end + 1 - start - number.size(), '0');
+        return fileName.substr(0, start) + number + fileName.substr(end + 1);
+    }
+    std::string number = std::to_string(frame);
+    number.insert(0, number.size() < 4 ? 4 - number.size() : 0, '0');
+    size_t dot = fileName.rfind('.');
+    if (dot == std::string::npos || (fileName.rfind('/') != std::string::npos && dot < fileName.rfind('/')))
+        return fileName + "." + number;
+    return fileName.substr(0, dot) + "." + number + fileName.substr(dot);
 }
 
-Hitable *final() {
-    Hitable **list = new Hitable*[500];
-    int count = 0;
-    Material *red = new Lambertian( new ConstantTexture(Vector3(0.65, 0.05, 0.05)) );
-    Material *white = new Lambertian( new ConstantTexture(Vector3(0.73, 0.73, 0.73)) );
-    Material *green = new Lambertian( new ConstantTexture(Vector3(0.12, 0.45, 0.15)) );
-    Material *light = new DiffuseLight( new ConstantTexture(Vector3(15, 15, 15)) );
+static volatile std::sig_atomic_t stopRequested = 0;
 
-    list[count++] = cornellBox();
+// a refit tree this much costlier than when it was built is built again
+const float rebuildLoosening = 2;
 
-    list[count++] = new Sphere(Vector3(0,0,0), 50, red);
-    
-    // for (int i=0; i < 6; i++) {
-    //     for (int j = 0; j < 6; j++) {
-    //         float x = (drand48()*900)-450;
-    //         float y = drand48()*700;  
-    //         float z = (drand48()*900)-450;
-
-    //         list[count++] = new Sphere(Vector3(x,y,z), 50, white);
-    //     }
-    // }
+void requestStop(int) {
+    stopRequested = 1;
+}
 
-    // for (int i=0; i < 28; i++) {
+/*
+    Renders in passes, every pixel taking up to pass more samples each time,
+    into progress. With a checkpoint file, passes are one sample and progress
+    is saved whenever checkpointInterval has passed, at the end, and on
+    SIGTERM or SIGINT, after which it returns false and leaves the rest to
+    --resume=. With writeEvery or a preview, passes are one sample too and
+    the image so far goes to output or the preview between them, whenever
+    they are ready for another.
+*/
+bool renderProgressive(const Camera& cam, const CompiledScene& scene, const Options& options, Checkpoint& progress,
+                       OutputQueue& output, PreviewServer& preview) {
+    int pass = options.checkpoint.empty() && options.writeEvery <= 0 && !preview.running() ? options.nSamples : 1;
+    if (!options.checkpoint.empty()) {
+        std::signal(SIGTERM, requestStop);
+        std::signal(SIGINT, requestStop);
+    }
+    auto lastCheckpoint = std::chrono::steady_clock::now();
+    auto lastWrite = lastCheckpoint;
+    while (true) {
+        std::atomic<bool> remaining(false);
+        parallelForEach(0, options.yResolution, [&](int j){
+            int y = options.yResolution - 1 - j;
+            for (int i=0; i < options.xResolution; i++) {
+                size_t p = size_t(y)*options.xResolution + i;
+                int n = std::min(pass, options.nSamples - int(progress.count[p]));
+                if (n <= 0)
+                    continue;
+                float *sum = &progress.sum[3*p];
+                Vector3 col = renderPixel(cam, scene, options, i, j, progress.count[p], n, Vector3(sum[0], sum[1], sum[2]));
+                sum[0] = col[0];
+                sum[1] = col[1];
+                sum[2] = col[2];
+                progress.count[p] += n;
+                if (int(progress.count[p]) < options.nSamples)
+                    remaining = true;
+            }
+        });
+        // a finished render is saved too, so it can be carried on to more samples later
+        auto now = std::chrono::steady_clock::now();
+        if (!options.checkpoint.empty() &&
+            (!remaining || stopRequested || now - lastCheckpoint >= std::chrono::seconds(options.checkpointInterval))) {
+            if (progress.write(options.checkpoint))
+                std::cout << "Checkpoint: " << progress.count[0] << " of " << options.nSamples << " samples in " << options.checkpoint << std::endl;
+            lastCheckpoint = now;
+        }
+        if (!remaining)
+            return true;
+        if (stopRequested)
+            return false;
+        if (options.writeEvery > 0 && now - lastWrite >= std::chrono::seconds(options.writeEvery)) {
+            OutputQueue::Job job = { averageImage(progress), options.fileNames, options.toneMap };
+            output.push(job, false);
+            lastWrite = now;
+        }
+        if (preview.due())
+            preview.publish(averageImage(progress));
+    }
+}
 
-    //     list[count++] = new Box(
-    //         Vector3(650-(50*i),0,400-drand48()*100),
-    //         Vector3(700-(50*i),100+drand48()*200,700),
-    //         green
-    //     );
+Camera viewCamera(const SceneCamera& view, const Options& options) {
+    return Camera(view.lookfrom, view.lookat, view.vup, view.vfov, float(options.xResolution)/float(options.yResolution),
+                  view.aperture, view.focusDist, view.time0, view.time1);
+}
 
-    // }
+// one image of view, handed to output (and preview) as it is finished; false when stopped for a checkpoint
+// sceneHash is the scene file's input hash, 0 for a built-in scene
+bool renderFrame(const SceneCamera& view, const CompiledScene& scene, uint64_t sceneHash, const Options& options,
+                 OutputQueue& output, PreviewServer& preview) {
+    Camera cam = viewCamera(view, options);
 
-    //list[count++] = new ConstantMedium(cornellBox(), 0.01, new ConstantTexture(Vector3(1.0, 1.0, 1.0)));
+    if (options.tileSize > 0) {
+        if (!renderTiled(cam, scene, options))
+            std::cout << "Error: writing to file failed!" << std::endl;
+        return true;
+    }
+    Checkpoint progress;
+    uint64_t settingsHash = hashBytes(&view, sizeof(view), hashBytes(options.scene.data(), options.scene.size(), sceneHash));
+    if (!options.resume.empty()) {
+        if (!progress.read(options.resume))
+            return false;
+        if (progress.width != options.xResolution || progress.height != options.yResolution ||
+            progress.seed != options.seed || progress.settingsHash != settingsHash) {
+            std::cout << "Error: " << options.resume << " was made with another scene, resolution or seed" << std::endl;
+            return false;
+        }
+        std::cout << "Resuming from " << options.resume << std::endl;
+    } else {
+        progress.reset(options.xResolution, options.yResolution, options.seed, settingsHash);
+    }
+    if (!renderProgressive(cam, scene, options, progress, output, preview)) {
+        std::cout << "Stopped; continue with --resume=" << options.checkpoint << std::endl;
+        return false;
+    }
+    // output reports its own failures, and its destructor waits for the write
+    OutputQueue::Job job = { averageImage(progress), options.fileNames, options.toneMap };
+    output.push(job);
+    preview.publish(job.image, true);
+    return true;
+}
 
-    list[count++] = new XZRect(-200, 200, 0, 200, 554, light);
+// renders every benchCase in memory and writes the timings as JSON; progress goes to stderr
+bool runBenchmark(const Options& options) {
+    std::vector<BenchResult> results;
+    for (size_t c = 0; c < sizeof(benchCases)/sizeof(benchCases[0]); c++) {
+        BenchResult result;
+        result.bench = benchCases[c];
+        Options benchOptions = options;
+        benchOptions.scene = result.bench.scene;
+        benchOptions.xResolution = result.bench.xResolution;
+        benchOptions.yResolution = result.bench.yResolution;
+        benchOptions.nSamples = result.bench.nSamples;
+        benchOptions.seed = result.bench.seed;
+
+#ifdef JRAY_STATS
+        collectStats();
+#endif
+        auto start = std::chrono::steady_clock::now();
+        srand48(long(result.bench.seed));
+        SceneArena arena;
+        TextureCache textures(size_t(options.textureCacheMB) << 20);
+        SceneCamera view;
+        Hitable *world = builtinScene(benchOptions.scene, arena, textures, view);
+        if (world == NULL)
+            return false;
+        CompiledScene scene(world, view.time0, view.time1);
+        Camera cam = viewCamera(view, benchOptions);
+        auto built = std::chrono::steady_clock::now();
+
+        std::atomic<uint64_t> rays(0);
+        std::vector<double> rowSums(benchOptions.yResolution);
+        parallelForEach(0, benchOptions.yResolution, [&](int j){
+            uint64_t before = raysTraced;
+            double sum = 0;
+            for (int i=0; i < benchOptions.xResolution; i++) {
+                Vector3 col = renderPixel(cam, scene, benchOptions, i, j, 0, benchOptions.nSamples, Vector3(0,0,0));
+                sum += col[0] + col[1] + col[2];
+            }
+            rowSums[j] = sum;
+            rays += raysTraced - before;
+        });
+        auto end = std::chrono::steady_clock::now();
+
+        double sum = 0;
+        for (size_t j = 0; j < rowSums.size(); j++)
+            sum += rowSums[j];
+        result.buildSeconds = std::chrono::duration<double>(built - start).count();
+        result.renderSeconds = std::chrono::duration<double>(end - built).count();
+        result.rays = rays;
+        result.meanValue = sum / (3.0*benchOptions.xResolution*benchOptions.yResolution*benchOptions.nSamples);
+#ifdef JRAY_STATS
+        result.stats = collectStats();
+#endif
+        results.push_back(result);
+        std::cerr << result.bench.scene << ": " << result.rays / result.renderSeconds / 1e6 << " Mrays/s, "
+                  << result.renderSeconds << " s" << std::endl;
+    }
 
-    return new HitableList(list, count);
+    unsigned threads = std::thread::hardware_concurrency();
+    if (options.bench == "-") {
+        writeBenchJSON(std::cout, options.benchLabel, threads, results);
+        return true;
+    }
+    std::ofstream out(options.bench);
+    writeBenchJSON(out, options.benchLabel, threads, results);
+    out.close();
+    if (!out) {
+        std::cout << "Error: writing to file " << options.bench << " failed!" << std::endl;
+        return false;
+    }
+    std::cout << "Benchmark results in " << options.bench << std::endl;
+    return true;
 }
 
 int main(int argc, char *argv[]) {
@@ -162,65 +365,193 @@ int main(int argc, char *argv[]) {
             options.xResolution = stoi(argString.substr(14,argString.length()));
         } else if (argString.substr(0,14) == "--yResolution=") {
             options.yResolution = stoi(argString.substr(14,argString.length()));
+        } else if (argString.substr(0,8) == "--scene=") {
+            options.scene = argString.substr(8,argString.length());
+        } else if (argString.substr(0,13) == "--sceneCache=") {
+            options.sceneCache = argString.substr(13,argString.length());
+        } else if (argString.substr(0,15) == "--textureCache=") {
+            options.textureCacheMB = stoi(argString.substr(15,argString.length()));
+        } else if (argString.substr(0,8) == "--input=") {
+            options.input = argString.substr(8,argString.length());
+        } else if (argString.substr(0,11) == "--tileSize=") {
+            options.tileSize = stoi(argString.substr(11,argString.length()));
+        } else if (argString.substr(0,7) == "--seed=") {
+            options.seed = stoull(argString.substr(7,argString.length()));
+        } else if (argString.substr(0,13) == "--checkpoint=") {
+            options.checkpoint = argString.substr(13,argString.length());
+        } else if (argString.substr(0,21) == "--checkpointInterval=") {
+            options.checkpointInterval = stoi(argString.substr(21,argString.length()));
+        } else if (argString.substr(0,9) == "--resume=") {
+            options.resume = argString.substr(9,argString.length());
+        } else if (argString.substr(0,13) == "--writeEvery=") {
+            options.writeEvery = stoi(argString.substr(13,argString.length()));
+        } else if (argString.substr(0,9) == "--frames=") {
+            options.frames = argString.substr(9,argString.length());
+        } else if (argString.substr(0,10) == "--preview=") {
+            options.preview = argString.substr(10,argString.length());
+        } else if (argString.substr(0,14) == "--previewRate=") {
+            options.previewRate = stof(argString.substr(14,argString.length()));
+        } else if (argString == "--bench") {
+            options.bench = "-";
+        } else if (argString.substr(0,8) == "--bench=") {
+            options.bench = argString.substr(8,argString.length());
+        } else if (argString.substr(0,13) == "--benchLabel=") {
+            options.benchLabel = argString.substr(13,argString.length());
+        } else if (argString.substr(0,8) == "--stats=") {
+            options.stats = argString.substr(8,argString.length());
+        } else if (argString.substr(0,11) == "--exposure=") {
+            options.toneMap.exposure = stof(argString.substr(11,argString.length()));
+        } else if (argString.substr(0,8) == "--gamma=") {
+            options.toneMap.gamma = stof(argString.substr(8,argString.length()));
+        } else if (argString.substr(0,10) == "--toneMap=") {
+            if (!parseToneMapOperator(argString.substr(10,argString.length()), options.toneMap.op)) {
+                std::cout << "Error: tone map \"" << argString.substr(10,argString.length()) << "\" unknown!" << std::endl;
+                return 0;
+            }
         } else {
             std::cout << "Error: parameter \"" << argString << "\" unknown!" << std::endl;
             return 0;
         }
     }
 
-    srand(time(0));
+#ifndef JRAY_STATS
+    if (!options.stats.empty()) {
+        std::cout << "Error: --stats needs a build with the counters compiled in (make STATS=1)" << std::endl;
+        return 0;
+    }
+#endif
+
+    for (size_t start = 0; start <= options.fileName.size(); ) {
+        size_t end = std::min(options.fileName.find(',', start), options.fileName.size());
+        if (end > start)
+            options.fileNames.push_back(options.fileName.substr(start, end - start));
+        start = end + 1;
+    }
+    if (options.fileNames.empty()) {
+        std::cout << "Error: --fileName= names no file" << std::endl;
+        return 0;
+    }
+
+    OutputQueue output;
+    if (!options.input.empty()) {
+        std::shared_ptr<Framebuffer> image(new Framebuffer());
+        if (!readImage(options.input, *image)) {
+            std::cout << "Error: could not read " << options.input << std::endl;
+            return 0;
+        }
+        OutputQueue::Job job = { image, options.fileNames, options.toneMap };
+        output.push(job);
+        return 0;
+    }
+
+    if (!options.bench.empty()) {
+        runBenchmark(options);
+        return 0;
+    }
+
+    if (options.checkpoint.empty())
+        options.checkpoint = options.resume;
+    if (options.tileSize > 0 && (!options.checkpoint.empty() || !options.preview.empty())) {
+        std::cout << "Error: checkpoints and previews need the whole framebuffer and do not work with --tileSize" << std::endl;
+        return 0;
+    }
+    int firstFrame = 0, lastFrame = 0;
+    bool sequence = !options.frames.empty();
+    if (sequence) {
+        size_t dash = options.frames.find('-', 1);
+        if (dash == std::string::npos) {
+            lastFrame = stoi(options.frames) - 1;
+        } else {
+            firstFrame = stoi(options.frames.substr(0, dash));
+            lastFrame = stoi(options.frames.substr(dash + 1));
+        }
+        if (!options.checkpoint.empty()) {
+            std::cout << "Error: checkpoints are for single images and do not work with --frames" << std::endl;
+            return 0;
+        }
+    }
+    PreviewServer preview;
+    if (!options.preview.empty() && !preview.start(options.preview, options.previewRate, options.toneMap))
+        return 0;
 
     std::cout<< "Samples: " << options.nSamples << std::endl;
     std::cout<< "Resolution " << options.xResolution << " " << options.yResolution << std::endl;
     std::cout<< "Creating image " << options.fileName << "..." << std::endl;
 
-    unsigned char *texData;
-    //Hitable *world = randomScene(&texData);
-    Hitable *world = final();
-    // if (texData == NULL || world == NULL) {
-    //     std::cout << "Error: creating scene has failed" << std::endl;
-    //     return 0;
-    // }
-
-    Vector3 lookfrom(0,278,-800);
-    Vector3 lookat(0,278,0);
-    float distToFocus = 10;
-    float aperture = 0.0;
-
-    Camera cam(lookfrom, lookat, Vector3(0,1,0), 40, float(options.xResolution)/float(options.yResolution), aperture, distToFocus, 0, 1);
-
-    char* image;
-    image = new char[options.xResolution*options.yResolution*3];
-
-    parallelForEach(0, options.yResolution, [=,&image,&cam](int j){
-        for (int i=0; i < options.xResolution; i++) {
-                Vector3 col(0,0,0);
-                for (int s=0; s < options.nSamples; s++) {
-                    float u = float(i + randomFloat()) / float(options.xResolution);
-                    float v = float(j + randomFloat()) / float(options.yResolution);
-                    Ray r = cam.getRay(u, v);
-                    Vector3 p = r.pointAtParameter(2.0);
-                    col += color(r, world, 0);
-                }
-                col /= float(options.nSamples);
-                col = Vector3(sqrt(col[0]), sqrt(col[1]), sqrt(col[2]));
-
-                image[(j*options.xResolution*3) + (i*3)] = char(255.99*col[0]);
-                image[(j*options.xResolution*3) + (i*3+1)] = int(255.99*col[1]);
-                image[(j*options.xResolution*3) + (i*3+2)] = int(255.99*col[2]);
+    SceneArena arena;
+    TextureCache textures(size_t(options.textureCacheMB) << 20, options.fileNames[0]); // tiles go on the output's disk
+    SceneCamera view;
+    Hitable *world;
+    auto startup = std::chrono::steady_clock::now();
+    bool sceneFile = options.scene.size() > 5 && options.scene.compare(options.scene.size() - 5, 5, ".json") == 0;
+    if (options.sceneCache.empty())
+        options.sceneCache = options.scene + ".cache";
+    std::unique_ptr<SceneCache> sceneCache;
+    if (sceneFile && options.sceneCache != "none")
+        sceneCache.reset(new SceneCache(options.sceneCache));
+    std::unique_ptr<SceneLoader> loader; // kept for setFrame
+    if (sceneFile) {
+        loader.reset(new SceneLoader(arena, textures));
+        world = loader->load(options.scene, view, sceneCache.get());
+    } else {
+        world = builtinScene(options.scene, arena, textures, view);
+    }
+    if (world == NULL) {
+        std::cout << "Error: creating scene has failed" << std::endl;
+        return 0;
+    }
+    CompiledScene scene(world, view.time0, view.time1, sceneCache.get());
+    if (sceneCache) {
+        if (sceneCache->valid)
+            std::cout << "Scene cache: loaded " << sceneCache->fileName << std::endl;
+        else if (sceneCache->write())
+            std::cout << "Scene cache: wrote " << sceneCache->fileName << std::endl;
+    }
+    std::cout << "Scene ready in " << std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - startup).count()
+              << " ms" << std::endl;
+
+    // a sequence keeps the scene and only refits its tree to the transforms of each frame
+    for (int frame = firstFrame; frame <= lastFrame; frame++) {
+        auto frameStart = std::chrono::steady_clock::now();
+        const char *update = "static";
+        if (sequence && loader && loader->setFrame(float(frame), view)) {
+            update = "refit";
+            if (scene.refit() > rebuildLoosening) {
+                scene.compile(world, view.time0, view.time1);
+                update = "rebuilt";
             }
-    });
+        }
+        auto renderStart = std::chrono::steady_clock::now();
+        Options frameOptions = options;
+        if (sequence) {
+            for (size_t f = 0; f < frameOptions.fileNames.size(); f++)
+                frameOptions.fileNames[f] = frameFileName(options.fileNames[f], frame);
+        }
+        if (!renderFrame(view, scene, loader ? loader->inputHash : 0, frameOptions, output, preview))
+            return 0;
+        if (sequence) {
+            auto end = std::chrono::steady_clock::now();
+            std::cout << "Frame " << frame << ": " << update << " in "
+                      << std::chrono::duration<float, std::milli>(renderStart - frameStart).count() << " ms, rendered in "
+                      << std::chrono::duration<float, std::milli>(end - renderStart).count() << " ms" << std::endl;
+        }
+    }
 
-    // stbi_image_free(texData);
+    if (textures.size() > 0) {
+        TextureCache::Stats stats = textures.stats();
+        std::cout << "Texture cache: " << stats.hits << " hits, " << stats.misses << " misses, "
+                  << stats.evictions << " evictions, " << (stats.bytes >> 10) << " KB resident" << std::endl;
+    }
 
-    int fileNameSize = options.fileName.size();
-    char cFileName[fileNameSize+1];
-    options.fileName.copy(cFileName, fileNameSize + 1);
-    cFileName[fileNameSize] = '\0';
-    
-    stbi_flip_vertically_on_write(1);
-    int success = stbi_write_jpg(cFileName, options.xResolution, options.yResolution, 3, image, 100);
-    if (!success) {
-        std::cout << "Error: writing to file failed!" << std::endl;
+#ifdef JRAY_STATS
+    RenderStats stats = collectStats();
+    stats.print(std::cout);
+    if (!options.stats.empty()) {
+        std::ofstream out(options.stats);
+        stats.writeJSON(out);
+        out << std::endl;
+        if (!out)
+            std::cout << "Error: writing to file " << options.stats << " failed!" << std::endl;
     }
-}
\ No newline at end of file
+#endif
+}
@@ -0,0 +1,53 @@
+#ifndef MAPPEDFILEH
+#define MAPPEDFILEH
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <string>
+
+/*
+    Read-only memory mapping of a whole file, unmapped when the object dies.
+*/
+class MappedFile {
+    public:
+        MappedFile() : data(NULL), size(0) {}
+        ~MappedFile() { close(); }
+
+        bool open(const std::string& fileName) {
+            close();
+            int fd = ::open(fileName.c_str(), O_RDONLY);
+            if (fd < 0)
+                return false;
+            struct stat info;
+            if (fstat(fd, &info) != 0 || info.st_size == 0) {
+                ::close(fd);
+                return false;
+            }
+            void *p = mmap(NULL, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+            ::close(fd);
+            if (p == MAP_FAILED)
+                return false;
+            data = (const unsigned char*)p;
+            size = info.st_size;
+            return true;
+        }
+
+        void close() {
+            if (data)
+                munmap((void*)data, size);
+            data = NULL;
+            size = 0;
+        }
+
+        const unsigned char *data;
+        size_t size;
+
+    private:
+        MappedFile(const MappedFile&);
+        MappedFile& operator=(const MappedFile&);
+};
+
+#endif
@@ -4,11 +4,7 @@
 #include "ray.h"
 #include "hitable.h"
 #include "texture.h"
-
-float randomFloat() {
-    // returns a random float [0, 1)
-    return ((float) rand() / (RAND_MAX));
-}
+#include "random.h"
 
 Vector3 randomInUnitSphere() {
     Vector3 p;
@@ -40,28 +36,37 @@ float schlick(float cosine, float refIDX) {
     return r0 + (1-r0)*pow((1-cosine),5);
 }
 
+enum MaterialType { MATERIAL_OTHER, MATERIAL_LAMBERTIAN, MATERIAL_METAL, MATERIAL_DIELECTRIC, MATERIAL_DIFFUSE_LIGHT, MATERIAL_ISOTROPIC };
+
+/*
+    Like Texture, type lets scatterMaterial and emittedMaterial switch on the
+    concrete class; the virtual functions remain for materials defined elsewhere.
+    The switch calls the tagged classes' own functions, so they are final.
+*/
 class Material {
     public:
+        Material() : type(MATERIAL_OTHER) {}
         virtual bool scatter(const Ray& rIn, const HitRecord& rec, Vector3& attenuation, Ray& scattered) const = 0;
         virtual Vector3 emitted(float u, float v, const Vector3& p) const { return Vector3(0,0,0); }
+        MaterialType type;
 };
 
-class Lambertian : public Material {
+class Lambertian final : public Material {
     public:
-        Lambertian(Texture *a) : albedo(a) {}
+        Lambertian(Texture *a) : albedo(a) { type = MATERIAL_LAMBERTIAN; }
         virtual bool scatter(const Ray& rIn, const HitRecord& rec, Vector3& attenuation, Ray& scattered) const {
             Vector3 target = rec.p + rec.normal + randomInUnitSphere();
             scattered = Ray(rec.p, target-rec.p, rIn.time());
-            attenuation = albedo->value(rec.u, rec.v, rec.p);
+            attenuation = textureValue(albedo, rec.u, rec.v, rec.p, rec.uvWidth);
             return true;
         }
 
         Texture *albedo;
 };
 
-class Metal : public Material {
+class Metal final : public Material {
     public:
-        Metal(const Vector3 a, float f) : albedo(a) { if (f < 1) fuzz = f; else fuzz = 1;}
+        Metal(const Vector3 a, float f) : albedo(a) { type = MATERIAL_METAL; if (f < 1) fuzz = f; else fuzz = 1;}
         virtual bool scatter(const Ray& rIn, const HitRecord& rec, Vector3& attenuation, Ray& scattered) const {
             Vector3 reflected = reflect(unitVector(rIn.direction()), rec.normal);
             scattered = Ray(rec.p, reflected + fuzz*randomInUnitSphere());
@@ -73,9 +78,9 @@ class Metal : public Material {
         float fuzz;
 };
 
-class Dielectric : public Material {
+class Dielectric final : public Material {
 public:
-        Dielectric(float ri) : refIDX(ri) {}
+        Dielectric(float ri) : refIDX(ri) { type = MATERIAL_DIELECTRIC; }
         virtual bool scatter(const Ray& rIn, const HitRecord& rec, Vector3& attenuation, Ray& scattered) const {
             Vector3 outwardNormal;
             Vector3 reflected = reflect(rIn.direction(), rec.normal);
@@ -110,25 +115,44 @@ public:
         float refIDX;
 };
 
-class DiffuseLight : public Material {
+class DiffuseLight final : public Material {
     public:
-        DiffuseLight(Texture *a) : emit(a) {}
+        DiffuseLight(Texture *a) : emit(a) { type = MATERIAL_DIFFUSE_LIGHT; }
         virtual bool scatter(const Ray& rIn, const HitRecord& rec, Vector3& attenuation, Ray& scattered) const { return false; }
         virtual Vector3 emitted(float u, float v, const Vector3& p) const {
-            return emit->value(u, v, p);
+            return textureValue(emit, u, v, p);
         }
         Texture *emit;
 };
 
-class Isotropic : public Material {
+class Isotropic final : public Material {
     public:
-        Isotropic(Texture *a) : albedo(a) {}
+        Isotropic(Texture *a) : albedo(a) { type = MATERIAL_ISOTROPIC; }
         virtual bool scatter(const Ray& rIn, const HitRecord& rec, Vector3& attenuation, Ray& scattered) const {
             scattered = Ray(rec.p, randomInUnitSphere());
-            attenuation = albedo->value(rec.u, rec.v, rec.p);
+            attenuation = textureValue(albedo, rec.u, rec.v, rec.p, rec.uvWidth);
             return true;
         }
         Texture *albedo;
 };
 
+inline bool scatterMaterial(const Material *m, const Ray& rIn, const HitRecord& rec, Vector3& attenuation, Ray& scattered) {
+    switch (m->type) {
+        case MATERIAL_LAMBERTIAN: return static_cast<const Lambertian*>(m)->Lambertian::scatter(rIn, rec, attenuation, scattered);
+        case MATERIAL_METAL: return static_cast<const Metal*>(m)->Metal::scatter(rIn, rec, attenuation, scattered);
+        case MATERIAL_DIELECTRIC: return static_cast<const Dielectric*>(m)->Dielectric::scatter(rIn, rec, attenuation, scattered);
+        case MATERIAL_DIFFUSE_LIGHT: return false;
+        case MATERIAL_ISOTROPIC: return static_cast<const Isotropic*>(m)->Isotropic::scatter(rIn, rec, attenuation, scattered);
+        default: return m->scatter(rIn, rec, attenuation, scattered);
+    }
+}
+
+inline Vector3 emittedMaterial(const Material *m, float u, float v, const Vector3& p) {
+    switch (m->type) {
+        case MATERIAL_DIFFUSE_LIGHT: return static_cast<const DiffuseLight*>(m)->DiffuseLight::emitted(u, v, p);
+        case MATERIAL_OTHER: return m->emitted(u, v, p);
+        default: return Vector3(0,0,0);
+    }
+}
+
 #endif
\ No newline at end of file
@@ -0,0 +1,75 @@
+#ifndef MIPMAPH
+#define MIPMAPH
+
+#include <vector>
+
+#include "vector.h"
+
+// source texels under texel i when n texels shrink to m (at most halving), and their share of its area
+inline int boxFilterTaps(int n, int m, int i, int *src, float *weight) {
+    float scale = float(n) / m;
+    float x0 = i*scale, x1 = (i+1)*scale;
+    int taps = 0;
+    for (int s = int(x0); s < x1 && s < n; s++) {
+        src[taps] = s;
+        weight[taps++] = (ffmin(s+1, x1) - ffmax(s, x0)) / scale;
+    }
+    return taps;
+}
+
+/*
+    Mip levels of an 8-bit RGB image: each level box-filters the one above to
+    half size (rounding up), down to 1x1. Level 0 is the caller's pixels and
+    is not copied.
+*/
+class MipPyramid {
+    public:
+        MipPyramid() : base(NULL) {}
+        MipPyramid(const unsigned char *pixels, int nx, int ny);
+        int levels() const { return int(width.size()); }
+        const unsigned char *level(int l) const { return l == 0 ? base : &storage[offset[l]]; }
+
+        std::vector<int> width, height;
+
+    private:
+        const unsigned char *base;
+        std::vector<unsigned char> storage; // levels 1 and up, one after another
+        std::vector<size_t> offset;
+};
+
+MipPyramid::MipPyramid(const unsigned char *pixels, int nx, int ny) : base(pixels) {
+    offset.push_back(0);
+    width.push_back(nx);
+    height.push_back(ny);
+    while (width.back() > 1 || height.back() > 1) {
+        int w = width.back(), h = height.back();
+        int w2 = (w + 1) / 2, h2 = (h + 1) / 2;
+        size_t start = storage.size();
+        storage.resize(start + size_t(3)*w2*h2);
+        // a box filter by area, so odd sizes weight their texels fairly
+        const unsigned char *src = level(levels() - 1);
+        for (int j = 0; j < h2; j++) {
+            int sj[3];
+            float wj[3];
+            int nj = boxFilterTaps(h, h2, j, sj, wj);
+            for (int i = 0; i < w2; i++) {
+                int si[3];
+                float wi[3];
+                int ni = boxFilterTaps(w, w2, i, si, wi);
+                for (int c = 0; c < 3; c++) {
+                    float sum = 0;
+                    for (int b = 0; b < nj; b++) {
+                        for (int a = 0; a < ni; a++)
+                            sum += wj[b]*wi[a]*src[3*(sj[b]*w + si[a]) + c];
+                    }
+                    storage[start + 3*(j*w2 + i) + c] = (unsigned char)(sum + 0.5f);
+                }
+            }
+        }
+        offset.push_back(start);
+        width.push_back(w2);
+        height.push_back(h2);
+    }
+}
+
+#endif
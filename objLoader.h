@@ -0,0 +1,107 @@
+#ifndef OBJLOADERH
+#define OBJLOADERH
+
+#include <fstream>
+#include <map>
+#include <sstream>
+#include <string>
+#include <tuple>
+
+#include "triangleMesh.h"
+
+/*
+    Reads the geometry of a Wavefront OBJ file (v, vt, vn and f records) into
+    mesh. Polygons are split into triangle fans and each distinct v/vt/vn
+    combination becomes one shared mesh vertex. Normals are kept only when
+    every face gives them. Materials and groups are ignored.
+*/
+bool loadOBJ(const std::string& fileName, TriangleMesh& mesh) {
+    std::ifstream file(fileName.c_str());
+    if (!file) {
+        std::cerr << "Error: could not open " << fileName << std::endl;
+        return false;
+    }
+
+    std::vector<Vector3> positions, normals;
+    std::vector<float> uvs;
+    std::map<std::tuple<int,int,int>, int> vertexIds;
+    bool hasUVs = false, hasNormals = false, missingNormals = false;
+
+    auto resolve = [](int index, int count) { return index < 0 ? count + index : index - 1; };
+
+    std::string line;
+    int lineNumber = 0;
+    while (std::getline(file, line)) {
+        lineNumber++;
+        std::istringstream in(line);
+        std::string tag;
+        in >> tag;
+        if (tag == "v") {
+            Vector3 p;
+            in >> p;
+            positions.push_back(p);
+        } else if (tag == "vt") {
+            float u = 0, v = 0;
+            in >> u >> v;
+            uvs.push_back(u);
+            uvs.push_back(v);
+        } else if (tag == "vn") {
+            Vector3 n;
+            in >> n;
+            normals.push_back(n);
+        } else if (tag == "f") {
+            std::vector<int> face;
+            std::string corner;
+            while (in >> corner) {
+                int vi = 0, ti = 0, ni = 0;
+                size_t first = corner.find('/');
+                vi = atoi(corner.substr(0, first).c_str());
+                if (first != std::string::npos) {
+                    size_t second = corner.find('/', first+1);
+                    std::string t = corner.substr(first+1, second == std::string::npos ? std::string::npos : second-first-1);
+                    if (!t.empty())
+                        ti = atoi(t.c_str());
+                    if (second != std::string::npos)
+                        ni = atoi(corner.substr(second+1).c_str());
+                }
+                vi = resolve(vi, int(positions.size()));
+                ti = ti ? resolve(ti, int(uvs.size()/2)) : -1;
+                ni = ni ? resolve(ni, int(normals.size())) : -1;
+                if (vi < 0 || vi >= int(positions.size()) || ti >= int(uvs.size()/2) || ni >= int(normals.size())) {
+                    std::cerr << "Error: bad face index in " << fileName << " line " << lineNumber << std::endl;
+                    return false;
+                }
+
+                std::tuple<int,int,int> key(vi, ti, ni);
+                auto found = vertexIds.find(key);
+                if (found == vertexIds.end()) {
+                    int id = int(mesh.vertices.size());
+                    mesh.vertices.push_back(positions[vi]);
+                    mesh.normals.push_back(ni >= 0 ? normals[ni] : Vector3(0,0,0));
+                    mesh.uvs.push_back(ti >= 0 ? uvs[2*ti] : 0);
+                    mesh.uvs.push_back(ti >= 0 ? uvs[2*ti+1] : 0);
+                    hasUVs = hasUVs || ti >= 0;
+                    hasNormals = hasNormals || ni >= 0;
+                    missingNormals = missingNormals || ni < 0;
+                    found = vertexIds.insert(std::make_pair(key, id)).first;
+                }
+                face.push_back(found->second);
+            }
+            for (int i = 1; i + 1 < int(face.size()); i++) {
+                mesh.indices.push_back(face[0]);
+                mesh.indices.push_back(face[i]);
+                mesh.indices.push_back(face[i+1]);
+            }
+        }
+    }
+
+    // interpolating with a vertex that has no normal would give a zero one
+    if (!hasNormals || missingNormals)
+        mesh.normals.clear();
+    if (!hasUVs)
+        mesh.uvs.clear();
+    mesh.build();
+    return true;
+}
+
+#endif
@@ -0,0 +1,97 @@
+#ifndef OUTPUTQUEUEH
+#define OUTPUTQUEUEH
+
+#include <condition_variable>
+#include <deque>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "framebuffer.h"
+
+/*
+    Encodes and writes finished images on a thread of its own, so the render
+    threads carry on with the next frame or pass in the meantime. Each job is
+    one image written to any number of files, each in the format its name
+    asks for. At most capacity jobs wait: push() blocks until there is room,
+    or with wait false gives up instead, for images that may be skipped when
+    the writer falls behind.
+*/
+class OutputQueue {
+    public:
+        struct Job {
+            std::shared_ptr<const Framebuffer> image;
+            std::vector<std::string> fileNames;
+            ToneMapSettings settings;
+        };
+
+        explicit OutputQueue(size_t _capacity = 2);
+        ~OutputQueue() { finish(); }
+        bool push(const Job& job, bool wait = true);
+        bool finish();
+
+        size_t capacity;
+
+    private:
+        void run();
+
+        std::mutex lock;
+        std::condition_variable changed;
+        std::deque<Job> jobs;
+        bool closing;
+        int failures;
+        std::thread worker;
+};
+
+OutputQueue::OutputQueue(size_t _capacity) : capacity(_capacity), closing(false), failures(0) {
+    worker = std::thread(&OutputQueue::run, this);
+}
+
+bool OutputQueue::push(const Job& job, bool wait) {
+    std::unique_lock<std::mutex> guard(lock);
+    if (!wait && jobs.size() >= capacity)
+        return false;
+    changed.wait(guard, [this]{ return jobs.size() < capacity; });
+    jobs.push_back(job);
+    changed.notify_all();
+    return true;
+}
+
+// waits for everything queued to be written; false if any file failed
+bool OutputQueue::finish() {
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        closing = true;
+        changed.notify_all();
+    }
+    if (worker.joinable())
+        worker.join();
+    return failures == 0;
+}
+
+void OutputQueue::run() {
+    while (true) {
+        Job job;
+        {
+            std::unique_lock<std::mutex> guard(lock);
+            changed.wait(guard, [this]{ return !jobs.empty() || closing; });
+            if (jobs.empty())
+                return;
+            job = jobs.front();
+            jobs.pop_front();
+            changed.notify_all();
+        }
+        for (size_t i = 0; i < job.fileNames.size(); i++) {
+            if (!writeImage(*job.image, job.fileNames[i], job.settings)) {
+                std::cout << "Error: writing to file " << job.fileNames[i] << " failed!" << std::endl;
+                std::lock_guard<std::mutex> guard(lock);
+                failures++;
+            }
+        }
+    }
+}
+
+#endif
@@ -0,0 +1,242 @@
+#ifndef PERLINH
+#define PERLINH
+
+#include <vector>
+#if defined(__AVX2__) && defined(__FMA__)
+#include <immintrin.h>
+#endif
+
+#include "vector.h"
+
+/*
+    Gradient (improved Perlin) noise. Lattice corners hash through one shared
+    permutation table and pick one of 12 edge gradients from the low bits of
+    the hash, so there are no per-corner tables to keep. mask sets the lattice
+    period (a power of two up to 256) and lets a baked volume tile seamlessly.
+    noise8 evaluates eight points at once with AVX2 and FMA.
+*/
+class Perlin {
+    public:
+        Perlin(int period = 256) : mask(period - 1) {}
+        float noise(const Vector3& p) const;
+        void noise8(const float *x, const float *y, const float *z, float *out) const;
+        float turbulence(const Vector3& p, int octaves = 7) const;
+
+        int mask;
+        static int *perm; // 512 entries: the permutation twice, so perm[perm[i] + j] needs no wrap
+};
+
+static int* perlinGeneratePerm() {
+    int *p = new int[512];
+    for (int i = 0; i < 256; i++)
+        p[i] = i;
+    for (int i = 255; i > 0; i--) {
+        int target = int(drand48()*(i+1));
+        int tmp = p[i];
+        p[i] = p[target];
+        p[target] = tmp;
+    }
+    for (int i = 0; i < 256; i++)
+        p[256+i] = p[i];
+    return p;
+}
+
+int *Perlin::perm = perlinGeneratePerm();
+
+inline float perlinFade(float t) { return t*t*t*(t*(t*6 - 15) + 10); }
+inline float perlinLerp(float t, float a, float b) { return a + t*(b - a); }
+
+inline float perlinGrad(int hash, float x, float y, float z) {
+    int h = hash & 15;
+    float u = h < 8 ? x : y;
+    float v = h < 4 ? y : (h == 12 || h == 14 ? x : z);
+    return ((h & 1) ? -u : u) + ((h & 2) ? -v : v);
+}
+
+float Perlin::noise(const Vector3& p) const {
+    int i[2], j[2], k[2];
+    float f[3];
+    for (int a = 0; a < 3; a++)
+        f[a] = p[a] - floor(p[a]);
+    i[0] = int(floor(p.x())) & mask;
+    j[0] = int(floor(p.y())) & mask;
+    k[0] = int(floor(p.z())) & mask;
+    i[1] = (i[0] + 1) & mask;
+    j[1] = (j[0] + 1) & mask;
+    k[1] = (k[0] + 1) & mask;
+
+    float c[2][2][2];
+    for (int di = 0; di < 2; di++) {
+        for (int dj = 0; dj < 2; dj++) {
+            for (int dk = 0; dk < 2; dk++) {
+                int h = perm[perm[perm[i[di]] + j[dj]] + k[dk]];
+                c[di][dj][dk] = perlinGrad(h, f[0] - di, f[1] - dj, f[2] - dk);
+            }
+        }
+    }
+    float u = perlinFade(f[0]), v = perlinFade(f[1]), w = perlinFade(f[2]);
+    float x00 = perlinLerp(u, c[0][0][0], c[1][0][0]);
+    float x10 = perlinLerp(u, c[0][1][0], c[1][1][0]);
+    float x01 = perlinLerp(u, c[0][0][1], c[1][0][1]);
+    float x11 = perlinLerp(u, c[0][1][1], c[1][1][1]);
+    return perlinLerp(w, perlinLerp(v, x00, x10), perlinLerp(v, x01, x11));
+}
+
+#if defined(__AVX2__) && defined(__FMA__)
+inline __m256 perlinFade8(__m256 t) {
+    __m256 inner = _mm256_fmadd_ps(t, _mm256_fmsub_ps(t, _mm256_set1_ps(6), _mm256_set1_ps(15)), _mm256_set1_ps(10));
+    return _mm256_mul_ps(_mm256_mul_ps(_mm256_mul_ps(t, t), t), inner);
+}
+
+inline __m256 perlinLerp8(__m256 t, __m256 a, __m256 b) {
+    return _mm256_fmadd_ps(t, _mm256_sub_ps(b, a), a);
+}
+
+inline __m256 perlinGrad8(__m256i hash, __m256 x, __m256 y, __m256 z) {
+    __m256i h = _mm256_and_si256(hash, _mm256_set1_epi32(15));
+    __m256 hLess8 = _mm256_castsi256_ps(_mm256_cmpgt_epi32(_mm256_set1_epi32(8), h));
+    __m256 hLess4 = _mm256_castsi256_ps(_mm256_cmpgt_epi32(_mm256_set1_epi32(4), h));
+    __m256 h12or14 = _mm256_castsi256_ps(_mm256_or_si256(_mm256_cmpeq_epi32(h, _mm256_set1_epi32(12)),
+                                                         _mm256_cmpeq_epi32(h, _mm256_set1_epi32(14))));
+    __m256 u = _mm256_blendv_ps(y, x, hLess8);
+    __m256 v = _mm256_blendv_ps(_mm256_blendv_ps(z, x, h12or14), y, hLess4);
+    // bits 0 and 1 of the hash flip the signs of u and v
+    __m256 signU = _mm256_castsi256_ps(_mm256_slli_epi32(h, 31));
+    __m256 signV = _mm256_castsi256_ps(_mm256_slli_epi32(_mm256_srli_epi32(h, 1), 31));
+    return _mm256_add_ps(_mm256_xor_ps(u, signU), _mm256_xor_ps(v, signV));
+}
+#endif
+
+void Perlin::noise8(const float *x, const float *y, const float *z, float *out) const {
+#if defined(__AVX2__) && defined(__FMA__)
+    const __m256i m = _mm256_set1_epi32(mask);
+    const __m256i one = _mm256_set1_epi32(1);
+    __m256 p[3] = { _mm256_loadu_ps(x), _mm256_loadu_ps(y), _mm256_loadu_ps(z) };
+    __m256 f[3], g[3];
+    __m256i i0[3], i1[3];
+    for (int a = 0; a < 3; a++) {
+        __m256 fl = _mm256_floor_ps(p[a]);
+        f[a] = _mm256_sub_ps(p[a], fl);
+        g[a] = _mm256_sub_ps(f[a], _mm256_set1_ps(1));
+        i0[a] = _mm256_and_si256(_mm256_cvttps_epi32(fl), m);
+        i1[a] = _mm256_and_si256(_mm256_add_epi32(i0[a], one), m);
+    }
+
+    __m256i pi0 = _mm256_i32gather_epi32(perm, i0[0], 4);
+    __m256i pi1 = _mm256_i32gather_epi32(perm, i1[0], 4);
+    __m256i h00 = _mm256_i32gather_epi32(perm, _mm256_add_epi32(pi0, i0[1]), 4);
+    __m256i h01 = _mm256_i32gather_epi32(perm, _mm256_add_epi32(pi0, i1[1]), 4);
+    __m256i h10 = _mm256_i32gather_epi32(perm, _mm256_add_epi32(pi1, i0[1]), 4);
+    __m256i h11 = _mm256_i32gather_epi32(perm, _mm256_add_epi32(pi1, i1[1]), 4);
+    #define PERLIN_CORNER(h, k, fx, fy, fz) \
+        perlinGrad8(_mm256_i32gather_epi32(perm, _mm256_add_epi32(h, k), 4), fx, fy, fz)
+    __m256 c000 = PERLIN_CORNER(h00, i0[2], f[0], f[1], f[2]);
+    __m256 c001 = PERLIN_CORNER(h00, i1[2], f[0], f[1], g[2]);
+    __m256 c010 = PERLIN_CORNER(h01, i0[2], f[0], g[1], f[2]);
+    __m256 c011 = PERLIN_CORNER(h01, i1[2], f[0], g[1], g[2]);
+    __m256 c100 = PERLIN_CORNER(h10, i0[2], g[0], f[1], f[2]);
+    __m256 c101 = PERLIN_CORNER(h10, i1[2], g[0], f[1], g[2]);
+    __m256 c110 = PERLIN_CORNER(h11, i0[2], g[0], g[1], f[2]);
+    __m256 c111 = PERLIN_CORNER(h11, i1[2], g[0], g[1], g[2]);
+    #undef PERLIN_CORNER
+
+    __m256 u = perlinFade8(f[0]), v = perlinFade8(f[1]), w = perlinFade8(f[2]);
+    __m256 x00 = perlinLerp8(u, c000, c100);
+    __m256 x10 = perlinLerp8(u, c010, c110);
+    __m256 x01 = perlinLerp8(u, c001, c101);
+    __m256 x11 = perlinLerp8(u, c011, c111);
+    _mm256_storeu_ps(out, perlinLerp8(w, perlinLerp8(v, x00, x10), perlinLerp8(v, x01, x11)));
+#else
+    for (int i = 0; i < 8; i++)
+        out[i] = noise(Vector3(x[i], y[i], z[i]));
+#endif
+}
+
+// sum of |noise| over octaves of doubling frequency and halving weight; eight octaves go in one noise8 call
+float Perlin::turbulence(const Vector3& p, int octaves) const {
+    float accum = 0;
+    float weight = 1;
+    float scale = 1;
+    for (int first = 0; first < octaves; first += 8) {
+        float x[8], y[8], z[8], n[8];
+        for (int i = 0; i < 8; i++) {
+            x[i] = p.x()*scale;
+            y[i] = p.y()*scale;
+            z[i] = p.z()*scale;
+            scale *= 2;
+        }
+        noise8(x, y, z, n);
+        for (int i = 0; i < 8 && first + i < octaves; i++) {
+            accum += weight*fabs(n[i]);
+            weight *= 0.5f;
+        }
+    }
+    return accum;
+}
+
+/*
+    Turbulence baked into a periodic grid once, so shading does a trilinear
+    lookup instead of evaluating every octave. The noise is generated with a
+    lattice period of period units, which makes the grid tile without seams.
+    Only the octaves the grid can hold are baked: octave k has 2^k cycles a
+    unit and needs at least twice that many samples. turbulence() adds the
+    finer octaves live, from the same periodic lattice.
+*/
+class BakedNoise {
+    public:
+        BakedNoise(int _period = 16, int samplesPerUnit = 8, int _octaves = 7);
+        float lookup(const Vector3& p) const;
+        float turbulence(const Vector3& p) const;
+
+        int period;
+        int n; // samples along each axis
+        float samplesPerUnit;
+        int octaves, bakedOctaves;
+        Perlin noise;
+        std::vector<float> values;
+};
+
+BakedNoise::BakedNoise(int _period, int _samplesPerUnit, int _octaves) :
+    period(_period), n(_period*_samplesPerUnit), samplesPerUnit(float(_samplesPerUnit)), octaves(_octaves), bakedOctaves(0),
+    noise(_period), values(n*n*n) {
+    while (bakedOctaves < octaves && 2*(1 << bakedOctaves) <= _samplesPerUnit)
+        bakedOctaves++;
+    for (int k = 0; k < n; k++) {
+        for (int j = 0; j < n; j++) {
+            for (int i = 0; i < n; i++)
+                values[(k*n + j)*n + i] = noise.turbulence(Vector3(i, j, k) / samplesPerUnit, bakedOctaves);
+        }
+    }
+}
+
+// octave bakedOctaves onwards, which weigh 2^-bakedOctaves of what they would from octave 0
+float BakedNoise::turbulence(const Vector3& p) const {
+    float sum = lookup(p);
+    if (bakedOctaves < octaves) {
+        float scale = float(1 << bakedOctaves);
+        sum += noise.turbulence(p*scale, octaves - bakedOctaves) / scale;
+    }
+    return sum;
+}
+
+float BakedNoise::lookup(const Vector3& p) const {
+    int i0[3], i1[3];
+    float f[3];
+    for (int a = 0; a < 3; a++) {
+        float g = p[a]*samplesPerUnit;
+        float fl = floor(g);
+        f[a] = g - fl;
+        i0[a] = int(fl) % n;
+        if (i0[a] < 0)
+            i0[a] += n;
+        i1[a] = i0[a] + 1 == n ? 0 : i0[a] + 1;
+    }
+    auto at = [&](const int *x, const int *y, const int *z) { return values[(z[2]*n + y[1])*n + x[0]]; };
+    float c00 = at(i0, i0, i0)*(1-f[0]) + at(i1, i0, i0)*f[0];
+    float c10 = at(i0, i1, i0)*(1-f[0]) + at(i1, i1, i0)*f[0];
+    float c01 = at(i0, i0, i1)*(1-f[0]) + at(i1, i0, i1)*f[0];
+    float c11 = at(i0, i1, i1)*(1-f[0]) + at(i1, i1, i1)*f[0];
+    return (c00*(1-f[1]) + c10*f[1])*(1-f[2]) + (c01*(1-f[1]) + c11*f[1])*f[2];
+}
+
+#endif
@@ -0,0 +1,372 @@
+#ifndef PLYLOADERH
+#define PLYLOADERH
+
+#include <sys/resource.h>
+#include <stdint.h>
+#include <string.h>
+
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "mappedFile.h"
+#include "parallel.h"
+#include "triangleMesh.h"
+
+enum PLYType { PLY_NONE, PLY_INT8, PLY_UINT8, PLY_INT16, PLY_UINT16, PLY_INT32, PLY_UINT32, PLY_FLOAT32, PLY_FLOAT64 };
+
+struct PLYProperty {
+    std::string name;
+    PLYType type;
+    PLYType countType; // PLY_NONE unless this is a list
+};
+
+struct PLYElement {
+    std::string name;
+    long count;
+    std::vector<PLYProperty> properties;
+    int recordSize; // -1 when the element has a list property
+};
+
+PLYType plyType(const std::string& name) {
+    if (name == "char" || name == "int8") return PLY_INT8;
+    if (name == "uchar" || name == "uint8") return PLY_UINT8;
+    if (name == "short" || name == "int16") return PLY_INT16;
+    if (name == "ushort" || name == "uint16") return PLY_UINT16;
+    if (name == "int" || name == "int32") return PLY_INT32;
+    if (name == "uint" || name == "uint32") return PLY_UINT32;
+    if (name == "float" || name == "float32") return PLY_FLOAT32;
+    if (name == "double" || name == "float64") return PLY_FLOAT64;
+    return PLY_NONE;
+}
+
+int plyTypeSize(PLYType type) {
+    static const int sizes[] = { 0, 1, 1, 2, 2, 4, 4, 4, 8 };
+    return sizes[type];
+}
+
+inline double readPLYValue(const unsigned char *p, PLYType type) {
+    switch (type) {
+        case PLY_INT8: return *(const int8_t*)p;
+        case PLY_UINT8: return *p;
+        case PLY_INT16: { int16_t v; memcpy(&v, p, 2); return v; }
+        case PLY_UINT16: { uint16_t v; memcpy(&v, p, 2); return v; }
+        case PLY_INT32: { int32_t v; memcpy(&v, p, 4); return v; }
+        case PLY_UINT32: { uint32_t v; memcpy(&v, p, 4); return v; }
+        case PLY_FLOAT32: { float v; memcpy(&v, p, 4); return v; }
+        case PLY_FLOAT64: { double v; memcpy(&v, p, 8); return v; }
+        default: return 0;
+    }
+}
+
+// bytes taken by one record starting at p, walking any list properties; false when it would run past end
+inline bool plyRecordSize(const PLYElement& element, const unsigned char *p, const unsigned char *end, size_t& size) {
+    size_t left = end - p;
+    if (element.recordSize >= 0) {
+        size = element.recordSize;
+        return size <= left;
+    }
+    size = 0;
+    for (size_t i = 0; i < element.properties.size(); i++) {
+        const PLYProperty& prop = element.properties[i];
+        if (prop.countType == PLY_NONE) {
+            size += plyTypeSize(prop.type);
+            continue;
+        }
+        size_t countSize = plyTypeSize(prop.countType);
+        if (size + countSize > left)
+            return false;
+        double n = readPLYValue(p + size, prop.countType);
+        size += countSize;
+        if (n < 0 || n > double(left - size) / plyTypeSize(prop.type))
+            return false;
+        size += size_t(n)*plyTypeSize(prop.type);
+    }
+    return size <= left;
+}
+
+long peakRSSKilobytes() {
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_maxrss;
+}
+
+/*
+    Loads a binary little-endian PLY mesh by mapping the file. When the vertex
+    record is exactly three floats the mesh reads positions straight out of the
+    mapping; otherwise vertices are decoded in parallel. Faces are fan
+    triangulated in parallel chunks found by one quick scan of the list counts.
+*/
+bool loadPLY(const std::string& fileName, TriangleMesh& mesh) {
+    auto start = std::chrono::steady_clock::now();
+
+    std::shared_ptr<MappedFile> file(new MappedFile());
+    if (!file->open(fileName)) {
+        std::cerr << "Error: could not map " << fileName << std::endl;
+        return false;
+    }
+
+    const char *text = (const char*)file->data;
+    const char *headerEnd = (const char*)memmem(text, file->size, "end_header", 10);
+    if (file->size < 3 || memcmp(text, "ply", 3) != 0 || headerEnd == NULL) {
+        std::cerr << "Error: " << fileName << " is not a PLY file" << std::endl;
+        return false;
+    }
+    const unsigned char *body = (const unsigned char*)memchr(headerEnd, '\n', file->size - (headerEnd - text));
+    if (body == NULL) {
+        std::cerr << "Error: " << fileName << " has a truncated header" << std::endl;
+        return false;
+    }
+    body++;
+
+    std::vector<PLYElement> elements;
+    std::istringstream header(std::string(text, headerEnd - text));
+    std::string line;
+    while (std::getline(header, line)) {
+        std::istringstream in(line);
+        std::string tag;
+        in >> tag;
+        if (tag == "format") {
+            std::string format;
+            in >> format;
+            if (format != "binary_little_endian") {
+                std::cerr << "Error: " << fileName << " is " << format << ", only binary_little_endian is supported" << std::endl;
+                return false;
+            }
+        } else if (tag == "element") {
+            PLYElement element;
+            in >> element.name >> element.count;
+            if (!in || element.count < 0) {
+                std::cerr << "Error: bad element count in " << fileName << ": " << line << std::endl;
+                return false;
+            }
+            element.recordSize = 0;
+            elements.push_back(element);
+        } else if (tag == "property" && !elements.empty()) {
+            PLYProperty prop;
+            std::string type;
+            in >> type;
+            if (type == "list") {
+                std::string countType;
+                in >> countType >> type;
+                prop.countType = plyType(countType);
+                if (prop.countType == PLY_NONE || prop.countType == PLY_FLOAT32 || prop.countType == PLY_FLOAT64) {
+                    std::cerr << "Error: list counts must be integers in " << fileName << ": " << line << std::endl;
+                    return false;
+                }
+                elements.back().recordSize = -1;
+            } else {
+                prop.countType = PLY_NONE;
+            }
+            prop.type = plyType(type);
+            in >> prop.name;
+            if (prop.type == PLY_NONE) {
+                std::cerr << "Error: unknown property type in " << fileName << ": " << line << std::endl;
+                return false;
+            }
+            if (elements.back().recordSize >= 0)
+                elements.back().recordSize += plyTypeSize(prop.type);
+            elements.back().properties.push_back(prop);
+        }
+    }
+
+    const unsigned char *end = file->data + file->size;
+    const unsigned char *p = body;
+    const unsigned char *vertexData = NULL;
+    const unsigned char *faceData = NULL;
+    const PLYElement *vertexElement = NULL;
+    const PLYElement *faceElement = NULL;
+    for (size_t e = 0; e < elements.size(); e++) {
+        const PLYElement& element = elements[e];
+        if (element.name == "vertex") {
+            vertexElement = &element;
+            vertexData = p;
+        } else if (element.name == "face") {
+            faceElement = &element;
+            faceData = p;
+        }
+        // every record is checked to end inside the file here, so the passes below need not
+        bool complete = true;
+        if (element.recordSize >= 0) {
+            complete = element.recordSize == 0 || element.count <= (end - p) / element.recordSize;
+            if (complete)
+                p += element.count * element.recordSize;
+        } else {
+            for (long i = 0; i < element.count && complete; i++) {
+                size_t size;
+                complete = plyRecordSize(element, p, end, size);
+                if (complete)
+                    p += size;
+            }
+        }
+        if (!complete) {
+            std::cerr << "Error: " << fileName << " is truncated or malformed" << std::endl;
+            return false;
+        }
+    }
+    if (vertexElement == NULL || faceElement == NULL || vertexElement->recordSize < 0) {
+        std::cerr << "Error: " << fileName << " needs a fixed size vertex element and a face element" << std::endl;
+        return false;
+    }
+
+    // vertex layout
+    int offsets[8];
+    PLYType types[8];
+    const char *names[8][3] = {
+        {"x"}, {"y"}, {"z"}, {"nx"}, {"ny"}, {"nz"}, {"u", "s", "texture_u"}, {"v", "t", "texture_v"}
+    };
+    int offset = 0;
+    for (int k = 0; k < 8; k++)
+        offsets[k] = -1;
+    for (size_t i = 0; i < vertexElement->properties.size(); i++) {
+        const PLYProperty& prop = vertexElement->properties[i];
+        for (int k = 0; k < 8; k++) {
+            for (int n = 0; n < 3; n++) {
+                if (names[k][n] && prop.name == names[k][n]) {
+                    offsets[k] = offset;
+                    types[k] = prop.type;
+                }
+            }
+        }
+        offset += plyTypeSize(prop.type);
+    }
+    if (offsets[0] < 0 || offsets[1] < 0 || offsets[2] < 0) {
+        std::cerr << "Error: " << fileName << " has no vertex positions" << std::endl;
+        return false;
+    }
+
+    long nVertices = vertexElement->count;
+    int stride = vertexElement->recordSize;
+    bool hasNormals = offsets[3] >= 0 && offsets[4] >= 0 && offsets[5] >= 0;
+    bool hasUVs = offsets[6] >= 0 && offsets[7] >= 0;
+    bool inPlace = stride == int(sizeof(Vector3)) && offsets[0] == 0 && offsets[1] == 4 && offsets[2] == 8 &&
+                   types[0] == PLY_FLOAT32 && types[1] == PLY_FLOAT32 && types[2] == PLY_FLOAT32;
+#if !defined(__x86_64__) && !defined(__i386__)
+    // the header length rarely leaves the floats aligned, which only x86 shrugs off
+    inPlace = inPlace && uintptr_t(vertexData) % alignof(Vector3) == 0;
+#endif
+
+    const long chunkSize = 16384;
+    if (inPlace) {
+        mesh.shareVertices((const Vector3*)vertexData, int(nVertices), file);
+    } else {
+        mesh.vertices.resize(nVertices);
+        if (hasNormals)
+            mesh.normals.resize(nVertices);
+        if (hasUVs)
+            mesh.uvs.resize(2*nVertices);
+        parallelForEach(0, int((nVertices + chunkSize - 1) / chunkSize), [&](int chunk) {
+            long last = std::min(nVertices, (chunk+1)*chunkSize);
+            for (long i = chunk*chunkSize; i < last; i++) {
+                const unsigned char *v = vertexData + i*stride;
+                for (int a = 0; a < 3; a++)
+                    mesh.vertices[i][a] = readPLYValue(v + offsets[a], types[a]);
+                if (hasNormals) {
+                    for (int a = 0; a < 3; a++)
+                        mesh.normals[i][a] = readPLYValue(v + offsets[3+a], types[3+a]);
+                }
+                if (hasUVs) {
+                    mesh.uvs[2*i] = readPLYValue(v + offsets[6], types[6]);
+                    mesh.uvs[2*i+1] = readPLYValue(v + offsets[7], types[7]);
+                }
+            }
+        });
+    }
+
+    // face layout: the index list and the fixed bytes in front of it
+    int listIndex = -1;
+    int listOffset = 0;
+    for (size_t i = 0; i < faceElement->properties.size(); i++) {
+        const PLYProperty& prop = faceElement->properties[i];
+        if (prop.countType != PLY_NONE && (prop.name == "vertex_indices" || prop.name == "vertex_index")) {
+            listIndex = int(i);
+            break;
+        }
+        if (prop.countType != PLY_NONE) {
+            listIndex = -2;
+            break;
+        }
+        listOffset += plyTypeSize(prop.type);
+    }
+    if (listIndex < 0) {
+        std::cerr << "Error: " << fileName << " faces need vertex_indices as their first list" << std::endl;
+        return false;
+    }
+    const PLYProperty& list = faceElement->properties[listIndex];
+
+    // one serial pass over the list counts to find where each chunk of faces starts
+    long nFaces = faceElement->count;
+    long nChunks = (nFaces + chunkSize - 1) / chunkSize;
+    std::vector<const unsigned char*> chunkStart(nChunks);
+    std::vector<long> chunkTriangle(nChunks + 1);
+    long nTriangles = 0;
+    p = faceData;
+    for (long i = 0; i < nFaces; i++) {
+        if (i % chunkSize == 0) {
+            chunkStart[i / chunkSize] = p;
+            chunkTriangle[i / chunkSize] = nTriangles;
+        }
+        long n = long(readPLYValue(p + listOffset, list.countType));
+        if (n >= 3)
+            nTriangles += n - 2;
+        size_t size;
+        plyRecordSize(*faceElement, p, end, size);
+        p += size;
+    }
+    chunkTriangle[nChunks] = nTriangles;
+
+    mesh.indices.resize(3*nTriangles);
+    std::atomic<bool> badIndex(false);
+    int countSize = plyTypeSize(list.countType);
+    int indexSize = plyTypeSize(list.type);
+    // checked before the conversion to int, which would turn a large uint index negative
+    auto vertexIndex = [&](const unsigned char *at) {
+        double index = readPLYValue(at, list.type);
+        if (index >= 0 && index < nVertices)
+            return int(index);
+        badIndex = true;
+        return 0;
+    };
+    parallelForEach(0, int(nChunks), [&](int chunk) {
+        const unsigned char *f = chunkStart[chunk];
+        int *out = &mesh.indices[3*chunkTriangle[chunk]];
+        long last = std::min(nFaces, (chunk+1)*chunkSize);
+        for (long i = chunk*chunkSize; i < last; i++) {
+            const unsigned char *indices = f + listOffset + countSize;
+            long n = long(readPLYValue(f + listOffset, list.countType));
+            // a face under three vertices has no indices to read, and may end the mapping
+            if (n >= 3) {
+                int first = vertexIndex(indices);
+                for (long k = 1; k + 1 < n; k++) {
+                    out[0] = first;
+                    out[1] = vertexIndex(indices + k*indexSize);
+                    out[2] = vertexIndex(indices + (k+1)*indexSize);
+                    out += 3;
+                }
+            }
+            size_t size;
+            plyRecordSize(*faceElement, f, end, size);
+            f += size;
+        }
+    });
+    if (badIndex) {
+        std::cerr << "Error: " << fileName << " has out of range vertex indices" << std::endl;
+        return false;
+    }
+
+    auto loaded = std::chrono::steady_clock::now();
+    mesh.build();
+    auto built = std::chrono::steady_clock::now();
+
+    std::cout << "Loaded " << fileName << ": " << nVertices << " vertices, " << nTriangles << " triangles"
+              << (inPlace ? " (positions read in place)" : "") << std::endl;
+    std::cout << "  read " << std::chrono::duration<double, std::milli>(loaded - start).count() << " ms, BVH "
+              << std::chrono::duration<double, std::milli>(built - loaded).count() << " ms, peak RSS "
+              << peakRSSKilobytes() / 1024 << " MB" << std::endl;
+    return true;
+}
+
+#endif
@@ -0,0 +1,245 @@
+#ifndef PREVIEWH
+#define PREVIEWH
+
+#include <errno.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <chrono>
+#include <condition_variable>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "framebuffer.h"
+
+/*
+    Shows a render while it runs. The renderer hands over snapshots of the
+    image with publish(), which does not wait: it swaps the newest snapshot
+    into a slot, or drops it if the server holds the slot that instant. The
+    server's own thread tone maps and sends the newest one to:
+
+        "-"          raw PPM frames, one after another, on stdout (the
+                     renderer's messages move to stderr)
+        "http:PORT"  an MJPEG stream at http://127.0.0.1:PORT/ for any
+                     number of browsers or players
+        a FIFO       raw PPM frames, reopened when its reader goes away
+        a file       the newest frame as a PPM image, rewritten each time
+
+    due() says whether a snapshot would be sent yet at the given rate, so
+    the renderer need not make ones that would be dropped. A reader that
+    stops reading for a second is dropped rather than let the server fall
+    behind.
+*/
+class PreviewServer {
+    public:
+        PreviewServer() : rate(2), fd(-1), listener(-1), stopping(false), fresh(false) {}
+        ~PreviewServer() { stop(); }
+        bool start(const std::string& target, float framesPerSecond, const ToneMapSettings& settings);
+        bool running() const { return thread.joinable(); }
+        bool due() const;
+        void publish(const std::shared_ptr<const Framebuffer>& image, bool wait = false);
+        void stop();
+
+    private:
+        void run();
+        void acceptClients();
+        bool send(int to, const std::vector<unsigned char>& data);
+        std::vector<unsigned char> encode(const Framebuffer& image) const;
+
+        std::string target;
+        float rate;
+        ToneMapSettings settings;
+        bool http;
+        int fd;        // stdout or the FIFO
+        int listener;
+        std::vector<int> clients;
+        std::vector<unsigned char> last; // the newest frame, for clients that connect later
+
+        std::thread thread;
+        std::mutex lock;
+        std::condition_variable changed;
+        bool stopping, fresh;
+        std::shared_ptr<const Framebuffer> pending;
+        std::chrono::steady_clock::time_point lastPublish;
+};
+
+bool PreviewServer::start(const std::string& _target, float framesPerSecond, const ToneMapSettings& _settings) {
+    target = _target;
+    rate = framesPerSecond;
+    settings = _settings;
+    http = target.compare(0, 5, "http:") == 0;
+    signal(SIGPIPE, SIG_IGN);
+    if (http) {
+        listener = socket(AF_INET, SOCK_STREAM, 0);
+        int yes = 1;
+        setsockopt(listener, SOL_SOCKET, SO_REUSEADDR, &yes, sizeof(yes));
+        sockaddr_in address = sockaddr_in();
+        address.sin_family = AF_INET;
+        address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        address.sin_port = htons(uint16_t(atoi(target.c_str() + 5)));
+        if (listener < 0 || bind(listener, (sockaddr*)&address, sizeof(address)) != 0 || listen(listener, 8) != 0) {
+            std::cerr << "Error: preview could not listen on " << target << std::endl;
+            return false;
+        }
+        fcntl(listener, F_SETFL, O_NONBLOCK);
+        std::cout << "Preview: http://127.0.0.1:" << target.substr(5) << "/" << std::endl;
+    } else if (target == "-") {
+        // frames keep stdout to themselves; everything else printed goes to stderr
+        std::cout.flush();
+        fd = dup(1);
+        dup2(2, 1);
+        fcntl(fd, F_SETFL, O_NONBLOCK);
+    }
+    lastPublish = std::chrono::steady_clock::now() - std::chrono::hours(1);
+    thread = std::thread(&PreviewServer::run, this);
+    return true;
+}
+
+bool PreviewServer::due() const {
+    return running() && std::chrono::steady_clock::now() - lastPublish >= std::chrono::duration<float>(1 / rate);
+}
+
+// wait makes sure image is shown, for the last one
+void PreviewServer::publish(const std::shared_ptr<const Framebuffer>& image, bool wait) {
+    if (!running())
+        return;
+    lastPublish = std::chrono::steady_clock::now();
+    std::unique_lock<std::mutex> guard(lock, std::try_to_lock);
+    if (!guard.owns_lock() && !wait)
+        return;
+    if (!guard.owns_lock())
+        guard.lock();
+    pending = image;
+    fresh = true;
+    changed.notify_one();
+}
+
+// sends whatever was published last, then closes every stream
+void PreviewServer::stop() {
+    if (!running())
+        return;
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        stopping = true;
+        changed.notify_one();
+    }
+    thread.join();
+    for (size_t i = 0; i < clients.size(); i++)
+        close(clients[i]);
+    clients.clear();
+    if (listener >= 0)
+        close(listener);
+    if (fd >= 0)
+        close(fd);
+    listener = fd = -1;
+}
+
+std::vector<unsigned char> PreviewServer::encode(const Framebuffer& image) const {
+    std::vector<unsigned char> pixels = toneMap(image, settings);
+    std::vector<unsigned char> out;
+    if (http) {
+        stbi_write_jpg_to_func([](void *context, void *data, int size) {
+            std::vector<unsigned char>& v = *(std::vector<unsigned char>*)context;
+            v.insert(v.end(), (unsigned char*)data, (unsigned char*)data + size);
+        }, &out, image.width, image.height, 3, pixels.data(), 80);
+        std::string part = "--jrayframe\r\nContent-Type: image/jpeg\r\nContent-Length: " + std::to_string(out.size()) + "\r\n\r\n";
+        out.insert(out.begin(), part.begin(), part.end());
+        out.push_back('\r');
+        out.push_back('\n');
+    } else {
+        std::string header = "P6\n" + std::to_string(image.width) + " " + std::to_string(image.height) + "\n255\n";
+        out.assign(header.begin(), header.end());
+        out.insert(out.end(), pixels.begin(), pixels.end());
+    }
+    return out;
+}
+
+// false when the reader is gone or has not taken anything for a second
+bool PreviewServer::send(int to, const std::vector<unsigned char>& data) {
+    size_t done = 0;
+    while (done < data.size()) {
+        pollfd p = { to, POLLOUT, 0 };
+        if (poll(&p, 1, 1000) <= 0)
+            return false;
+        ssize_t n = http ? ::send(to, &data[done], data.size() - done, MSG_NOSIGNAL) : write(to, &data[done], data.size() - done);
+        if (n < 0 && (errno == EAGAIN || errno == EINTR))
+            continue;
+        if (n <= 0)
+            return false;
+        done += n;
+    }
+    return true;
+}
+
+void PreviewServer::acceptClients() {
+    while (true) {
+        int client = accept(listener, NULL, NULL);
+        if (client < 0)
+            return;
+        // the request itself does not matter; every path gets the stream
+        char request[1024];
+        while (recv(client, request, sizeof(request), MSG_DONTWAIT) > 0) {}
+        std::string header = "HTTP/1.0 200 OK\r\nCache-Control: no-cache\r\nContent-Type: multipart/x-mixed-replace; boundary=jrayframe\r\n\r\n";
+        fcntl(client, F_SETFL, O_NONBLOCK);
+        if (send(client, std::vector<unsigned char>(header.begin(), header.end())) && (last.empty() || send(client, last)))
+            clients.push_back(client);
+        else
+            close(client);
+    }
+}
+
+void PreviewServer::run() {
+    while (true) {
+        std::shared_ptr<const Framebuffer> image;
+        bool finishing;
+        {
+            std::unique_lock<std::mutex> guard(lock);
+            changed.wait_for(guard, std::chrono::milliseconds(100), [this]{ return fresh || stopping; });
+            if (fresh)
+                image = pending;
+            fresh = false;
+            pending.reset();
+            finishing = stopping;
+        }
+        if (http)
+            acceptClients();
+        if (image) {
+            last = encode(*image);
+            if (http) {
+                for (size_t i = 0; i < clients.size(); ) {
+                    if (send(clients[i], last)) {
+                        i++;
+                    } else {
+                        close(clients[i]);
+                        clients.erase(clients.begin() + i);
+                    }
+                }
+            } else if (target == "-") {
+                send(fd, last);
+            } else {
+                struct stat info;
+                bool fifo = stat(target.c_str(), &info) == 0 && S_ISFIFO(info.st_mode);
+                // a FIFO without a reader fails to open; the next frame tries again
+                if (fd < 0)
+                    fd = open(target.c_str(), fifo ? O_WRONLY | O_NONBLOCK : O_WRONLY | O_CREAT | O_TRUNC | O_NONBLOCK, 0644);
+                if (fd >= 0 && (!send(fd, last) || !fifo)) {
+                    close(fd);
+                    fd = -1;
+                }
+            }
+        }
+        if (finishing)
+            return;
+    }
+}
+
+#endif
@@ -0,0 +1,60 @@
+#ifndef RANDOMH
+#define RANDOMH
+
+#include <stdint.h>
+
+/*
+    PCG32 (O'Neill): a 64-bit LCG with a permuted 32-bit output. Small,
+    fast and statistically sound, unlike rand(), which also serialises
+    threads on a lock.
+*/
+struct Pcg32 {
+    uint64_t state, inc;
+
+    void seed(uint64_t initState, uint64_t stream) {
+        state = 0;
+        inc = (stream << 1) | 1;
+        next();
+        state += initState;
+        next();
+    }
+    uint32_t next() {
+        uint64_t old = state;
+        state = old*6364136223846793005ull + inc;
+        uint32_t shifted = uint32_t(((old >> 18) ^ old) >> 27);
+        uint32_t rot = uint32_t(old >> 59);
+        return (shifted >> rot) | (shifted << ((32 - rot) & 31));
+    }
+    // [0, 1)
+    float nextFloat() { return (next() >> 8) * (1.0f / 16777216.0f); }
+};
+
+inline uint64_t splitMix64(uint64_t x) {
+    x += 0x9E3779B97F4A7C15ull;
+    x = (x ^ (x >> 30)) * 0xBF58476D1CE4E5B9ull;
+    x = (x ^ (x >> 27)) * 0x94D049BB133111EBull;
+    return x ^ (x >> 31);
+}
+
+// the generator every render-time random number on this thread comes from
+inline Pcg32& threadRandom() {
+    static thread_local Pcg32 rng = { 0x853C49E6748FEA9Bull, 0xDA3E39CB94B95BDBull };
+    return rng;
+}
+
+/*
+    Restarts this thread's generator for one sample of one pixel. Every
+    sample's random numbers then depend only on (seed, pixel, sample), not
+    on which thread ran it or what ran before, so any sample can be drawn
+    again and give the same value.
+*/
+inline void seedSample(uint64_t seed, uint64_t pixel, uint32_t sample) {
+    threadRandom().seed(splitMix64(seed ^ splitMix64(pixel)), sample);
+}
+
+// [0, 1)
+inline float randomFloat() {
+    return threadRandom().nextFloat();
+}
+
+#endif
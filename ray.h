@@ -18,4 +18,10 @@ class Ray {
 
 };
 
+// rays through the neighbouring pixels in x and y, for texture footprints
+struct RayDifferential {
+    Vector3 rxOrigin, rxDirection;
+    Vector3 ryOrigin, ryDirection;
+};
+
 #endif
\ No newline at end of file
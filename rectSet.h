@@ -0,0 +1,293 @@
+#ifndef RECTSETH
+#define RECTSETH
+
+#include <unordered_map>
+#include <vector>
+#if defined(__AVX2__) && defined(__FMA__)
+#include <immintrin.h>
+#endif
+
+#include "hitable.h"
+#include "leafBVH.h"
+#include "material.h"
+#include "rectangle.h"
+
+/*
+    Many axis-aligned rectangles stored as structure-of-arrays, sorted by the
+    axis they face. Every leaf holds rects of a single axis, so a leaf of up
+    to 8 is tested together with AVX2 and FMA by hitLeaf<Axis>. The per-axis
+    trees hang under one shared root and are walked in a single traversal.
+*/
+class RectSet: public Hitable {
+    public:
+        static const int leafSize = 8;
+        static const int flatLimit = 32;
+
+        RectSet() {}
+        int addMaterial(Material *m);
+        void add(int axis, float a0, float a1, float b0, float b1, float k, int material, bool flipped = false);
+        void add(int axis, float a0, float a1, float b0, float b1, float k, Material *m, bool flipped = false) {
+            add(axis, a0, a1, b0, b1, k, addMaterial(m), flipped);
+        }
+        template <int Axis>
+        void add(const AARect<Axis>& rect, bool flipped = false) {
+            add(Axis, rect.a0, rect.a1, rect.b0, rect.b1, rect.k, rect.mp, flipped);
+        }
+        void build();
+        int size() const { return int(matId.size()); }
+        int axisOf(int i) const { return i < groupEnd[0] ? 0 : (i < groupEnd[1] ? 1 : 2); }
+        virtual bool hit(const Ray& r, float tMin, float tMax, HitRecord& rec) const;
+        virtual void computeSurfaceInteraction(const Ray& r, HitRecord& rec) const;
+        virtual bool boundingBox(float t0, float t1, AABB& box) const;
+
+        std::vector<float> k, a0, a1, b0, b1;
+        std::vector<int> axis;
+        std::vector<int> matId;
+        std::vector<unsigned char> flipped;
+        std::vector<Material*> materials;
+        QuantizedBVH bvh;
+        int groupEnd[3] = {0, 0, 0}; // rects facing axis a are [groupEnd[a-1], groupEnd[a])
+
+    private:
+        template <int Axis>
+        bool hitLeaf(const Ray& r, int offset, int count, float tMin, float& tMax, int& closest) const;
+        bool hitRange(const Ray& r, int offset, int count, float tMin, float& tMax, int& closest) const;
+        AABB rectBox(int i) const;
+        std::unordered_map<Material*, int> materialIds;
+        int nRects = 0;
+};
+
+int RectSet::addMaterial(Material *m) {
+    auto found = materialIds.find(m);
+    if (found != materialIds.end())
+        return found->second;
+    int id = int(materials.size());
+    materials.push_back(m);
+    materialIds[m] = id;
+    return id;
+}
+
+void RectSet::add(int _axis, float _a0, float _a1, float _b0, float _b1, float _k, int material, bool _flipped) {
+    axis.push_back(_axis);
+    a0.push_back(_a0);
+    a1.push_back(_a1);
+    b0.push_back(_b0);
+    b1.push_back(_b1);
+    k.push_back(_k);
+    matId.push_back(material);
+    flipped.push_back(_flipped);
+}
+
+AABB RectSet::rectBox(int i) const {
+    int ax = axis[i];
+    int axisA = ax == 0 ? 1 : 0;
+    int axisB = ax == 2 ? 1 : 2;
+    Vector3 lo, hi;
+    lo[ax] = k[i] - 0.0001;
+    hi[ax] = k[i] + 0.0001;
+    lo[axisA] = a0[i];
+    hi[axisA] = a1[i];
+    lo[axisB] = b0[i];
+    hi[axisB] = b1[i];
+    return AABB(lo, hi);
+}
+
+void RectSet::build() {
+    nRects = size();
+    for (std::vector<float> *v : {&k, &a0, &a1, &b0, &b1})
+        v->resize(nRects);
+
+    // group by axis first, then let each group's tree order its own range
+    std::vector<int> order;
+    for (int ax = 0; ax < 3; ax++) {
+        for (int i = 0; i < nRects; i++) {
+            if (axis[i] == ax)
+                order.push_back(i);
+        }
+        groupEnd[ax] = int(order.size());
+    }
+
+    std::vector<LeafBVHNode> nodes;
+    if (nRects > flatLimit) {
+        std::vector<std::vector<LeafBVHNode> > trees(3);
+        std::vector<int> groups;
+        for (int ax = 0; ax < 3; ax++) {
+            int begin = ax == 0 ? 0 : groupEnd[ax-1];
+            if (begin == groupEnd[ax])
+                continue;
+            std::vector<AABB> boxes;
+            for (int i = begin; i < groupEnd[ax]; i++)
+                boxes.push_back(rectBox(order[i]));
+            std::vector<int> groupOrder;
+            buildLeafBVH(boxes, leafSize, trees[ax], groupOrder);
+            std::vector<int> sorted(order.begin()+begin, order.begin()+groupEnd[ax]);
+            for (size_t i = 0; i < groupOrder.size(); i++)
+                order[begin+i] = sorted[groupOrder[i]];
+            groups.push_back(ax);
+        }
+
+        // interior nodes chain the group trees together: each has one group's
+        // tree on the left and the remaining groups on the right
+        for (size_t g = 0; g < groups.size(); g++) {
+            int interior = -1;
+            if (g + 1 < groups.size()) {
+                AABB box = trees[groups[g]][0].box;
+                for (size_t h = g+1; h < groups.size(); h++)
+                    box = surroundingBox(box, trees[groups[h]][0].box);
+                interior = int(nodes.size());
+                LeafBVHNode node;
+                node.box = box;
+                node.count = 0;
+                nodes.push_back(node);
+            }
+            int ax = groups[g];
+            int base = int(nodes.size());
+            int primitiveBase = ax == 0 ? 0 : groupEnd[ax-1];
+            for (size_t i = 0; i < trees[ax].size(); i++) {
+                LeafBVHNode node = trees[ax][i];
+                node.offset += node.count > 0 ? primitiveBase : base;
+                nodes.push_back(node);
+            }
+            if (interior >= 0)
+                nodes[interior].offset = int(nodes.size());
+        }
+    }
+
+    std::vector<float> ok(k), oa0(a0), oa1(a1), ob0(b0), ob1(b1);
+    std::vector<int> oaxis(axis), omat(matId);
+    std::vector<unsigned char> oflipped(flipped);
+    for (int i = 0; i < nRects; i++) {
+        k[i] = ok[order[i]];
+        a0[i] = oa0[order[i]];
+        a1[i] = oa1[order[i]];
+        b0[i] = ob0[order[i]];
+        b1[i] = ob1[order[i]];
+        axis[i] = oaxis[order[i]];
+        matId[i] = omat[order[i]];
+        flipped[i] = oflipped[order[i]];
+    }
+    bvh.build(nodes);
+    // pad so the last leaf can always be loaded as a full group of 8
+    for (std::vector<float> *v : {&k, &a0, &a1, &b0, &b1})
+        v->resize(nRects + leafSize, 0);
+}
+
+template <int Axis>
+bool RectSet::hitLeaf(const Ray& r, int offset, int count, float tMin, float& tMax, int& closest) const {
+    STAT_ADD(primitiveTests[STAT_RECT], count);
+    const int axisA = Axis == 0 ? 1 : 0;
+    const int axisB = Axis == 2 ? 1 : 2;
+    bool hitAnything = false;
+#if defined(__AVX2__) && defined(__FMA__)
+    const __m256 o = _mm256_set1_ps(r.origin()[Axis]);
+    const __m256 d = _mm256_set1_ps(r.direction()[Axis]);
+    const __m256 oa = _mm256_set1_ps(r.origin()[axisA]);
+    const __m256 da = _mm256_set1_ps(r.direction()[axisA]);
+    const __m256 ob = _mm256_set1_ps(r.origin()[axisB]);
+    const __m256 db = _mm256_set1_ps(r.direction()[axisB]);
+    const __m256 lanes = _mm256_castsi256_ps(_mm256_cmpgt_epi32(_mm256_set1_epi32(count), _mm256_setr_epi32(0,1,2,3,4,5,6,7)));
+
+    __m256 t = _mm256_div_ps(_mm256_sub_ps(_mm256_loadu_ps(&k[offset]), o), d);
+    __m256 valid = _mm256_and_ps(lanes, _mm256_and_ps(_mm256_cmp_ps(t, _mm256_set1_ps(tMin), _CMP_GE_OQ),
+                                                      _mm256_cmp_ps(t, _mm256_set1_ps(tMax), _CMP_LT_OQ)));
+    if (_mm256_movemask_ps(valid) == 0)
+        return false;
+    __m256 a = _mm256_fmadd_ps(t, da, oa);
+    __m256 b = _mm256_fmadd_ps(t, db, ob);
+    valid = _mm256_and_ps(valid, _mm256_and_ps(_mm256_cmp_ps(a, _mm256_loadu_ps(&a0[offset]), _CMP_GE_OQ),
+                                               _mm256_cmp_ps(a, _mm256_loadu_ps(&a1[offset]), _CMP_LE_OQ)));
+    valid = _mm256_and_ps(valid, _mm256_and_ps(_mm256_cmp_ps(b, _mm256_loadu_ps(&b0[offset]), _CMP_GE_OQ),
+                                               _mm256_cmp_ps(b, _mm256_loadu_ps(&b1[offset]), _CMP_LE_OQ)));
+    int mask = _mm256_movemask_ps(valid);
+    if (mask == 0)
+        return false;
+
+    float ts[8];
+    _mm256_storeu_ps(ts, t);
+    for (int i = 0; i < 8; i++) {
+        if ((mask & (1 << i)) && ts[i] < tMax) {
+            tMax = ts[i];
+            closest = offset + i;
+            hitAnything = true;
+        }
+    }
+#else
+    for (int i = offset; i < offset + count; i++) {
+        float t = (k[i] - r.origin()[Axis]) / r.direction()[Axis];
+        if (t < tMin || t >= tMax)
+            continue;
+        float a = r.origin()[axisA] + t*r.direction()[axisA];
+        float b = r.origin()[axisB] + t*r.direction()[axisB];
+        if (a < a0[i] || a > a1[i] || b < b0[i] || b > b1[i])
+            continue;
+        tMax = t;
+        closest = i;
+        hitAnything = true;
+    }
+#endif
+    return hitAnything;
+}
+
+// a range never crosses an axis group, so its first rect decides the axis
+bool RectSet::hitRange(const Ray& r, int offset, int count, float tMin, float& tMax, int& closest) const {
+    switch (axisOf(offset)) {
+        case 0: return hitLeaf<0>(r, offset, count, tMin, tMax, closest);
+        case 1: return hitLeaf<1>(r, offset, count, tMin, tMax, closest);
+        default: return hitLeaf<2>(r, offset, count, tMin, tMax, closest);
+    }
+}
+
+bool RectSet::hit(const Ray& r, float tMin, float tMax, HitRecord& rec) const {
+    int closest = -1;
+    bool hitAnything = false;
+    if (bvh.empty()) {
+        for (int ax = 0, begin = 0; ax < 3; begin = groupEnd[ax++]) {
+            for (int offset = begin; offset < groupEnd[ax]; offset += leafSize) {
+                if (hitRange(r, offset, std::min(leafSize, groupEnd[ax] - offset), tMin, tMax, closest))
+                    hitAnything = true;
+            }
+        }
+    } else {
+        hitAnything = traverseLeafBVH(bvh, r, tMin, tMax, [&](int offset, int count, float t0, float& t1) {
+            return hitRange(r, offset, count, t0, t1, closest);
+        });
+    }
+    if (!hitAnything)
+        return false;
+    rec.t = tMax;
+    rec.primitive = closest;
+    rec.object = this;
+    rec.flipped = false;
+    return true;
+}
+
+void RectSet::computeSurfaceInteraction(const Ray& r, HitRecord& rec) const {
+    int i = rec.primitive;
+    int ax = axis[i];
+    int axisA = ax == 0 ? 1 : 0;
+    int axisB = ax == 2 ? 1 : 2;
+    rec.p = r.pointAtParameter(rec.t);
+    rec.u = (rec.p[axisA] - a0[i]) / (a1[i] - a0[i]);
+    rec.v = (rec.p[axisB] - b0[i]) / (b1[i] - b0[i]);
+    rec.normal = Vector3(0,0,0);
+    rec.normal[ax] = flipped[i] ? -1 : 1;
+    rec.dpdu = rec.dpdv = Vector3(0,0,0);
+    rec.dpdu[axisA] = a1[i] - a0[i];
+    rec.dpdv[axisB] = b1[i] - b0[i];
+    rec.matPtr = materials[matId[i]];
+}
+
+bool RectSet::boundingBox(float t0, float t1, AABB& box) const {
+    if (nRects == 0)
+        return false;
+    if (!bvh.empty()) {
+        box = bvh.bounds;
+        return true;
+    }
+    box = rectBox(0);
+    for (int i = 1; i < nRects; i++)
+        box = surroundingBox(box, rectBox(i));
+    return true;
+}
+
+#endif
@@ -5,99 +5,70 @@
 #include "hitableList.h"
 #include "material.h"
 
-class XYRect: public Hitable {
+/*
+    Rectangle facing the Axis direction (0 = x, 1 = y, 2 = z) at Axis = k.
+    a and b are the two remaining axes in x, y, z order, so XYRect spans
+    x in [a0, a1] and y in [b0, b1].
+*/
+template <int Axis>
+class AARect: public Hitable {
     public:
-        XYRect() {}
-        XYRect(float _x0, float _x1, float _y0, float _y1, float _k, Material *mat) : 
-        x0(_x0), x1(_x1), y0(_y0), y1(_y1), k(_k), mp(mat) {};
-        virtual bool hit(const Ray& r, float t0, float t1, HitRecord& rec) const;
-        virtual bool boundingBox(float t0, float t1, AABB& box) const {
-            box = AABB(Vector3(x0, y0, k-0.0001), Vector3(x1, y1, k+0.0001));
-            return true;
-        }
-        Material *mp;
-        float x0, x1, y0, y1, k;
-};
+        static const int axisA = Axis == 0 ? 1 : 0;
+        static const int axisB = Axis == 2 ? 1 : 2;
 
-class XZRect: public Hitable {
-    public:
-        XZRect() {}
-        XZRect(float _x0, float _x1, float _z0, float _z1, float _k, Material *mat) : 
-        x0(_x0), x1(_x1), z0(_z0), z1(_z1), k(_k), mp(mat) {};
+        AARect() {}
+        AARect(float _a0, float _a1, float _b0, float _b1, float _k, Material *mat) :
+        mp(mat), a0(_a0), a1(_a1), b0(_b0), b1(_b1), k(_k) {};
         virtual bool hit(const Ray& r, float t0, float t1, HitRecord& rec) const;
+        virtual void computeSurfaceInteraction(const Ray& r, HitRecord& rec) const;
         virtual bool boundingBox(float t0, float t1, AABB& box) const {
-            box = AABB(Vector3(x0, z0, k-0.0001), Vector3(x1, z1, k+0.0001));
+            Vector3 lo, hi;
+            lo[Axis] = k-0.0001;
+            hi[Axis] = k+0.0001;
+            lo[axisA] = a0;
+            hi[axisA] = a1;
+            lo[axisB] = b0;
+            hi[axisB] = b1;
+            box = AABB(lo, hi);
             return true;
         }
         Material *mp;
-        float x0, x1, z0, z1, k;
+        float a0, a1, b0, b1, k;
 };
 
-class YZRect: public Hitable {
-    public:
-        YZRect() {}
-        YZRect(float _y0, float _y1, float _z0, float _z1, float _k, Material *mat) : 
-        y0(_y0), y1(_y1), z0(_z0), z1(_z1), k(_k), mp(mat) {};
-        virtual bool hit(const Ray& r, float t0, float t1, HitRecord& rec) const;
-        virtual bool boundingBox(float t0, float t1, AABB& box) const {
-            box = AABB(Vector3(y0, y0, k-0.0001), Vector3(z1, z1, k+0.0001));
-            return true;
-        }
-        Material *mp;
-        float y0, y1, z0, z1, k;
-};
+typedef AARect<0> YZRect;
+typedef AARect<1> XZRect;
+typedef AARect<2> XYRect;
 
-bool XYRect::hit(const Ray& r, float t0, float t1, HitRecord& rec) const {
-    float t = (k-r.origin().z()) / r.direction().z();
+template <int Axis>
+bool AARect<Axis>::hit(const Ray& r, float t0, float t1, HitRecord& rec) const {
+    STAT_INC(primitiveTests[STAT_RECT]);
+    float t = (k-r.origin()[Axis]) / r.direction()[Axis];
     if (t < t0 || t > t1)
         return false;
-    float x = r.origin().x() + t*r.direction().x();
-    float y = r.origin().y() + t*r.direction().y();
-    if (x < x0 || x > x1 || y < y0 || y > y1){
+    float a = r.origin()[axisA] + t*r.direction()[axisA];
+    float b = r.origin()[axisB] + t*r.direction()[axisB];
+    if (a < a0 || a > a1 || b < b0 || b > b1)
         return false;
-    }
-
-    rec.u = (x-x0)/(x1-x0);
-    rec.v = (y-y0)/(y1-y0);
     rec.t = t;
-    rec.matPtr = mp;
-    rec.p = r.pointAtParameter(t);
-    rec.normal = Vector3(0,0,1);
-    return true;
-}
-
-bool XZRect::hit(const Ray& r, float t0, float t1, HitRecord& rec) const {
-    float t = (k-r.origin().y()) / r.direction().y();
-    if (t < t0 || t > t1)
-        return false;
-    float x = r.origin().x() + t*r.direction().x();
-    float z = r.origin().z() + t*r.direction().z();
-    if (x < x0 || x > x1 || z < z0 || z > z1) 
-        return false;
-    rec.u = (x-x0)/(x1-x0);
-    rec.v = (z-z0)/(z1-z0); 
-    rec.t = t;
-    rec.matPtr = mp;
-    rec.p = r.pointAtParameter(t);
-    rec.normal = Vector3(0, 1, 0);
+    rec.b0 = a;
+    rec.b1 = b;
+    rec.object = this;
+    rec.flipped = false;
     return true;
 }
 
-bool YZRect::hit(const Ray& r, float t0, float t1, HitRecord& rec) const {
-    float t = (k-r.origin().x()) / r.direction().x();
-    if (t < t0 || t > t1)
-        return false;
-    float y = r.origin().y() + t*r.direction().y();
-    float z = r.origin().z() + t*r.direction().z();
-    if (y < y0 || y > y1 || z < z0 || z > z1) 
-        return false;
-    rec.u = (y-y0)/(y1-y0);
-    rec.v = (z-z0)/(z1-z0); 
-    rec.t = t;
+template <int Axis>
+void AARect<Axis>::computeSurfaceInteraction(const Ray& r, HitRecord& rec) const {
+    rec.u = (rec.b0-a0)/(a1-a0);
+    rec.v = (rec.b1-b0)/(b1-b0);
     rec.matPtr = mp;
-    rec.p = r.pointAtParameter(t);
-    rec.normal = Vector3(1, 0, 0);
-    return true;
+    rec.p = r.pointAtParameter(rec.t);
+    rec.normal = Vector3(0,0,0);
+    rec.normal[Axis] = 1;
+    rec.dpdu = rec.dpdv = Vector3(0,0,0);
+    rec.dpdu[axisA] = a1 - a0;
+    rec.dpdv[axisB] = b1 - b0;
 }
 
-#endif
\ No newline at end of file
+#endif
@@ -0,0 +1,206 @@
+#ifndef SCENECACHEH
+#define SCENECACHEH
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#include <iostream>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "mappedFile.h"
+
+enum SceneCacheKind { CACHE_MESH = 1, CACHE_TEXTURE = 2, CACHE_SCENE = 3 };
+
+/*
+    Binary cache of the slow parts of building a scene: meshes with their
+    BVHs, decoded texture tiles and the scene BVH. Each is stored as named
+    sections (kind, key, part) of plain arrays in one file that later runs
+    map read-only. The header carries a hash of every input; when it does
+    not match, or there is no file yet, the cache records what the scene
+    builds instead and write() replaces the file.
+
+    Consumers ask get() first and fall back to building and put()ing, so
+    they work the same whichever state the cache is in.
+*/
+class SceneCache {
+    public:
+        static const uint32_t version = 3;
+
+        SceneCache(const std::string& _fileName) : fileName(_fileName), valid(false), recording(false) {}
+        bool open(uint64_t inputHash);
+        bool write();
+
+        bool get(uint32_t kind, uint32_t key, uint32_t part, const void*& data, size_t& bytes) const;
+        template <typename T>
+        bool get(uint32_t kind, uint32_t key, uint32_t part, const T*& data, size_t& count) const;
+        template <typename T>
+        bool get(uint32_t kind, uint32_t key, uint32_t part, std::vector<T>& out) const;
+        void put(uint32_t kind, uint32_t key, uint32_t part, const void *data, size_t bytes);
+        template <typename T>
+        void put(uint32_t kind, uint32_t key, uint32_t part, const std::vector<T>& v) { put(kind, key, part, v.data(), v.size()*sizeof(T)); }
+
+        // keeps the mapping alive for whoever reads from it in place
+        std::shared_ptr<const void> owner() const { return file; }
+
+        std::string fileName;
+        bool valid;     // mapped and matching the inputs
+        bool recording; // collecting sections for write()
+
+    private:
+        struct Header {
+            char magic[8];
+            uint32_t version;
+            uint32_t sectionCount;
+            uint64_t inputHash;
+        };
+        struct Section {
+            uint32_t kind, key, part, pad;
+            uint64_t offset, size;
+        };
+
+        std::shared_ptr<MappedFile> file;
+        const Section *sections = NULL;
+        uint32_t sectionCount = 0;
+        uint64_t hash = 0;
+        std::vector<Section> pending;
+        std::vector<std::vector<unsigned char> > pendingData;
+};
+
+// FNV-1a, chained through h
+inline uint64_t hashBytes(const void *data, size_t n, uint64_t h = 14695981039346656037ull) {
+    const unsigned char *p = (const unsigned char*)data;
+    for (size_t i = 0; i < n; i++) {
+        h ^= p[i];
+        h *= 1099511628211ull;
+    }
+    return h;
+}
+
+// a file stands in for its contents by name, size and modification time
+inline uint64_t hashFileStamp(const std::string& fileName, uint64_t h) {
+    h = hashBytes(fileName.data(), fileName.size(), h);
+    struct stat info;
+    if (stat(fileName.c_str(), &info) == 0) {
+        int64_t stamp[2] = { int64_t(info.st_size), int64_t(info.st_mtime) };
+        h = hashBytes(stamp, sizeof(stamp), h);
+    }
+    return h;
+}
+
+bool SceneCache::open(uint64_t inputHash) {
+    uint32_t v = version;
+    hash = hashBytes(&v, sizeof(v), inputHash);
+    valid = false;
+    recording = true;
+    std::shared_ptr<MappedFile> mapped(new MappedFile());
+    if (!mapped->open(fileName) || mapped->size < sizeof(Header))
+        return false;
+    const Header *header = (const Header*)mapped->data;
+    if (memcmp(header->magic, "JRAYSCN", 8) != 0 || header->version != version || header->inputHash != hash ||
+        sizeof(Header) + header->sectionCount*sizeof(Section) > mapped->size)
+        return false;
+    sections = (const Section*)(mapped->data + sizeof(Header));
+    sectionCount = header->sectionCount;
+    for (uint32_t i = 0; i < sectionCount; i++) {
+        if (sections[i].offset + sections[i].size > mapped->size)
+            return false;
+    }
+    file = mapped;
+    valid = true;
+    recording = false;
+    return true;
+}
+
+bool SceneCache::get(uint32_t kind, uint32_t key, uint32_t part, const void*& data, size_t& bytes) const {
+    if (!valid)
+        return false;
+    for (uint32_t i = 0; i < sectionCount; i++) {
+        const Section& s = sections[i];
+        if (s.kind == kind && s.key == key && s.part == part) {
+            data = file->data + s.offset;
+            bytes = s.size;
+            return true;
+        }
+    }
+    return false;
+}
+
+template <typename T>
+bool SceneCache::get(uint32_t kind, uint32_t key, uint32_t part, const T*& data, size_t& count) const {
+    const void *p;
+    size_t bytes;
+    if (!get(kind, key, part, p, bytes) || bytes % sizeof(T) != 0)
+        return false;
+    data = (const T*)p;
+    count = bytes / sizeof(T);
+    return true;
+}
+
+template <typename T>
+bool SceneCache::get(uint32_t kind, uint32_t key, uint32_t part, std::vector<T>& out) const {
+    const T *data;
+    size_t count;
+    if (!get(kind, key, part, data, count))
+        return false;
+    out.assign(data, data + count);
+    return true;
+}
+
+void SceneCache::put(uint32_t kind, uint32_t key, uint32_t part, const void *data, size_t bytes) {
+    if (!recording)
+        return;
+    Section s = { kind, key, part, 0, 0, bytes };
+    pending.push_back(s);
+    pendingData.push_back(std::vector<unsigned char>((const unsigned char*)data, (const unsigned char*)data + bytes));
+}
+
+// sections start on 64-byte boundaries so mapped arrays are aligned for any element type
+bool SceneCache::write() {
+    if (!recording)
+        return false;
+    Header header;
+    memcpy(header.magic, "JRAYSCN", 8);
+    header.version = version;
+    header.sectionCount = uint32_t(pending.size());
+    header.inputHash = hash;
+    uint64_t offset = sizeof(Header) + pending.size()*sizeof(Section);
+    for (size_t i = 0; i < pending.size(); i++) {
+        offset = (offset + 63) & ~uint64_t(63);
+        pending[i].offset = offset;
+        offset += pending[i].size;
+    }
+
+    // written next to the target and renamed over it, so a reader never maps half a file
+    std::string temporary = fileName + ".tmp";
+    FILE *out = fopen(temporary.c_str(), "wb");
+    if (out == NULL) {
+        std::cerr << "Error: could not write scene cache " << fileName << std::endl;
+        return false;
+    }
+    bool ok = fwrite(&header, sizeof(header), 1, out) == 1;
+    if (!pending.empty())
+        ok = ok && fwrite(pending.data(), sizeof(Section), pending.size(), out) == pending.size();
+    uint64_t at = sizeof(Header) + pending.size()*sizeof(Section);
+    static const unsigned char zeros[64] = { 0 };
+    for (size_t i = 0; ok && i < pending.size(); i++) {
+        ok = fwrite(zeros, 1, pending[i].offset - at, out) == pending[i].offset - at;
+        ok = ok && (pendingData[i].empty() || fwrite(pendingData[i].data(), 1, pendingData[i].size(), out) == pendingData[i].size());
+        at = pending[i].offset + pending[i].size;
+    }
+    ok = fclose(out) == 0 && ok;
+    if (!ok || rename(temporary.c_str(), fileName.c_str()) != 0) {
+        std::cerr << "Error: could not write scene cache " << fileName << std::endl;
+        remove(temporary.c_str());
+        return false;
+    }
+    pending.clear();
+    pendingData.clear();
+    recording = false;
+    return true;
+}
+
+#endif
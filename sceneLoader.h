@@ -0,0 +1,670 @@
+#ifndef SCENELOADERH
+#define SCENELOADERH
+
+#include <fstream>
+#include <map>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "arena.h"
+#include "json.h"
+#include "sphere.h"
+#include "rectangle.h"
+#include "box.h"
+#include "hitableList.h"
+#include "transform.h"
+#include "triangleMesh.h"
+#include "objLoader.h"
+#include "plyLoader.h"
+#include "material.h"
+#include "constantMedium.h"
+#include "gridMedium.h"
+#include "sceneCache.h"
+
+// where the camera is and what it sees; the aspect ratio comes from the image
+struct SceneCamera {
+    SceneCamera() : lookfrom(0,278,-800), lookat(0,278,0), vup(0,1,0), vfov(40), aperture(0), focusDist(10), time0(0), time1(1) {}
+
+    Vector3 lookfrom, lookat, vup;
+    float vfov, aperture, focusDist;
+    float time0, time1;
+};
+
+/*
+    Builds a scene from a JSON description:
+
+        {
+          "camera":    { "lookfrom": [0,278,-800], "lookat": [0,278,0], "vfov": 40, ... },
+          "textures":  { "earth": { "type": "image", "file": "../textures/earth.jpg" } },
+          "materials": { "red": { "type": "lambertian", "albedo": [0.65,0.05,0.05] } },
+          "objects":   [ { "type": "sphere", "center": [0,0,0], "radius": 50, "material": "red" } ]
+        }
+
+    Textures and materials are defined once by name and shared by everything
+    that names them; where one is wanted, a name, an inline definition or
+    (for a texture) a plain [r,g,b] colour all work. Names must be defined
+    before they are used. Any object may also carry "flip": true and a
+    "transform" list of {"translate": [x,y,z]}, {"scale": [x,y,z]} or
+    {"rotateX"/"rotateY"/"rotateZ": degrees}, applied in order. File names
+    are relative to the scene file. Everything is allocated from the arena.
+
+    Smoke is a "constantMedium" filling a "boundary" object at one
+    "density", or a "gridMedium" of "resolution" [nx,ny,nz] voxels between
+    "min" and "max", whose densities come from a raw "file" of floats (x
+    fastest) or, without one, a procedural plume, scaled by "density".
+    A "noise" texture with "baked": true reads the coarse octaves of its
+    turbulence from a precomputed tiling volume instead of summing them at
+    every lookup.
+
+    Camera values and transform steps may be keyframed for --frames:
+    {"keys": [[frame, value], ...]} in frame order, interpolated linearly
+    between keys and held before the first and after the last, e.g.
+    {"rotateY": {"keys": [[0, 0], [48, 360]]}}. load() builds frame 0;
+    setFrame() moves the camera and the keyframed transforms to another
+    frame without building anything again. The loader must outlive the
+    scene for that.
+
+    inputHash covers the scene text and the stamps of every file it names.
+    With a SceneCache, meshes and image textures are taken from it when its
+    input hash still matches, and recorded into it otherwise.
+*/
+class SceneLoader {
+    public:
+        SceneLoader(SceneArena& a, TextureCache& t) : inputHash(0), arena(a), imageCache(t), frame(0), cameraDef(NULL) {}
+        Hitable *load(const std::string& fileName, SceneCamera& camera, SceneCache *cache = NULL);
+        bool setFrame(float frame, SceneCamera& camera);
+
+        std::string error;
+        uint64_t inputHash;
+
+    private:
+        struct AnimatedTransform {
+            Transform *transform;
+            const JsonValue *steps;
+        };
+
+        bool fail(const JsonValue& at, const std::string& message);
+        bool keyedValue(const JsonValue& v, const JsonValue*& out, JsonValue& scratch);
+        bool keyed(const JsonValue& v) const;
+        bool readFloat(const JsonValue& object, const char *key, float& out, bool required = false);
+        bool readVector(const JsonValue& object, const char *key, Vector3& out, bool required = false);
+        bool vectorValue(const JsonValue& v, const std::string& what, Vector3& out);
+        bool readString(const JsonValue& object, const char *key, std::string& out, bool required = false);
+        bool readCamera(const JsonValue& v, SceneCamera& camera);
+        Texture *texture(const JsonValue& v);
+        Texture *makeTexture(const JsonValue& v);
+        Material *material(const JsonValue& v);
+        Material *makeMaterial(const JsonValue& v);
+        Hitable *object(const JsonValue& v);
+        Hitable *makeObject(const JsonValue& v, const std::string& type);
+        Hitable *group(const JsonValue& list);
+        bool readTransform(const JsonValue& list, Matrix34& m);
+        std::string path(const std::string& fileName) const;
+        uint64_t hashInputs(const JsonValue& v, uint64_t h) const;
+
+        SceneArena& arena;
+        TextureCache& imageCache;
+        std::string directory;
+        std::map<std::string, Texture*> textures;
+        std::map<std::string, Material*> materials;
+        float time0, time1;
+        SceneCache *sceneCache;
+        int meshes, images; // keys of the next mesh and image in the scene cache
+        JsonValue root;
+        float frame;
+        const JsonValue *cameraDef;
+        std::vector<AnimatedTransform> animated;
+        std::map<int, BakedNoise*> bakedNoise;
+};
+
+bool SceneLoader::fail(const JsonValue& at, const std::string& message) {
+    if (error.empty()) {
+        std::ostringstream out;
+        out << "line " << at.line << ": " << message;
+        error = out.str();
+    }
+    return false;
+}
+
+// v itself, or its value at the current frame when it is keyframed
+bool SceneLoader::keyedValue(const JsonValue& v, const JsonValue*& out, JsonValue& scratch) {
+    const JsonValue *keys = v.isObject() ? v.get("keys") : NULL;
+    out = &v;
+    if (keys == NULL)
+        return true;
+    if (!keys->isArray() || keys->items.empty())
+        return fail(*keys, "\"keys\" should be a list of [frame, value]");
+    for (size_t i = 0; i < keys->items.size(); i++) {
+        const JsonValue& key = keys->items[i];
+        if (!key.isArray() || key.items.size() != 2 || !key.items[0].isNumber())
+            return fail(key, "each key should be [frame, value]");
+    }
+    size_t next = 0;
+    while (next < keys->items.size() && keys->items[next].items[0].number <= frame)
+        next++;
+    if (next == 0 || next == keys->items.size()) {
+        out = &keys->items[next == 0 ? 0 : next - 1].items[1];
+        return true;
+    }
+    const JsonValue& a = keys->items[next-1].items[1];
+    const JsonValue& b = keys->items[next].items[1];
+    double t = (frame - keys->items[next-1].items[0].number) / (keys->items[next].items[0].number - keys->items[next-1].items[0].number);
+    out = &a;
+    if (a.isNumber() && b.isNumber()) {
+        scratch = a;
+        scratch.number = a.number + t*(b.number - a.number);
+        out = &scratch;
+    } else if (a.isArray() && b.isArray() && a.items.size() == b.items.size()) {
+        scratch = a;
+        for (size_t i = 0; i < a.items.size(); i++) {
+            if (!a.items[i].isNumber() || !b.items[i].isNumber())
+                return true;
+            scratch.items[i].number = a.items[i].number + t*(b.items[i].number - a.items[i].number);
+        }
+        out = &scratch;
+    }
+    return true;
+}
+
+bool SceneLoader::keyed(const JsonValue& v) const {
+    if (v.isObject() && v.get("keys"))
+        return true;
+    for (size_t i = 0; i < v.items.size(); i++) {
+        if (keyed(v.items[i]))
+            return true;
+    }
+    for (size_t i = 0; i < v.members.size(); i++) {
+        if (keyed(v.members[i].second))
+            return true;
+    }
+    return false;
+}
+
+// missing optional values leave out untouched
+bool SceneLoader::readFloat(const JsonValue& object, const char *key, float& out, bool required) {
+    const JsonValue *v = object.get(key);
+    if (v == NULL)
+        return !required || fail(object, std::string("missing \"") + key + "\"");
+    JsonValue scratch;
+    if (!keyedValue(*v, v, scratch))
+        return false;
+    if (!v->isNumber())
+        return fail(*v, std::string("\"") + key + "\" should be a number");
+    out = float(v->number);
+    return true;
+}
+
+bool SceneLoader::vectorValue(const JsonValue& v, const std::string& what, Vector3& out) {
+    if (!v.isArray() || v.items.size() != 3 || !v.items[0].isNumber() || !v.items[1].isNumber() || !v.items[2].isNumber())
+        return fail(v, what + " should be an array of three numbers");
+    out = Vector3(v.items[0].number, v.items[1].number, v.items[2].number);
+    return true;
+}
+
+bool SceneLoader::readVector(const JsonValue& object, const char *key, Vector3& out, bool required) {
+    const JsonValue *v = object.get(key);
+    if (v == NULL)
+        return !required || fail(object, std::string("missing \"") + key + "\"");
+    JsonValue scratch;
+    if (!keyedValue(*v, v, scratch))
+        return false;
+    return vectorValue(*v, std::string("\"") + key + "\"", out);
+}
+
+bool SceneLoader::readString(const JsonValue& object, const char *key, std::string& out, bool required) {
+    const JsonValue *v = object.get(key);
+    if (v == NULL)
+        return !required || fail(object, std::string("missing \"") + key + "\"");
+    if (!v->isString())
+        return fail(*v, std::string("\"") + key + "\" should be a string");
+    out = v->string;
+    return true;
+}
+
+std::string SceneLoader::path(const std::string& fileName) const {
+    if (fileName.empty() || fileName[0] == '/')
+        return fileName;
+    return directory + fileName;
+}
+
+bool SceneLoader::readCamera(const JsonValue& v, SceneCamera& camera) {
+    if (!v.isObject())
+        return fail(v, "\"camera\" should be an object");
+    const JsonValue *time = v.get("time");
+    if (time && (!time->isArray() || time->items.size() != 2 || !time->items[0].isNumber() || !time->items[1].isNumber()))
+        return fail(*time, "\"time\" should be [open, close]");
+    if (time) {
+        camera.time0 = float(time->items[0].number);
+        camera.time1 = float(time->items[1].number);
+    }
+    return readVector(v, "lookfrom", camera.lookfrom) && readVector(v, "lookat", camera.lookat) &&
+           readVector(v, "vup", camera.vup) && readFloat(v, "vfov", camera.vfov) &&
+           readFloat(v, "aperture", camera.aperture) && readFloat(v, "focusDist", camera.focusDist);
+}
+
+// a name, an inline definition or an [r,g,b] constant
+Texture *SceneLoader::texture(const JsonValue& v) {
+    if (v.isString()) {
+        auto found = textures.find(v.string);
+        if (found == textures.end()) {
+            fail(v, "unknown texture \"" + v.string + "\"");
+            return NULL;
+        }
+        return found->second;
+    }
+    if (v.isArray()) {
+        Vector3 color;
+        if (!vectorValue(v, "a colour", color))
+            return NULL;
+        return arena.make<ConstantTexture>(color);
+    }
+    return makeTexture(v);
+}
+
+Texture *SceneLoader::makeTexture(const JsonValue& v) {
+    std::string type;
+    if (!v.isObject()) {
+        fail(v, "a texture should be a name, a colour or an object");
+        return NULL;
+    }
+    if (!readString(v, "type", type, true))
+        return NULL;
+    if (type == "constant") {
+        Vector3 color;
+        if (!readVector(v, "color", color, true))
+            return NULL;
+        return arena.make<ConstantTexture>(color);
+    }
+    if (type == "checker") {
+        const JsonValue *even = v.get("even");
+        const JsonValue *odd = v.get("odd");
+        if (even == NULL || odd == NULL) {
+            fail(v, "a checker texture needs \"even\" and \"odd\"");
+            return NULL;
+        }
+        Texture *t0 = texture(*even);
+        Texture *t1 = t0 ? texture(*odd) : NULL;
+        return t1 ? arena.make<CheckerTexture>(t0, t1) : NULL;
+    }
+    if (type == "noise") {
+        float scale = 1, octaves = 7;
+        std::string style = "plain";
+        if (!readFloat(v, "scale", scale) || !readFloat(v, "octaves", octaves) || !readString(v, "style", style))
+            return NULL;
+        const JsonValue *bake = v.get("baked");
+        const BakedNoise *baked = NULL;
+        if (bake && bake->type == JSON_BOOL && bake->boolean) {
+            // one volume per octave count, shared by every texture that asks for it
+            BakedNoise *&b = bakedNoise[int(octaves)];
+            if (b == NULL)
+                b = arena.make<BakedNoise>(16, 8, int(octaves));
+            baked = b;
+        }
+        NoiseStyle s = NOISE_PLAIN;
+        if (style == "turbulence")
+            s = NOISE_TURBULENCE;
+        else if (style == "marble")
+            s = NOISE_MARBLE;
+        else if (style != "plain") {
+            fail(v, "unknown noise style \"" + style + "\"");
+            return NULL;
+        }
+        return arena.make<NoiseTexture>(scale, s, int(octaves), baked);
+    }
+    if (type == "image") {
+        std::string file;
+        if (!readString(v, "file", file, true))
+            return NULL;
+        int id = imageCache.add(path(file).c_str(), sceneCache, images++);
+        if (id < 0) {
+            fail(v, "could not load image " + path(file));
+            return NULL;
+        }
+        return arena.make<ImageTexture>(&imageCache, id);
+    }
+    fail(v, "unknown texture type \"" + type + "\"");
+    return NULL;
+}
+
+// a name or an inline definition
+Material *SceneLoader::material(const JsonValue& v) {
+    if (v.isString()) {
+        auto found = materials.find(v.string);
+        if (found == materials.end()) {
+            fail(v, "unknown material \"" + v.string + "\"");
+            return NULL;
+        }
+        return found->second;
+    }
+    return makeMaterial(v);
+}
+
+Material *SceneLoader::makeMaterial(const JsonValue& v) {
+    std::string type;
+    if (!v.isObject()) {
+        fail(v, "a material should be a name or an object");
+        return NULL;
+    }
+    if (!readString(v, "type", type, true))
+        return NULL;
+    if (type == "lambertian" || type == "isotropic" || type == "diffuseLight") {
+        const char *key = type == "diffuseLight" ? "emit" : "albedo";
+        const JsonValue *t = v.get(key);
+        if (t == NULL) {
+            fail(v, std::string("missing \"") + key + "\"");
+            return NULL;
+        }
+        Texture *tex = texture(*t);
+        if (tex == NULL)
+            return NULL;
+        if (type == "lambertian")
+            return arena.make<Lambertian>(tex);
+        if (type == "isotropic")
+            return arena.make<Isotropic>(tex);
+        return arena.make<DiffuseLight>(tex);
+    }
+    if (type == "metal") {
+        Vector3 albedo;
+        float fuzz = 0;
+        if (!readVector(v, "albedo", albedo, true) || !readFloat(v, "fuzz", fuzz))
+            return NULL;
+        return arena.make<Metal>(albedo, fuzz);
+    }
+    if (type == "dielectric") {
+        float ior = 1.5;
+        if (!readFloat(v, "ior", ior))
+            return NULL;
+        return arena.make<Dielectric>(ior);
+    }
+    fail(v, "unknown material type \"" + type + "\"");
+    return NULL;
+}
+
+bool SceneLoader::readTransform(const JsonValue& list, Matrix34& m) {
+    if (!list.isArray())
+        return fail(list, "\"transform\" should be a list of steps");
+    for (size_t i = 0; i < list.items.size(); i++) {
+        const JsonValue& step = list.items[i];
+        if (!step.isObject() || step.members.size() != 1)
+            return fail(step, "each transform step should be an object with one member");
+        const std::string& op = step.members[0].first;
+        Matrix34 s;
+        if (op == "translate" || op == "scale") {
+            Vector3 amount;
+            if (!readVector(step, op.c_str(), amount, true))
+                return false;
+            s = op == "translate" ? Matrix34::translation(amount) : Matrix34::scaling(amount);
+        } else if (op == "rotateX" || op == "rotateY" || op == "rotateZ") {
+            float degrees;
+            if (!readFloat(step, op.c_str(), degrees, true))
+                return false;
+            s = Matrix34::rotation(op[6] - 'X', degrees);
+        } else {
+            return fail(step, "unknown transform step \"" + op + "\"");
+        }
+        m = s * m;
+    }
+    return true;
+}
+
+Hitable *SceneLoader::object(const JsonValue& v) {
+    std::string type;
+    if (!v.isObject()) {
+        fail(v, "an object should be a JSON object");
+        return NULL;
+    }
+    if (!readString(v, "type", type, true))
+        return NULL;
+    Hitable *h = makeObject(v, type);
+    if (h == NULL)
+        return NULL;
+    const JsonValue *flip = v.get("flip");
+    if (flip && flip->type == JSON_BOOL && flip->boolean)
+        h = arena.make<FlipNormals>(h);
+    if (const JsonValue *steps = v.get("transform")) {
+        Matrix34 m = Matrix34::identity();
+        if (!readTransform(*steps, m))
+            return NULL;
+        // makeObject never returns a Transform, so nothing is folded into t and its matrix is just these steps
+        Transform *t = arena.make<Transform>(h, m);
+        if (keyed(*steps)) {
+            AnimatedTransform a = { t, steps };
+            t->animated = true;
+            animated.push_back(a);
+        }
+        h = t;
+    }
+    return h;
+}
+
+Hitable *SceneLoader::makeObject(const JsonValue& v, const std::string& type) {
+    if (type == "group") {
+        const JsonValue *list = v.get("objects");
+        if (list == NULL) {
+            fail(v, "a group needs \"objects\"");
+            return NULL;
+        }
+        return group(*list);
+    }
+    if (type == "constantMedium") {
+        const JsonValue *boundary = v.get("boundary");
+        const JsonValue *albedo = v.get("albedo");
+        float density;
+        if (boundary == NULL || albedo == NULL) {
+            fail(v, "a constant medium needs \"boundary\" and \"albedo\"");
+            return NULL;
+        }
+        if (!readFloat(v, "density", density, true))
+            return NULL;
+        Hitable *b = object(*boundary);
+        Texture *a = b ? texture(*albedo) : NULL;
+        return a ? arena.make<ConstantMedium>(b, density, a) : NULL;
+    }
+    if (type == "gridMedium") {
+        // densities from a raw "file" of floats, or a procedural plume when there is none
+        Vector3 lo, hi, res;
+        float density;
+        std::string file;
+        const JsonValue *albedo = v.get("albedo");
+        if (albedo == NULL) {
+            fail(v, "a grid medium needs \"albedo\"");
+            return NULL;
+        }
+        if (!readVector(v, "min", lo, true) || !readVector(v, "max", hi, true) || !readVector(v, "resolution", res, true) ||
+            !readFloat(v, "density", density, true) || !readString(v, "file", file))
+            return NULL;
+        int nx = int(res.x()), ny = int(res.y()), nz = int(res.z());
+        if (nx < 1 || ny < 1 || nz < 1 || nx > 1024 || ny > 1024 || nz > 1024) {
+            fail(v, "a grid medium \"resolution\" should be 1 to 1024 voxels on each axis");
+            return NULL;
+        }
+        DensityGrid grid(nx, ny, nz, AABB(lo, hi));
+        if (file.empty())
+            plumeDensity(grid);
+        else if (!loadDensityRaw(path(file), grid)) {
+            fail(v, "could not load densities from " + path(file));
+            return NULL;
+        }
+        Texture *a = texture(*albedo);
+        return a ? arena.make<GridMedium>(grid, density, a) : NULL;
+    }
+
+    // everything else is a surface with a material
+    const JsonValue *m = v.get("material");
+    if (m == NULL) {
+        fail(v, "missing \"material\"");
+        return NULL;
+    }
+    Material *mat = material(*m);
+    if (mat == NULL)
+        return NULL;
+    if (type == "sphere") {
+        Vector3 center;
+        float radius;
+        if (!readVector(v, "center", center, true) || !readFloat(v, "radius", radius, true))
+            return NULL;
+        return arena.make<Sphere>(center, radius, mat);
+    }
+    if (type == "movingSphere") {
+        Vector3 center0, center1;
+        float radius, t0 = time0, t1 = time1;
+        if (!readVector(v, "center0", center0, true) || !readVector(v, "center1", center1, true) ||
+            !readFloat(v, "radius", radius, true) || !readFloat(v, "time0", t0) || !readFloat(v, "time1", t1))
+            return NULL;
+        return arena.make<movingSphere>(center0, center1, t0, t1, radius, mat);
+    }
+    if (type == "xyRect" || type == "xzRect" || type == "yzRect") {
+        // a and b span the two axes in the plane, in order: x then y, x then z, y then z
+        float k;
+        const JsonValue *ra = v.get("a");
+        const JsonValue *rb = v.get("b");
+        if (ra == NULL || rb == NULL || !ra->isArray() || !rb->isArray() || ra->items.size() != 2 || rb->items.size() != 2 ||
+            !ra->items[0].isNumber() || !ra->items[1].isNumber() || !rb->items[0].isNumber() || !rb->items[1].isNumber()) {
+            fail(v, "a rect needs \"a\" and \"b\" ranges of two numbers");
+            return NULL;
+        }
+        if (!readFloat(v, "k", k, true))
+            return NULL;
+        float a0 = ra->items[0].number, a1 = ra->items[1].number;
+        float b0 = rb->items[0].number, b1 = rb->items[1].number;
+        if (type == "xyRect")
+            return arena.make<XYRect>(a0, a1, b0, b1, k, mat);
+        if (type == "xzRect")
+            return arena.make<XZRect>(a0, a1, b0, b1, k, mat);
+        return arena.make<YZRect>(a0, a1, b0, b1, k, mat);
+    }
+    if (type == "box") {
+        Vector3 lo, hi;
+        if (!readVector(v, "min", lo, true) || !readVector(v, "max", hi, true))
+            return NULL;
+        return arena.make<Box>(lo, hi, mat);
+    }
+    if (type == "mesh") {
+        std::string file;
+        if (!readString(v, "file", file, true))
+            return NULL;
+        TriangleMesh *mesh = arena.make<TriangleMesh>(mat);
+        int key = meshes++;
+        if (sceneCache && mesh->loadCached(*sceneCache, key))
+            return mesh;
+        std::string fullPath = path(file);
+        bool ply = fullPath.size() > 4 && fullPath.compare(fullPath.size() - 4, 4, ".ply") == 0;
+        if (!(ply ? loadPLY(fullPath, *mesh) : loadOBJ(fullPath, *mesh))) {
+            fail(v, "could not load mesh " + fullPath);
+            return NULL;
+        }
+        if (sceneCache)
+            mesh->storeCached(*sceneCache, key);
+        return mesh;
+    }
+    fail(v, "unknown object type \"" + type + "\"");
+    return NULL;
+}
+
+Hitable *SceneLoader::group(const JsonValue& list) {
+    if (!list.isArray()) {
+        fail(list, "\"objects\" should be a list");
+        return NULL;
+    }
+    Hitable **objects = arena.makeArray<Hitable*>(list.items.size());
+    for (size_t i = 0; i < list.items.size(); i++) {
+        objects[i] = object(list.items[i]);
+        if (objects[i] == NULL)
+            return NULL;
+    }
+    return arena.make<HitableList>(objects, int(list.items.size()));
+}
+
+// every "file" the scene names, by name, size and modification time
+uint64_t SceneLoader::hashInputs(const JsonValue& v, uint64_t h) const {
+    for (size_t i = 0; i < v.items.size(); i++)
+        h = hashInputs(v.items[i], h);
+    for (size_t i = 0; i < v.members.size(); i++) {
+        if (v.members[i].first == "file" && v.members[i].second.isString())
+            h = hashFileStamp(path(v.members[i].second.string), h);
+        else
+            h = hashInputs(v.members[i].second, h);
+    }
+    return h;
+}
+
+// true when transforms moved, so a compiled scene needs refitting
+bool SceneLoader::setFrame(float f, SceneCamera& camera) {
+    frame = f;
+    if (cameraDef)
+        readCamera(*cameraDef, camera);
+    for (size_t i = 0; i < animated.size(); i++) {
+        Matrix34 m = Matrix34::identity();
+        readTransform(*animated[i].steps, m);
+        animated[i].transform->setMatrix(m);
+    }
+    return !animated.empty();
+}
+
+// NULL on failure, with the reason printed and kept in error
+Hitable *SceneLoader::load(const std::string& fileName, SceneCamera& camera, SceneCache *cache) {
+    std::ifstream file(fileName.c_str());
+    if (!file) {
+        std::cerr << "Error: could not open " << fileName << std::endl;
+        return NULL;
+    }
+    std::stringstream text;
+    text << file.rdbuf();
+    std::string source = text.str();
+    size_t slash = fileName.rfind('/');
+    directory = slash == std::string::npos ? "" : fileName.substr(0, slash + 1);
+
+    root = JsonValue();
+    JsonParser parser(source);
+    Hitable *world = NULL;
+    sceneCache = cache;
+    meshes = images = 0;
+    frame = 0;
+    animated.clear();
+    bakedNoise.clear();
+    if (!parser.parse(root)) {
+        error = parser.error;
+    } else if (!root.isObject()) {
+        fail(root, "a scene should be a JSON object");
+    } else {
+        const JsonValue *cam = root.get("camera");
+        cameraDef = cam && keyed(*cam) ? cam : NULL;
+        const JsonValue *textureDefs = root.get("textures");
+        const JsonValue *materialDefs = root.get("materials");
+        const JsonValue *objects = root.get("objects");
+        inputHash = hashInputs(root, hashBytes(source.data(), source.size()));
+        if (sceneCache)
+            sceneCache->open(inputHash);
+        bool ok = cam == NULL || readCamera(*cam, camera);
+        time0 = camera.time0;
+        time1 = camera.time1;
+        if (ok && textureDefs) {
+            if (!textureDefs->isObject())
+                ok = fail(*textureDefs, "\"textures\" should map names to textures");
+            for (size_t i = 0; ok && i < textureDefs->members.size(); i++) {
+                Texture *t = makeTexture(textureDefs->members[i].second);
+                textures[textureDefs->members[i].first] = t;
+                ok = t != NULL;
+            }
+        }
+        if (ok && materialDefs) {
+            if (!materialDefs->isObject())
+                ok = fail(*materialDefs, "\"materials\" should map names to materials");
+            for (size_t i = 0; ok && i < materialDefs->members.size(); i++) {
+                Material *m = makeMaterial(materialDefs->members[i].second);
+                materials[materialDefs->members[i].first] = m;
+                ok = m != NULL;
+            }
+        }
+        if (ok && objects == NULL)
+            fail(root, "missing \"objects\"");
+        else if (ok)
+            world = group(*objects);
+    }
+    if (world == NULL)
+        std::cerr << "Error: " << fileName << " " << error << std::endl;
+    return world;
+}
+
+#endif
@@ -0,0 +1,243 @@
+#ifndef SCENESH
+#define SCENESH
+
+#include <string>
+
+#include "arena.h"
+#include "sphere.h"
+#include "sphereSet.h"
+#include "rectangle.h"
+#include "box.h"
+#include "hitableList.h"
+#include "material.h"
+#include "constantMedium.h"
+#include "gridMedium.h"
+#include "transform.h"
+#include "sceneLoader.h"
+
+// The scenes built into the binary, picked with --scene=random, cornell, final,
+// boxes, volume, textured or instanced.
+
+Hitable *randomScene(SceneArena& arena, TextureCache& textures) {
+    Vector3 colors[6] = {
+            Vector3(0.37,0.62,0.58),
+            Vector3(0.24,0.21,0.22),
+            Vector3(0.45,0.21,0.20),
+            Vector3(0.71,0.38,0.22),
+            Vector3(0.69,0.63,0.64),
+            Vector3(0.89,0.85,0.82),
+    };
+
+    int n = 5;
+    Hitable **list = arena.makeArray<Hitable*>(n+1);
+    list[0] =  arena.make<Sphere>(Vector3(0,-1000,0), 1000, arena.make<DiffuseLight>(arena.make<ConstantTexture>(Vector3(1.1,1.1,1.1))));
+
+    int i = 1;
+    SphereSet *smallSpheres = arena.make<SphereSet>();
+    for (int a = -11; a < 11; a++) {
+        for (int b = -11; b < 11; b++) {
+            float chooseMat = drand48();
+            Vector3 center(a+0.9*drand48(),0.2,b+0.9*drand48());
+            Vector3 color;
+            color = colors[ int(drand48()*5) ];
+
+            if ((center-Vector3(4,0.2,0)).length() > 0.9) { 
+                if (chooseMat < 0.3) {  // diffuse
+                    smallSpheres->add(center, 0.2, arena.make<Lambertian>(arena.make<ConstantTexture>(color)));
+                }
+                else if (chooseMat < 0.6) { // metal
+                    smallSpheres->add(center, 0.2, arena.make<Metal>(Vector3(0.5*(1 + drand48()), 0.5*(1 + drand48()), 0.5*(1 + drand48())),  0.5*drand48()));
+                }
+                else {  // glass
+                    smallSpheres->add(center, 0.2, arena.make<Dielectric>(1.5));
+                }
+            }
+        }
+    }
+    smallSpheres->build();
+    list[i++] = smallSpheres;
+
+    list[i++] = arena.make<Sphere>(Vector3(0, 1, 0), 1.0, arena.make<Dielectric>(1.5));
+
+    int earth = textures.add("textures/earth.jpg");
+    if (earth < 0)
+        return NULL;
+
+    Material *mat = arena.make<Lambertian>(arena.make<ImageTexture>(&textures, earth));
+    list[i++] = arena.make<Sphere>(Vector3(4, 1, 0), 1.0, mat);
+
+    list[i++] = arena.make<Sphere>(Vector3(-4, 1, 0), 1.0, arena.make<Metal>(colors[4], 0.0));
+    return arena.make<HitableList>(list,i);
+}
+
+Hitable *cornellBox(SceneArena& arena) {
+    Hitable **list = arena.makeArray<Hitable*>(6);
+    int i = 0;
+    Material *white = arena.make<Lambertian>(arena.make<ConstantTexture>(Vector3(0.73, 0.73, 0.73)));
+
+    list[i++] = arena.make<FlipNormals>(arena.make<YZRect>(0, 700, 0, 700, 700, white));
+    list[i++] = arena.make<YZRect>(0, 700, 0, 700, -700, white);
+    list[i++] = arena.make<FlipNormals>(arena.make<XZRect>(-700, 700, -700, 700, 700, white));
+    list[i++] = arena.make<XZRect>(-700, 700, -700, 700, 0, white);
+    list[i++] = arena.make<FlipNormals>(arena.make<XYRect>(-700, 700, 0, 700, 700, white));
+
+    return arena.make<HitableList>(list,i);
+}
+
+Hitable *final(SceneArena& arena) {
+    Hitable **list = arena.makeArray<Hitable*>(500);
+    int count = 0;
+    Material *red = arena.make<Lambertian>( arena.make<ConstantTexture>(Vector3(0.65, 0.05, 0.05)) );
+    Material *white = arena.make<Lambertian>( arena.make<ConstantTexture>(Vector3(0.73, 0.73, 0.73)) );
+    Material *green = arena.make<Lambertian>( arena.make<ConstantTexture>(Vector3(0.12, 0.45, 0.15)) );
+    Material *light = arena.make<DiffuseLight>( arena.make<ConstantTexture>(Vector3(15, 15, 15)) );
+
+    list[count++] = cornellBox(arena);
+
+    list[count++] = arena.make<Sphere>(Vector3(0,0,0), 50, red);
+    
+    // for (int i=0; i < 6; i++) {
+    //     for (int j = 0; j < 6; j++) {
+    //         float x = (drand48()*900)-450;
+    //         float y = drand48()*700;  
+    //         float z = (drand48()*900)-450;
+
+    //         list[count++] = arena.make<Sphere>(Vector3(x,y,z), 50, white);
+    //     }
+    // }
+
+    // for (int i=0; i < 28; i++) {
+
+    //     list[count++] = arena.make<Box>(
+    //         Vector3(650-(50*i),0,400-drand48()*100),
+    //         Vector3(700-(50*i),100+drand48()*200,700),
+    //         green
+    //     );
+
+    // }
+
+    //list[count++] = arena.make<ConstantMedium>(cornellBox(arena), 0.01, arena.make<ConstantTexture>(Vector3(1.0, 1.0, 1.0)));
+
+    list[count++] = arena.make<XZRect>(-200, 200, 0, 200, 554, light);
+
+    return arena.make<HitableList>(list, count);
+}
+
+// final with the row of 28 boxes along the back wall, of random heights
+Hitable *boxesScene(SceneArena& arena) {
+    Hitable **list = arena.makeArray<Hitable*>(31);
+    int count = 0;
+    Material *red = arena.make<Lambertian>( arena.make<ConstantTexture>(Vector3(0.65, 0.05, 0.05)) );
+    Material *green = arena.make<Lambertian>( arena.make<ConstantTexture>(Vector3(0.12, 0.45, 0.15)) );
+    Material *light = arena.make<DiffuseLight>( arena.make<ConstantTexture>(Vector3(15, 15, 15)) );
+
+    list[count++] = cornellBox(arena);
+    list[count++] = arena.make<Sphere>(Vector3(0,0,0), 50, red);
+    list[count++] = arena.make<XZRect>(-200, 200, 0, 200, 554, light);
+    for (int i = 0; i < 28; i++) {
+        list[count++] = arena.make<Box>(
+            Vector3(650-(50*i),0,400-drand48()*100),
+            Vector3(700-(50*i),100+drand48()*200,700),
+            green
+        );
+    }
+
+    return arena.make<HitableList>(list, count);
+}
+
+// the room of final with a voxel plume of smoke and a sphere of fog
+Hitable *volumeScene(SceneArena& arena) {
+    Hitable **list = arena.makeArray<Hitable*>(5);
+    int count = 0;
+    Material *white = arena.make<Lambertian>( arena.make<ConstantTexture>(Vector3(0.73, 0.73, 0.73)) );
+    Material *light = arena.make<DiffuseLight>( arena.make<ConstantTexture>(Vector3(15, 15, 15)) );
+
+    list[count++] = cornellBox(arena);
+    list[count++] = arena.make<XZRect>(-200, 200, 0, 200, 554, light);
+    // not a multiple of the brick size, so the last bricks are partial
+    DensityGrid plume(45, 75, 45, AABB(Vector3(-400,0,0), Vector3(-100,500,300)));
+    plumeDensity(plume);
+    list[count++] = arena.make<GridMedium>(plume, 0.3, arena.make<ConstantTexture>(Vector3(0.5, 0.5, 0.5)));
+    Hitable *fog = arena.make<Sphere>(Vector3(150,150,150), 150, white);
+    list[count++] = arena.make<ConstantMedium>(fog, 0.005, arena.make<ConstantTexture>(Vector3(0.9, 0.9, 0.9)));
+
+    return arena.make<HitableList>(list, count);
+}
+
+// every kind of texture: a checker floor, an image, and plain, turbulent and marble noise
+Hitable *texturedScene(SceneArena& arena, TextureCache& textures) {
+    Hitable **list = arena.makeArray<Hitable*>(7);
+    int count = 0;
+    Material *light = arena.make<DiffuseLight>( arena.make<ConstantTexture>(Vector3(15, 15, 15)) );
+    Texture *checker = arena.make<CheckerTexture>(arena.make<ConstantTexture>(Vector3(0.73, 0.73, 0.73)),
+                                                  arena.make<ConstantTexture>(Vector3(0.12, 0.45, 0.15)));
+    int earth = textures.add("textures/earth.jpg");
+    if (earth < 0)
+        return NULL;
+
+    list[count++] = cornellBox(arena);
+    list[count++] = arena.make<XZRect>(-700, 700, -700, 700, 0.5, arena.make<Lambertian>(checker));
+    list[count++] = arena.make<XZRect>(-200, 200, 0, 200, 554, light);
+    list[count++] = arena.make<Sphere>(Vector3(-220,100,150), 100, arena.make<Lambertian>(arena.make<ImageTexture>(&textures, earth)));
+    list[count++] = arena.make<Sphere>(Vector3(0,100,250), 100, arena.make<Lambertian>(arena.make<NoiseTexture>(0.05, NOISE_PLAIN)));
+    list[count++] = arena.make<Sphere>(Vector3(220,100,150), 100, arena.make<Lambertian>(arena.make<NoiseTexture>(0.05, NOISE_MARBLE)));
+    list[count++] = arena.make<Sphere>(Vector3(0,320,300), 80, arena.make<Lambertian>(arena.make<NoiseTexture>(0.1, NOISE_TURBULENCE)));
+
+    return arena.make<HitableList>(list, count);
+}
+
+// one cluster of 125 spheres, placed 144 times over the floor, each turned its own way
+Hitable *instancedScene(SceneArena& arena) {
+    int n = 12;
+    Hitable **list = arena.makeArray<Hitable*>(n*n + 2);
+    int count = 0;
+    Material *white = arena.make<Lambertian>( arena.make<ConstantTexture>(Vector3(0.73, 0.73, 0.73)) );
+    Material *light = arena.make<DiffuseLight>( arena.make<ConstantTexture>(Vector3(15, 15, 15)) );
+
+    list[count++] = cornellBox(arena);
+    list[count++] = arena.make<XZRect>(-200, 200, 0, 200, 554, light);
+
+    SphereSet *cluster = arena.make<SphereSet>();
+    for (int a = 0; a < 5; a++) {
+        for (int b = 0; b < 5; b++) {
+            for (int c = 0; c < 5; c++)
+                cluster->add(Vector3(-20 + 10*a, 5 + 10*b, -20 + 10*c), 4, white);
+        }
+    }
+    cluster->build();
+    for (int a = 0; a < n; a++) {
+        for (int b = 0; b < n; b++) {
+            Matrix34 place = Matrix34::translation(Vector3(-550 + 100*a, 0, -300 + 80*b)) * Matrix34::rotation(1, 7.5f*(a*n + b));
+            list[count++] = arena.make<Transform>(cluster, place);
+        }
+    }
+
+    return arena.make<HitableList>(list, count);
+}
+
+// NULL when the scene fails to build or the name is not built in
+Hitable *builtinScene(const std::string& name, SceneArena& arena, TextureCache& textures, SceneCamera& camera) {
+    camera = SceneCamera();
+    if (name == "random") {
+        camera.lookfrom = Vector3(13,2,3);
+        camera.lookat = Vector3(0,0,0);
+        camera.vfov = 20;
+        return randomScene(arena, textures);
+    }
+    if (name == "cornell")
+        return cornellBox(arena);
+    if (name == "final")
+        return final(arena);
+    if (name == "boxes")
+        return boxesScene(arena);
+    if (name == "volume")
+        return volumeScene(arena);
+    if (name == "textured")
+        return texturedScene(arena, textures);
+    if (name == "instanced")
+        return instancedScene(arena);
+    std::cout << "Error: unknown scene \"" << name << "\" (built in: random, cornell, final, boxes, volume, textured, instanced)" << std::endl;
+    return NULL;
+}
+
+#endif
@@ -6,51 +6,82 @@
 
 void getSphereUV(const Vector3& p, float& u, float& v) {
     float phi = atan2(p.z(), p.x());
-    float theta = asin(p.y());
+    float theta = asin(ffmax(-1.0f, ffmin(1.0f, p.y()))); // (p-center)/radius can land just past 1
     u = 1-(phi + M_PI) / (2*M_PI);
     v = (theta + M_PI/2) / M_PI;
 }
 
+// derivatives of the surface point along getSphereUV's u and v, from the unit normal
+void getSphereTangents(const Vector3& n, float radius, Vector3& dpdu, Vector3& dpdv) {
+    float cosTheta = ffmax(sqrt(n.x()*n.x() + n.z()*n.z()), 1e-4f); // the poles are singular
+    dpdu = float(2*M_PI)*radius*Vector3(n.z(), 0, -n.x());
+    dpdv = float(M_PI)*radius*Vector3(-n.y()*n.x()/cosTheta, cosTheta, -n.y()*n.z()/cosTheta);
+}
+
+// both roots of the ray against the sphere
+inline bool sphereInterval(const Vector3& center, float radius, const Ray& r, float tMin, float tMax, float& tEnter, float& tExit) {
+    Vector3 oc = r.origin() - center;
+    float a = dot(r.direction(), r.direction());
+    float b = dot(oc, r.direction());
+    float c = dot(oc, oc) - radius*radius;
+    float discriminant = b*b - a*c;
+    if (discriminant <= 0)
+        return false;
+    float root = sqrt(discriminant);
+    tEnter = (-b - root) / a;
+    tExit = (-b + root) / a;
+    return tExit > tMin && tEnter < tMax;
+}
+
 class Sphere: public Hitable {
     public:
         Sphere() {}
         Sphere(Vector3 cen, float r, Material *m) : center(cen), radius(r), matPtr(m) {};
         virtual bool hit(const Ray& r, float tmin, float tmax, HitRecord& rec) const;
         virtual bool boundingBox(float t0, float t1, AABB& box) const;
+        virtual void computeSurfaceInteraction(const Ray& r, HitRecord& rec) const;
+        virtual bool hitInterval(const Ray& r, float tMin, float tMax, float& tEnter, float& tExit) const {
+            return sphereInterval(center, radius, r, tMin, tMax, tEnter, tExit);
+        }
         Vector3 center;
         float radius;
         Material *matPtr;
 };
 
 bool Sphere::hit(const Ray& r, float tMin, float tMax, HitRecord& rec) const {
+    STAT_INC(primitiveTests[STAT_SPHERE]);
     Vector3 oc = r.origin() - center;
     float a = dot(r.direction(), r.direction());
     float b = dot(oc, r.direction());
     float c = dot(oc, oc) - radius*radius;
     float discriminant = b*b - a*c;
     if (discriminant > 0) {
-        float temp = (-b - sqrt(b*b-a*c)) / a;
+        float temp = (-b - sqrt(discriminant)) / a;
         if (temp < tMax && temp > tMin) {
             rec.t = temp;
-            rec.p = r.pointAtParameter(rec.t);
-            rec.normal = (rec.p - center) / radius;
-            rec.matPtr = matPtr;
-            getSphereUV((rec.p-center)/radius, rec.u, rec.v);
+            rec.object = this;
+            rec.flipped = false;
             return true;
         }
-        temp = (-b + sqrt(b*b-a*c))/a;
+        temp = (-b + sqrt(discriminant))/a;
         if (temp < tMax && temp > tMin) {
             rec.t = temp;
-            rec.p = r.pointAtParameter(rec.t);
-            rec.normal = (rec.p - center) / radius;
-            rec.matPtr = matPtr;
-            getSphereUV(rec.p, rec.u, rec.v);
+            rec.object = this;
+            rec.flipped = false;
             return true;
         }
     }
     return false;
 };
 
+void Sphere::computeSurfaceInteraction(const Ray& r, HitRecord& rec) const {
+    rec.p = r.pointAtParameter(rec.t);
+    rec.normal = (rec.p - center) / radius;
+    rec.matPtr = matPtr;
+    getSphereUV(rec.normal, rec.u, rec.v);
+    getSphereTangents(rec.normal, radius, rec.dpdu, rec.dpdv);
+}
+
 bool Sphere::boundingBox(float t0, float t1, AABB& box) const {
     box = AABB(center  - Vector3(radius, radius, radius), center + Vector3(radius, radius, radius));
     return true;
@@ -63,6 +94,10 @@ class movingSphere: public Hitable {
         virtual bool hit(const Ray& r, float tMin, float tMax, HitRecord& rec) const;
         Vector3 center(float time) const;
         virtual bool boundingBox(float t0, float t1, AABB& box) const;
+        virtual void computeSurfaceInteraction(const Ray& r, HitRecord& rec) const;
+        virtual bool hitInterval(const Ray& r, float tMin, float tMax, float& tEnter, float& tExit) const {
+            return sphereInterval(center(r.time()), radius, r, tMin, tMax, tEnter, tExit);
+        }
         Vector3 center0, center1;
         float time0, time1;
         float radius;
@@ -74,6 +109,7 @@ Vector3 movingSphere::center(float time) const {
 }
 
 bool movingSphere::hit(const Ray& r, float tMin, float tMax, HitRecord& rec) const {
+    STAT_INC(primitiveTests[STAT_MOVING_SPHERE]);
     Vector3 oc = r.origin() - center(r.time());
     float a = dot(r.direction(), r.direction());
     float b = dot(oc, r.direction());
@@ -83,23 +119,29 @@ bool movingSphere::hit(const Ray& r, float tMin, float tMax, HitRecord& rec) con
         float temp = (-b - sqrt(discriminant))/a;
         if (temp < tMax && temp > tMin) {
             rec.t = temp;
-            rec.p = r.pointAtParameter(rec.t);
-            rec.normal = (rec.p - center(r.time())) / radius;
-            rec.matPtr = matPtr;
+            rec.object = this;
+            rec.flipped = false;
             return true;
         }
         temp = (-b + sqrt(discriminant))/a;
         if (temp < tMax && temp > tMin) {
             rec.t = temp;
-            rec.p = r.pointAtParameter(rec.t);
-            rec.normal = (rec.p - center(r.time())) / radius;
-            rec.matPtr = matPtr;
+            rec.object = this;
+            rec.flipped = false;
             return true;
         }
     }
     return false;
 }
 
+void movingSphere::computeSurfaceInteraction(const Ray& r, HitRecord& rec) const {
+    rec.p = r.pointAtParameter(rec.t);
+    rec.normal = (rec.p - center(r.time())) / radius;
+    rec.matPtr = matPtr;
+    rec.u = rec.v = 0;
+    rec.dpdu = rec.dpdv = Vector3(0,0,0);
+}
+
 bool movingSphere::boundingBox(float t0, float t1, AABB& box) const {
     AABB box0(center(t0) - Vector3(radius,radius,radius), center(t0) + Vector3(radius, radius, radius));
     AABB box1(center(t1) - Vector3(radius,radius,radius), center(t1) + Vector3(radius, radius, radius));
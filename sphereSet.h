@@ -0,0 +1,215 @@
+#ifndef SPHERESETH
+#define SPHERESETH
+
+#include <unordered_map>
+#include <vector>
+#if defined(__AVX2__) && defined(__FMA__)
+#include <immintrin.h>
+#endif
+
+#include "hitable.h"
+#include "leafBVH.h"
+#include "material.h"
+#include "sphere.h"
+
+/*
+    Many static spheres stored as structure-of-arrays. Spheres are grouped into
+    leaves of up to 8 that are tested together, with AVX2 and FMA when they are
+    available. Small sets are scanned flat, larger ones through an internal BVH.
+*/
+class SphereSet: public Hitable {
+    public:
+        static const int leafSize = 8;
+        static const int flatLimit = 32;
+
+        SphereSet() {}
+        int addMaterial(Material *m);
+        void add(const Vector3& cen, float r, int material);
+        void add(const Vector3& cen, float r, Material *m) { add(cen, r, addMaterial(m)); }
+        void build();
+        int size() const { return int(matId.size()); }
+        virtual bool hit(const Ray& r, float tMin, float tMax, HitRecord& rec) const;
+        virtual void computeSurfaceInteraction(const Ray& r, HitRecord& rec) const;
+        virtual bool boundingBox(float t0, float t1, AABB& box) const;
+
+        std::vector<float> cx, cy, cz, radius;
+        std::vector<int> matId;
+        std::vector<Material*> materials;
+        QuantizedBVH bvh;
+
+    private:
+        bool hitLeaf(const Ray& r, int offset, int count, float tMin, float& tMax, int& closest) const;
+        std::unordered_map<Material*, int> materialIds;
+        int nSpheres = 0;
+};
+
+int SphereSet::addMaterial(Material *m) {
+    auto found = materialIds.find(m);
+    if (found != materialIds.end())
+        return found->second;
+    int id = int(materials.size());
+    materials.push_back(m);
+    materialIds[m] = id;
+    return id;
+}
+
+void SphereSet::add(const Vector3& cen, float r, int material) {
+    cx.push_back(cen.x());
+    cy.push_back(cen.y());
+    cz.push_back(cen.z());
+    radius.push_back(r);
+    matId.push_back(material);
+}
+
+void SphereSet::build() {
+    nSpheres = size();
+    cx.resize(nSpheres);
+    cy.resize(nSpheres);
+    cz.resize(nSpheres);
+    radius.resize(nSpheres);
+    std::vector<LeafBVHNode> nodes;
+    if (nSpheres > flatLimit) {
+        std::vector<AABB> boxes(nSpheres);
+        for (int i = 0; i < nSpheres; i++) {
+            Vector3 c(cx[i], cy[i], cz[i]);
+            Vector3 rad(radius[i], radius[i], radius[i]);
+            boxes[i] = AABB(c - rad, c + rad);
+        }
+        std::vector<int> order;
+        buildLeafBVH(boxes, leafSize, nodes, order);
+
+        std::vector<float> ox(cx), oy(cy), oz(cz), orad(radius);
+        std::vector<int> omat(matId);
+        for (int i = 0; i < nSpheres; i++) {
+            cx[i] = ox[order[i]];
+            cy[i] = oy[order[i]];
+            cz[i] = oz[order[i]];
+            radius[i] = orad[order[i]];
+            matId[i] = omat[order[i]];
+        }
+    }
+    bvh.build(nodes);
+    // pad so the last leaf can always be loaded as a full group of 8
+    cx.resize(nSpheres + leafSize, 0);
+    cy.resize(nSpheres + leafSize, 0);
+    cz.resize(nSpheres + leafSize, 0);
+    radius.resize(nSpheres + leafSize, 0);
+}
+
+bool SphereSet::hitLeaf(const Ray& r, int offset, int count, float tMin, float& tMax, int& closest) const {
+    STAT_ADD(primitiveTests[STAT_SPHERE], count);
+    bool hitAnything = false;
+#if defined(__AVX2__) && defined(__FMA__)
+    const __m256 ox = _mm256_set1_ps(r.origin().x());
+    const __m256 oy = _mm256_set1_ps(r.origin().y());
+    const __m256 oz = _mm256_set1_ps(r.origin().z());
+    const __m256 dx = _mm256_set1_ps(r.direction().x());
+    const __m256 dy = _mm256_set1_ps(r.direction().y());
+    const __m256 dz = _mm256_set1_ps(r.direction().z());
+    const __m256 a = _mm256_set1_ps(dot(r.direction(), r.direction()));
+    const __m256 lanes = _mm256_castsi256_ps(_mm256_cmpgt_epi32(_mm256_set1_epi32(count), _mm256_setr_epi32(0,1,2,3,4,5,6,7)));
+
+    __m256 ocx = _mm256_sub_ps(ox, _mm256_loadu_ps(&cx[offset]));
+    __m256 ocy = _mm256_sub_ps(oy, _mm256_loadu_ps(&cy[offset]));
+    __m256 ocz = _mm256_sub_ps(oz, _mm256_loadu_ps(&cz[offset]));
+    __m256 rad = _mm256_loadu_ps(&radius[offset]);
+    __m256 b = _mm256_fmadd_ps(ocz, dz, _mm256_fmadd_ps(ocy, dy, _mm256_mul_ps(ocx, dx)));
+    __m256 c = _mm256_fmadd_ps(ocz, ocz, _mm256_fmadd_ps(ocy, ocy, _mm256_fmsub_ps(ocx, ocx, _mm256_mul_ps(rad, rad))));
+    __m256 discriminant = _mm256_fmsub_ps(b, b, _mm256_mul_ps(a, c));
+    __m256 valid = _mm256_and_ps(lanes, _mm256_cmp_ps(discriminant, _mm256_setzero_ps(), _CMP_GT_OQ));
+    if (_mm256_movemask_ps(valid) == 0)
+        return false;
+
+    __m256 root = _mm256_sqrt_ps(_mm256_max_ps(discriminant, _mm256_setzero_ps()));
+    __m256 t0 = _mm256_div_ps(_mm256_sub_ps(_mm256_sub_ps(_mm256_setzero_ps(), b), root), a);
+    __m256 t1 = _mm256_div_ps(_mm256_add_ps(_mm256_sub_ps(_mm256_setzero_ps(), b), root), a);
+    __m256 lo = _mm256_set1_ps(tMin);
+    __m256 hi = _mm256_set1_ps(tMax);
+    __m256 in0 = _mm256_and_ps(_mm256_cmp_ps(t0, lo, _CMP_GT_OQ), _mm256_cmp_ps(t0, hi, _CMP_LT_OQ));
+    __m256 in1 = _mm256_and_ps(_mm256_cmp_ps(t1, lo, _CMP_GT_OQ), _mm256_cmp_ps(t1, hi, _CMP_LT_OQ));
+    __m256 t = _mm256_blendv_ps(t1, t0, in0);
+    int mask = _mm256_movemask_ps(_mm256_and_ps(valid, _mm256_or_ps(in0, in1)));
+    if (mask == 0)
+        return false;
+
+    float ts[8];
+    _mm256_storeu_ps(ts, t);
+    for (int i = 0; i < 8; i++) {
+        if ((mask & (1 << i)) && ts[i] < tMax) {
+            tMax = ts[i];
+            closest = offset + i;
+            hitAnything = true;
+        }
+    }
+#else
+    float a = dot(r.direction(), r.direction());
+    for (int i = offset; i < offset + count; i++) {
+        Vector3 oc = r.origin() - Vector3(cx[i], cy[i], cz[i]);
+        float b = dot(oc, r.direction());
+        float c = dot(oc, oc) - radius[i]*radius[i];
+        float discriminant = b*b - a*c;
+        if (discriminant > 0) {
+            float root = sqrt(discriminant);
+            float temp = (-b - root) / a;
+            if (!(temp < tMax && temp > tMin))
+                temp = (-b + root) / a;
+            if (temp < tMax && temp > tMin) {
+                tMax = temp;
+                closest = i;
+                hitAnything = true;
+            }
+        }
+    }
+#endif
+    return hitAnything;
+}
+
+bool SphereSet::hit(const Ray& r, float tMin, float tMax, HitRecord& rec) const {
+    int closest = -1;
+    bool hitAnything = false;
+    if (bvh.empty()) {
+        for (int offset = 0; offset < nSpheres; offset += leafSize) {
+            if (hitLeaf(r, offset, std::min(leafSize, nSpheres - offset), tMin, tMax, closest))
+                hitAnything = true;
+        }
+    } else {
+        hitAnything = traverseLeafBVH(bvh, r, tMin, tMax, [&](int offset, int count, float t0, float& t1) {
+            return hitLeaf(r, offset, count, t0, t1, closest);
+        });
+    }
+    if (!hitAnything)
+        return false;
+
+    rec.t = tMax;
+    rec.primitive = closest;
+    rec.object = this;
+    rec.flipped = false;
+    return true;
+}
+
+void SphereSet::computeSurfaceInteraction(const Ray& r, HitRecord& rec) const {
+    int i = rec.primitive;
+    rec.p = r.pointAtParameter(rec.t);
+    rec.normal = (rec.p - Vector3(cx[i], cy[i], cz[i])) / radius[i];
+    rec.matPtr = materials[matId[i]];
+    getSphereUV(rec.normal, rec.u, rec.v);
+    getSphereTangents(rec.normal, radius[i], rec.dpdu, rec.dpdv);
+}
+
+bool SphereSet::boundingBox(float t0, float t1, AABB& box) const {
+    if (nSpheres == 0)
+        return false;
+    if (!bvh.empty()) {
+        box = bvh.bounds;
+        return true;
+    }
+    Vector3 rad(radius[0], radius[0], radius[0]);
+    box = AABB(Vector3(cx[0], cy[0], cz[0]) - rad, Vector3(cx[0], cy[0], cz[0]) + rad);
+    for (int i = 1; i < nSpheres; i++) {
+        rad = Vector3(radius[i], radius[i], radius[i]);
+        box = surroundingBox(box, AABB(Vector3(cx[i], cy[i], cz[i]) - rad, Vector3(cx[i], cy[i], cz[i]) + rad));
+    }
+    return true;
+}
+
+#endif
@@ -0,0 +1,161 @@
+#ifndef STATSH
+#define STATSH
+
+#include <stdint.h>
+#include <string.h>
+
+#include <mutex>
+#include <ostream>
+
+/*
+    Counters for where tracing time goes, compiled in only with -DJRAY_STATS
+    (make STATS=1); otherwise STAT_INC and STAT_ADD expand to nothing. Each
+    thread counts into its own RenderStats, which is added to the totals when
+    the thread ends, so counting never makes threads share a cache line.
+    collectStats() takes everything counted so far.
+
+    boxTests counts every ray against bounding box test, in any BVH, and
+    nodesVisited the nodes whose box the ray did enter. primitiveTests counts
+    each shape a ray was tested against; a set tests a whole leaf at once and
+    counts every member of it.
+*/
+enum StatPrimitive {
+    STAT_SPHERE,
+    STAT_MOVING_SPHERE,
+    STAT_RECT,
+    STAT_BOX,
+    STAT_TRIANGLE,
+    STAT_INSTANCE,
+    STAT_MEDIUM,
+    STAT_PRIMITIVE_COUNT
+};
+
+enum StatTermination {
+    STAT_ESCAPED,     // missed everything
+    STAT_LIGHT,       // hit an emitter, which does not scatter
+    STAT_ABSORBED,    // hit a surface that did not scatter it
+    STAT_DEPTH_LIMIT, // bounced as often as color() allows
+    STAT_TERMINATION_COUNT
+};
+
+struct RenderStats {
+    static const int depths = 51; // color() follows bounces 0 to 50
+
+    RenderStats() { clear(); }
+    void clear() { memset(this, 0, sizeof(*this)); }
+    void add(const RenderStats& other);
+    uint64_t totalRays() const;
+    void print(std::ostream& out) const;
+    void writeJSON(std::ostream& out) const;
+
+    uint64_t rays[depths]; // by bounce depth, 0 for camera rays
+    uint64_t boxTests;
+    uint64_t nodesVisited;
+    uint64_t primitiveTests[STAT_PRIMITIVE_COUNT];
+    uint64_t terminations[STAT_TERMINATION_COUNT];
+};
+
+const char *const statPrimitiveNames[STAT_PRIMITIVE_COUNT] = {
+    "sphere", "movingSphere", "rect", "box", "triangle", "instance", "medium"
+};
+const char *const statTerminationNames[STAT_TERMINATION_COUNT] = {
+    "escaped", "light", "absorbed", "depthLimit"
+};
+
+void RenderStats::add(const RenderStats& other) {
+    for (int i = 0; i < depths; i++)
+        rays[i] += other.rays[i];
+    boxTests += other.boxTests;
+    nodesVisited += other.nodesVisited;
+    for (int i = 0; i < STAT_PRIMITIVE_COUNT; i++)
+        primitiveTests[i] += other.primitiveTests[i];
+    for (int i = 0; i < STAT_TERMINATION_COUNT; i++)
+        terminations[i] += other.terminations[i];
+}
+
+uint64_t RenderStats::totalRays() const {
+    uint64_t total = 0;
+    for (int i = 0; i < depths; i++)
+        total += rays[i];
+    return total;
+}
+
+void RenderStats::print(std::ostream& out) const {
+    uint64_t total = totalRays();
+    double perRay = total ? 1.0 / total : 0;
+    out << "Rays: " << total << " (by depth:";
+    int last = depths - 1;
+    while (last > 0 && rays[last] == 0)
+        last--;
+    for (int i = 0; i <= last; i++)
+        out << " " << rays[i];
+    out << ")" << std::endl;
+    out << "Box tests: " << boxTests << " (" << boxTests*perRay << " per ray), nodes visited: "
+        << nodesVisited << " (" << nodesVisited*perRay << " per ray)" << std::endl;
+    out << "Primitive tests:";
+    for (int i = 0; i < STAT_PRIMITIVE_COUNT; i++)
+        out << " " << statPrimitiveNames[i] << " " << primitiveTests[i];
+    out << std::endl << "Paths ended:";
+    for (int i = 0; i < STAT_TERMINATION_COUNT; i++)
+        out << " " << statTerminationNames[i] << " " << terminations[i];
+    out << std::endl;
+}
+
+void RenderStats::writeJSON(std::ostream& out) const {
+    int last = depths - 1;
+    while (last > 0 && rays[last] == 0)
+        last--;
+    out << "{ \"rays\": " << totalRays() << ", \"raysByDepth\": [";
+    for (int i = 0; i <= last; i++)
+        out << (i ? ", " : "") << rays[i];
+    out << "], \"boxTests\": " << boxTests << ", \"nodesVisited\": " << nodesVisited << ", \"primitiveTests\": {";
+    for (int i = 0; i < STAT_PRIMITIVE_COUNT; i++)
+        out << (i ? ", " : " ") << "\"" << statPrimitiveNames[i] << "\": " << primitiveTests[i];
+    out << " }, \"terminations\": {";
+    for (int i = 0; i < STAT_TERMINATION_COUNT; i++)
+        out << (i ? ", " : " ") << "\"" << statTerminationNames[i] << "\": " << terminations[i];
+    out << " } }";
+}
+
+#ifdef JRAY_STATS
+
+inline std::mutex& statsLock() {
+    static std::mutex lock;
+    return lock;
+}
+
+inline RenderStats& statsTotal() {
+    static RenderStats total;
+    return total;
+}
+
+struct ThreadStats : public RenderStats {
+    ~ThreadStats() {
+        std::lock_guard<std::mutex> guard(statsLock());
+        statsTotal().add(*this);
+    }
+};
+
+inline RenderStats& threadStats() {
+    static thread_local ThreadStats stats;
+    return stats;
+}
+
+// the counts of every thread that has ended and of this one, which start again from zero
+inline RenderStats collectStats() {
+    std::lock_guard<std::mutex> guard(statsLock());
+    RenderStats total = statsTotal();
+    total.add(threadStats());
+    statsTotal().clear();
+    threadStats().clear();
+    return total;
+}
+
+#define STAT_ADD(counter, n) (threadStats().counter += (n))
+#else
+#define STAT_ADD(counter, n) ((void)0)
+#endif
+
+#define STAT_INC(counter) STAT_ADD(counter, 1)
+
+#endif
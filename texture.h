@@ -1,138 +1,168 @@
 #ifndef TEXTUREH
 #define TEXTUREH
 
-inline float trilinearInterp(float c[2][2][2], float u, float v, float w) {
-    float accum = 0;
-    for (int i=0; i< 2; i++)
-        for (int j=0; j< 2; j++)
-            for (int k=0; k< 2; k++)
-                accum += (i*u + (1-i)*(1-u))*
-                        (j*v + (1-j)*(1-v))*
-                        (k*w + (1-k)*(1-w))*c[i][j][k];
-
-    return accum;
-}
-
-class Perlin {
-    public:
-    // TODO: implement perlin noise
-        float noise(const Vector3& p) const {
-            float u = p.x() - floor(p.x());
-            float v = p.y() - floor(p.y());
-            float w = p.z() - floor(p.z());
-            u = u*u*(3-2*u);
-            v = v*v*(3-2*v);
-            w = w*w*(3-2*w);
-            int i = floor(p.x());
-            int j = floor(p.y());
-            int k = floor(p.z());
-            float c[2][2][2];
-            for (int di=0; di < 2; di++)
-                for (int dj=0; dj < 2; dj++)
-                    for (int dk=0; dk < 2; dk++)
-                        c[di][dj][dk] = ranfloat[permX[(i+di)&255] ^ permX[(j+dj)&255] ^ permX[(k+dk)&255]];
-            return trilinearInterp(c, u, v, w);
-        }
-        static float *ranfloat;
-        static int *permX;
-        static int *permY;
-        static int *permZ;
-};
-
-static float *perlinGenerate() {
-    float *p = new float[256];
-    for (int i=0; i < 256; ++i) {
-        p[i] = drand48();
-    }
-    return p;
-}
+#include <vector>
 
-void permute(int *p, int n){
-    for (int i=n-1; i > 0; i--) {
-        int target = int(drand48()*(i+1));
-        int tmp = p[i];
-        p[i] = p[target];
-        p[target] = tmp;
-    }
-    return;
-}
+#include "perlin.h"
+#include "mipmap.h"
+#include "textureCache.h"
 
-static int* perlinGeneratePerm() {
-    int * p = new int[256];
-    for (int i=0; i < 256; i++) {
-        p[i] = i;
-    }
-    permute(p, 256);
-    return p;
-}
+enum TextureType { TEXTURE_OTHER, TEXTURE_CONSTANT, TEXTURE_CHECKER, TEXTURE_NOISE, TEXTURE_IMAGE };
 
+/*
+    type names the concrete class so the render loop can dispatch with a switch
+    (see textureValue) instead of a virtual call. Textures defined outside this
+    file keep TEXTURE_OTHER and are still reached through value(). The tagged
+    classes are final, since the switch would pass over an override.
+*/
 class Texture {
     public:
+        Texture() : type(TEXTURE_OTHER) {}
         virtual Vector3 value(float u, float v, const Vector3& p) const = 0;
+        TextureType type;
 };
 
-class ConstantTexture : public Texture {
+// width is the uv footprint of the lookup (see uvFootprint); only image textures filter with it
+Vector3 textureValue(const Texture *t, float u, float v, const Vector3& p, float width = 0);
+
+class ConstantTexture final : public Texture {
     public:
-        ConstantTexture() { }
-        ConstantTexture(Vector3 c) : color(c) { }
+        ConstantTexture() { type = TEXTURE_CONSTANT; }
+        ConstantTexture(Vector3 c) : color(c) { type = TEXTURE_CONSTANT; }
         virtual Vector3 value(float u, float v, const Vector3& p) const {
             return color;
         }
         Vector3 color;
 };
 
-class CheckerTexture : public Texture {
+class CheckerTexture final : public Texture {
     public:
-        CheckerTexture() { }
-        CheckerTexture(Texture *t0, Texture *t1) : even(t0), odd(t1) { }
-        virtual Vector3 value(float u, float v, const Vector3& p) const {
+        CheckerTexture() { type = TEXTURE_CHECKER; }
+        CheckerTexture(Texture *t0, Texture *t1) : even(t0), odd(t1) { type = TEXTURE_CHECKER; }
+        virtual Vector3 value(float u, float v, const Vector3& p) const { return value(u, v, p, 0); }
+        Vector3 value(float u, float v, const Vector3& p, float width) const {
             float sines = sin(10*p.x())*sin(10*p.y())*sin(10*p.z());
             if (sines < 0)
-                return odd->value(u, v, p);
+                return textureValue(odd, u, v, p, width);
             else
-                return even->value(u, v, p);
+                return textureValue(even, u, v, p, width);
         }
 
         Texture *odd;
         Texture *even;
 };
 
-class NoiseTexture : public Texture {
+enum NoiseStyle { NOISE_PLAIN, NOISE_TURBULENCE, NOISE_MARBLE };
+
+/*
+    Plain noise, turbulence (clouds) or marble veins. With a baked volume the
+    coarse octaves of the turbulence come from its lookup (see BakedNoise).
+*/
+class NoiseTexture final : public Texture {
     public:
-        NoiseTexture() {}
-        NoiseTexture(float sc) : scale(sc) {}
+        NoiseTexture() : scale(1), style(NOISE_PLAIN), octaves(7), baked(NULL) { type = TEXTURE_NOISE; }
+        NoiseTexture(float sc, NoiseStyle s = NOISE_PLAIN, int oct = 7, const BakedNoise *b = NULL) :
+            scale(sc), style(s), octaves(oct), baked(b) { type = TEXTURE_NOISE; }
         virtual Vector3 value(float u, float v, const Vector3& p) const {
-            return Vector3(1,1,1)*noise.noise(p*scale);
+            switch (style) {
+                case NOISE_TURBULENCE:
+                    return Vector3(1,1,1)*turbulence(p*scale);
+                case NOISE_MARBLE:
+                    return Vector3(1,1,1)*0.5*(1 + sin(scale*p.z() + 10*turbulence(p)));
+                default:
+                    return Vector3(1,1,1)*0.5*(1 + noise.noise(p*scale));
+            }
+        }
+        float turbulence(const Vector3& p) const {
+            return baked ? baked->turbulence(p) : noise.turbulence(p, octaves);
         }
         Perlin noise;
         float scale;
+        NoiseStyle style;
+        int octaves;
+        const BakedNoise *baked;
 };
 
-class ImageTexture : public Texture {
+/*
+    8-bit RGB image filtered through mip levels (see MipPyramid): lookups are
+    bilinear within a level and blend the two levels whose texel size brackets
+    the footprint, so a distant surface reads a prefiltered average instead of
+    aliasing. The pixels either stay in memory (data is level 0 and is not
+    copied) or live in a TextureCache and are fetched a tile at a time.
+*/
+class ImageTexture final : public Texture {
     public:
-        ImageTexture() {}
-        ImageTexture(unsigned char *pixels, int A, int B) : data(pixels), nx(A), ny(B) {}
-        virtual Vector3 value(float u, float v, const Vector3& p) const;
+        ImageTexture() : data(NULL), nx(0), ny(0), cache(NULL), cacheId(-1) { type = TEXTURE_IMAGE; }
+        ImageTexture(unsigned char *pixels, int A, int B) : data(pixels), nx(A), ny(B), cache(NULL), cacheId(-1), mips(pixels, A, B) {
+            type = TEXTURE_IMAGE;
+            levelWidth = mips.width;
+            levelHeight = mips.height;
+        }
+        ImageTexture(const TextureCache *c, int id) : data(NULL), cache(c), cacheId(id) {
+            type = TEXTURE_IMAGE;
+            levelWidth = cache->levelWidth(id);
+            levelHeight = cache->levelHeight(id);
+            nx = levelWidth[0];
+            ny = levelHeight[0];
+        }
+        virtual Vector3 value(float u, float v, const Vector3& p) const { return value(u, v, p, 0); }
+        Vector3 value(float u, float v, const Vector3& p, float width) const;
+        int levels() const { return int(levelWidth.size()); }
+
         unsigned char *data;
         int nx, ny;
+        const TextureCache *cache;
+        int cacheId;
+
+    private:
+        Vector3 texel(int level, int i, int j) const;
+        Vector3 bilinear(int level, float u, float v) const;
+
+        MipPyramid mips;
+        std::vector<int> levelWidth, levelHeight;
 };
 
-Vector3 ImageTexture::value(float u, float v, const Vector3& p) const {
-    int i = (u)*nx;
-    int j = (1-v)*ny-0.001;
-    if (i < 0) i = 0;
-    if (j < 0) j = 0;
-    if (i > nx-1) i = nx-1;
-    if (j > ny-1) j = ny-1;
-    float r = int(data[3*i + 3*nx*j] ) / 255.0;
-    float g = int(data[3*i + 3*nx*j + 1] ) / 255.0;
-    float b = int(data[3*i + 3*nx*j + 2] ) / 255.0;
-    return Vector3(r, g, b);
+inline Vector3 ImageTexture::texel(int level, int i, int j) const {
+    int w = levelWidth[level], h = levelHeight[level];
+    i = i < 0 ? 0 : (i > w-1 ? w-1 : i);
+    j = j < 0 ? 0 : (j > h-1 ? h-1 : j);
+    if (cache)
+        return cache->texel(cacheId, level, i, j);
+    const unsigned char *px = mips.level(level) + 3*(i + w*j);
+    return Vector3(px[0], px[1], px[2]) / 255.0f;
 }
 
-float * Perlin::ranfloat = perlinGenerate();
-int *Perlin::permX = perlinGeneratePerm();
-int *Perlin::permY = perlinGeneratePerm();
-int *Perlin::permZ = perlinGeneratePerm();
+// between texel centres, clamped at the edges; v runs up the image
+Vector3 ImageTexture::bilinear(int level, float u, float v) const {
+    float x = u*levelWidth[level] - 0.5f;
+    float y = (1-v)*levelHeight[level] - 0.5f;
+    float fx = floor(x), fy = floor(y);
+    int i = int(fx), j = int(fy);
+    float dx = x - fx, dy = y - fy;
+    return (1-dy)*((1-dx)*texel(level, i, j) + dx*texel(level, i+1, j)) +
+           dy*((1-dx)*texel(level, i, j+1) + dx*texel(level, i+1, j+1));
+}
+
+Vector3 ImageTexture::value(float u, float v, const Vector3& p, float width) const {
+    float lod = width > 0 ? log2f(width * std::max(nx, ny)) : 0;
+    if (lod <= 0)
+        return bilinear(0, u, v);
+    int last = levels() - 1;
+    if (lod >= last)
+        return bilinear(last, u, v);
+    int level = int(lod);
+    float f = lod - level;
+    return (1-f)*bilinear(level, u, v) + f*bilinear(level+1, u, v);
+}
+
+inline Vector3 textureValue(const Texture *t, float u, float v, const Vector3& p, float width) {
+    switch (t->type) {
+        case TEXTURE_CONSTANT: return static_cast<const ConstantTexture*>(t)->color;
+        case TEXTURE_CHECKER: return static_cast<const CheckerTexture*>(t)->CheckerTexture::value(u, v, p, width);
+        case TEXTURE_NOISE: return static_cast<const NoiseTexture*>(t)->NoiseTexture::value(u, v, p);
+        case TEXTURE_IMAGE: return static_cast<const ImageTexture*>(t)->ImageTexture::value(u, v, p, width);
+        default: return t->value(u, v, p);
+    }
+}
 
 #endif
\ No newline at end of file
@@ -0,0 +1,263 @@
+#ifndef TEXTURECACHEH
+#define TEXTURECACHEH
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <iostream>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "mipmap.h"
+#include "sceneCache.h"
+#include "stb_image.h"
+
+/*
+    Image textures kept as 64x64 tiles of their mip levels, shared by every
+    ImageTexture made from it. add() decodes an image once, writes its tiled
+    pyramid to an unlinked scratch file next to scratchNextTo and drops the
+    pixels, unless a SceneCache already holds the tiles mapped. Tiles are
+    then read back on demand and held under a byte budget, least recently
+    used first out. Lookups are safe from any number of threads: tiles are
+    spread over independently locked shards, and each thread also remembers
+    the last tile it used, so neighbouring texels do not take a lock at all.
+*/
+class TextureCache {
+    public:
+        static const int tileSize = 64;
+        static const int tileBytes = tileSize*tileSize*3;
+        static const int shardCount = 16;
+
+        struct Stats {
+            uint64_t hits, misses, evictions;
+            size_t bytes;
+        };
+
+        explicit TextureCache(size_t budgetBytes = size_t(256) << 20, const std::string& scratchNear = "textures");
+        ~TextureCache();
+        int add(const char *fileName, SceneCache *sceneCache = NULL, int key = 0);
+        int add(const unsigned char *pixels, int nx, int ny, std::vector<unsigned char> *tiles = NULL);
+        Vector3 texel(int texture, int level, int i, int j) const;
+        const std::vector<int>& levelWidth(int texture) const { return textures[texture].width; }
+        const std::vector<int>& levelHeight(int texture) const { return textures[texture].height; }
+        int size() const { return int(textures.size()); }
+        Stats stats() const;
+
+        size_t budget;
+        std::string scratchNextTo; // the scratch file is this plus a random suffix
+
+    private:
+        typedef std::vector<unsigned char> Tile;
+
+        struct TextureInfo {
+            std::vector<int> width, height, tilesX;
+            std::vector<int64_t> levelStart; // where each level's tiles begin in the scratch file, or in mapped
+            const unsigned char *mapped = NULL;
+            std::shared_ptr<const void> mappedOwner;
+        };
+
+        struct Shard {
+            std::mutex lock;
+            std::list<std::pair<uint64_t, std::shared_ptr<const Tile> > > lru; // most recent first
+            std::unordered_map<uint64_t, std::list<std::pair<uint64_t, std::shared_ptr<const Tile> > >::iterator> index;
+            size_t bytes = 0;
+            uint64_t hits = 0, misses = 0, evictions = 0;
+        };
+
+        std::shared_ptr<const Tile> tile(int texture, int level, int tx, int ty) const;
+
+        std::vector<TextureInfo> textures;
+        FILE *scratch;
+        int64_t scratchSize;
+        mutable Shard shards[shardCount];
+        uint64_t instance; // tells this cache apart from earlier ones in the per-thread last tile
+};
+
+TextureCache::TextureCache(size_t budgetBytes, const std::string& scratchNear) :
+    budget(budgetBytes), scratchNextTo(scratchNear), scratch(NULL), scratchSize(0) {
+    static std::atomic<uint64_t> instances(0);
+    instance = ++instances;
+}
+
+TextureCache::~TextureCache() {
+    if (scratch)
+        fclose(scratch);
+}
+
+// -1 when the file cannot be read. With a scene cache, key names the texture's sections in it
+int TextureCache::add(const char *fileName, SceneCache *sceneCache, int key) {
+    if (sceneCache) {
+        TextureInfo info;
+        size_t bytes;
+        const unsigned char *tiles;
+        if (sceneCache->get(CACHE_TEXTURE, key, 0, info.width) && sceneCache->get(CACHE_TEXTURE, key, 1, info.height) &&
+            sceneCache->get(CACHE_TEXTURE, key, 2, info.tilesX) && sceneCache->get(CACHE_TEXTURE, key, 3, info.levelStart) &&
+            sceneCache->get(CACHE_TEXTURE, key, 4, tiles, bytes)) {
+            info.mapped = tiles;
+            info.mappedOwner = sceneCache->owner();
+            textures.push_back(info);
+            return int(textures.size()) - 1;
+        }
+    }
+    int nx, ny, nn;
+    unsigned char *pixels = stbi_load(fileName, &nx, &ny, &nn, 3);
+    if (pixels == NULL) {
+        std::cerr << "Error: texture " << fileName << " could not be loaded!" << std::endl;
+        return -1;
+    }
+    std::vector<unsigned char> tiles;
+    int id = add(pixels, nx, ny, sceneCache && sceneCache->recording ? &tiles : NULL);
+    stbi_image_free(pixels);
+    if (id >= 0 && sceneCache) {
+        // offsets in the cache count from the first tile of this texture
+        TextureInfo info = textures[id];
+        for (size_t l = 0; l < info.levelStart.size(); l++)
+            info.levelStart[l] -= textures[id].levelStart[0];
+        sceneCache->put(CACHE_TEXTURE, key, 0, info.width);
+        sceneCache->put(CACHE_TEXTURE, key, 1, info.height);
+        sceneCache->put(CACHE_TEXTURE, key, 2, info.tilesX);
+        sceneCache->put(CACHE_TEXTURE, key, 3, info.levelStart);
+        sceneCache->put(CACHE_TEXTURE, key, 4, tiles);
+    }
+    return id;
+}
+
+// textures are added before rendering starts; only lookups may run concurrently.
+// When tiles is given it also receives a copy of everything written
+int TextureCache::add(const unsigned char *pixels, int nx, int ny, std::vector<unsigned char> *tiles) {
+    if (scratch == NULL) {
+        // not tmpfile(): /tmp is often memory itself, which the tiles are there to save
+        std::string name = scratchNextTo + ".XXXXXX";
+        std::vector<char> path(name.begin(), name.end());
+        path.push_back(0);
+        int fd = mkstemp(path.data());
+        if (fd >= 0) {
+            unlink(path.data());
+            scratch = fdopen(fd, "w+b");
+            if (scratch == NULL)
+                close(fd);
+        }
+        if (scratch == NULL) {
+            std::cerr << "Error: no scratch file for the texture cache next to " << scratchNextTo << std::endl;
+            return -1;
+        }
+    }
+    MipPyramid mips(pixels, nx, ny);
+    TextureInfo info;
+    info.width = mips.width;
+    info.height = mips.height;
+    Tile tile(tileBytes);
+    for (int l = 0; l < mips.levels(); l++) {
+        int w = mips.width[l], h = mips.height[l];
+        int tilesX = (w + tileSize - 1) / tileSize;
+        int tilesY = (h + tileSize - 1) / tileSize;
+        info.tilesX.push_back(tilesX);
+        info.levelStart.push_back(scratchSize);
+        const unsigned char *src = mips.level(l);
+        for (int ty = 0; ty < tilesY; ty++) {
+            for (int tx = 0; tx < tilesX; tx++) {
+                // edge tiles are padded with zeros; texel() never reads past the level
+                std::fill(tile.begin(), tile.end(), 0);
+                for (int y = 0; y < tileSize && ty*tileSize + y < h; y++) {
+                    int x0 = tx*tileSize;
+                    int n = std::min(tileSize, w - x0);
+                    std::copy(src + 3*(size_t(ty*tileSize + y)*w + x0), src + 3*(size_t(ty*tileSize + y)*w + x0 + n), &tile[3*y*tileSize]);
+                }
+                if (fwrite(tile.data(), 1, tileBytes, scratch) != size_t(tileBytes)) {
+                    std::cerr << "Error: writing the texture cache scratch file failed" << std::endl;
+                    return -1;
+                }
+                scratchSize += tileBytes;
+                if (tiles)
+                    tiles->insert(tiles->end(), tile.begin(), tile.end());
+            }
+        }
+    }
+    fflush(scratch);
+    textures.push_back(info);
+    return int(textures.size()) - 1;
+}
+
+std::shared_ptr<const TextureCache::Tile> TextureCache::tile(int texture, int level, int tx, int ty) const {
+    uint64_t key = (uint64_t(texture) << 37) | (uint64_t(level) << 32) | (uint64_t(ty) << 16) | uint64_t(tx);
+    Shard& shard = shards[(key * 0x9E3779B97F4A7C15ull) >> 60];
+    {
+        std::lock_guard<std::mutex> guard(shard.lock);
+        auto found = shard.index.find(key);
+        if (found != shard.index.end()) {
+            shard.lru.splice(shard.lru.begin(), shard.lru, found->second);
+            shard.hits++;
+            return found->second->second;
+        }
+        shard.misses++;
+    }
+
+    // read without holding the shard; if another thread loads the same tile meanwhile, its copy wins
+    const TextureInfo& info = textures[texture];
+    std::shared_ptr<Tile> loaded = std::make_shared<Tile>(tileBytes);
+    int64_t at = info.levelStart[level] + int64_t(ty*info.tilesX[level] + tx)*tileBytes;
+    if (info.mapped)
+        memcpy(loaded->data(), info.mapped + at, tileBytes);
+    else if (pread(fileno(scratch), loaded->data(), tileBytes, off_t(at)) != tileBytes)
+        std::cerr << "Error: reading a texture tile failed" << std::endl;
+
+    std::lock_guard<std::mutex> guard(shard.lock);
+    auto found = shard.index.find(key);
+    if (found != shard.index.end())
+        return found->second->second;
+    shard.lru.push_front(std::make_pair(key, std::shared_ptr<const Tile>(loaded)));
+    shard.index[key] = shard.lru.begin();
+    shard.bytes += tileBytes;
+    // each shard gets an equal slice of the budget, but always keeps the tile just loaded
+    while (shard.bytes > budget / shardCount && shard.lru.size() > 1) {
+        shard.index.erase(shard.lru.back().first);
+        shard.lru.pop_back();
+        shard.bytes -= tileBytes;
+        shard.evictions++;
+    }
+    return loaded;
+}
+
+// i and j must lie inside the level
+Vector3 TextureCache::texel(int texture, int level, int i, int j) const {
+    struct LastTile {
+        uint64_t instance;
+        int texture, level, tx, ty;
+        std::shared_ptr<const Tile> tile;
+    };
+    static thread_local LastTile last = { 0, -1, -1, -1, -1, std::shared_ptr<const Tile>() };
+    int tx = i / tileSize, ty = j / tileSize;
+    if (last.instance != instance || last.texture != texture || last.level != level || last.tx != tx || last.ty != ty) {
+        last.tile = tile(texture, level, tx, ty);
+        last.instance = instance;
+        last.texture = texture;
+        last.level = level;
+        last.tx = tx;
+        last.ty = ty;
+    }
+    const unsigned char *px = &(*last.tile)[3*((j - ty*tileSize)*tileSize + i - tx*tileSize)];
+    return Vector3(px[0], px[1], px[2]) / 255.0f;
+}
+
+// hits and misses count tile requests that reach the shards, not reuse of a thread's last tile
+TextureCache::Stats TextureCache::stats() const {
+    Stats s = { 0, 0, 0, 0 };
+    for (int i = 0; i < shardCount; i++) {
+        std::lock_guard<std::mutex> guard(shards[i].lock);
+        s.hits += shards[i].hits;
+        s.misses += shards[i].misses;
+        s.evictions += shards[i].evictions;
+        s.bytes += shards[i].bytes;
+    }
+    return s;
+}
+
+#endif
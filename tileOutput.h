@@ -0,0 +1,158 @@
+#ifndef TILEOUTPUTH
+#define TILEOUTPUTH
+
+#include <fcntl.h>
+#include <stdint.h>
+#include <unistd.h>
+
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "framebuffer.h"
+
+/*
+    Where a tiled render sends each tile as it finishes: w by h linear RGB
+    floats, top row first, for the region starting at x0, y0. Tiles arrive
+    from several threads at once and in any order, and must not overlap.
+*/
+class TileOutput {
+    public:
+        virtual ~TileOutput() {}
+        virtual bool writeTile(int x0, int y0, int w, int h, const float *rgb) = 0;
+        virtual bool finish() = 0;
+};
+
+/*
+    PFM and EXR files lay every pixel out at a fixed place, so the file is
+    sized up front and each tile is written straight to where it belongs.
+    Nothing but the tiles in flight is ever held in memory.
+*/
+class StreamedFileOutput : public TileOutput {
+    public:
+        StreamedFileOutput() : fd(-1), exr(false), width(0), height(0), dataStart(0), ok(true) {}
+        ~StreamedFileOutput() { if (fd >= 0) close(fd); }
+        bool open(const std::string& fileName, int w, int h);
+        virtual bool writeTile(int x0, int y0, int w, int h, const float *rgb);
+        virtual bool finish();
+
+    private:
+        bool put(const void *data, size_t bytes, uint64_t at);
+
+        int fd;
+        bool exr;
+        int width, height;
+        uint64_t dataStart; // the PFM data, or the first EXR line block
+        bool ok;
+};
+
+bool StreamedFileOutput::open(const std::string& fileName, int w, int h) {
+    exr = hasExtension(fileName, ".exr");
+    width = w;
+    height = h;
+    std::vector<unsigned char> header;
+    uint64_t total;
+    if (exr) {
+        header = exrHeader(w, h);
+        dataStart = header.size();
+        total = exrLineStart(header.size(), w, h);
+    } else {
+        std::string text = pfmHeader(w, h);
+        header.assign(text.begin(), text.end());
+        dataStart = header.size();
+        total = dataStart + uint64_t(w)*h*12;
+    }
+    fd = ::open(fileName.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0)
+        return false;
+    return ftruncate(fd, off_t(total)) == 0 && put(header.data(), header.size(), 0);
+}
+
+bool StreamedFileOutput::put(const void *data, size_t bytes, uint64_t at) {
+    const char *p = (const char*)data;
+    while (bytes > 0) {
+        ssize_t n = pwrite(fd, p, bytes, off_t(at));
+        if (n <= 0) {
+            ok = false;
+            return false;
+        }
+        p += n;
+        bytes -= n;
+        at += n;
+    }
+    return true;
+}
+
+bool StreamedFileOutput::writeTile(int x0, int y0, int w, int h, const float *rgb) {
+    if (!exr) {
+        for (int y = 0; y < h; y++) {
+            uint64_t row = uint64_t(height - 1 - (y0 + y)); // bottom row first
+            if (!put(rgb + size_t(3)*y*w, size_t(w)*12, dataStart + (row*width + x0)*12))
+                return false;
+        }
+        return true;
+    }
+    std::vector<uint16_t> half(w);
+    for (int y = 0; y < h; y++) {
+        uint64_t line = exrLineStart(dataStart, width, y0 + y);
+        // the tile on the left edge writes the line's block header
+        if (x0 == 0) {
+            int32_t block[2] = { y0 + y, int32_t(width*3*2) };
+            if (!put(block, 8, line))
+                return false;
+        }
+        const float *row = rgb + size_t(3)*y*w;
+        for (int c = 0; c < 3; c++) {
+            for (int x = 0; x < w; x++)
+                half[x] = floatToHalf(row[3*x + 2 - c]);
+            if (!put(half.data(), size_t(w)*2, line + 8 + (uint64_t(c)*width + x0)*2))
+                return false;
+        }
+    }
+    return true;
+}
+
+bool StreamedFileOutput::finish() {
+    bool closed = close(fd) == 0;
+    fd = -1;
+    return closed && ok;
+}
+
+/*
+    Every other format is written whole at the end, so tiles are gathered
+    in a framebuffer mapped from a scratch file rather than kept in memory.
+*/
+class MappedFramebufferOutput : public TileOutput {
+    public:
+        MappedFramebufferOutput(const std::string& _fileName, const ToneMapSettings& _settings) : fileName(_fileName), settings(_settings) {}
+        bool open(int w, int h) { return image.map(w, h, fileName); }
+        virtual bool writeTile(int x0, int y0, int w, int h, const float *rgb) {
+            for (int y = 0; y < h; y++)
+                std::copy(rgb + size_t(3)*y*w, rgb + size_t(3)*(y+1)*w, image.pixels + 3*(size_t(y0 + y)*image.width + x0));
+            return true;
+        }
+        virtual bool finish() { return writeImage(image, fileName, settings); }
+
+        std::string fileName;
+        ToneMapSettings settings;
+        Framebuffer image;
+};
+
+// NULL when the output cannot be created
+inline TileOutput *openTileOutput(const std::string& fileName, int w, int h, const ToneMapSettings& settings) {
+    if (hasExtension(fileName, ".pfm") || hasExtension(fileName, ".exr")) {
+        StreamedFileOutput *output = new StreamedFileOutput();
+        if (output->open(fileName, w, h))
+            return output;
+        delete output;
+    } else {
+        MappedFramebufferOutput *output = new MappedFramebufferOutput(fileName, settings);
+        if (output->open(w, h))
+            return output;
+        delete output;
+    }
+    std::cerr << "Error: could not create " << fileName << std::endl;
+    return NULL;
+}
+
+#endif
@@ -0,0 +1,237 @@
+#ifndef TRANSFORMH
+#define TRANSFORMH
+
+#include "hitable.h"
+
+/*
+    Affine transform as a 3x4 row-major matrix: a 3x3 linear part and a
+    translation in the last column.
+*/
+struct Matrix34 {
+    float m[3][4];
+
+    static Matrix34 identity();
+    static Matrix34 translation(const Vector3& offset);
+    static Matrix34 scaling(const Vector3& scale);
+    static Matrix34 rotation(int axis, float degrees);
+
+    Vector3 point(const Vector3& p) const {
+        return Vector3(m[0][0]*p[0] + m[0][1]*p[1] + m[0][2]*p[2] + m[0][3],
+                       m[1][0]*p[0] + m[1][1]*p[1] + m[1][2]*p[2] + m[1][3],
+                       m[2][0]*p[0] + m[2][1]*p[1] + m[2][2]*p[2] + m[2][3]);
+    }
+    Vector3 vector(const Vector3& v) const {
+        return Vector3(m[0][0]*v[0] + m[0][1]*v[1] + m[0][2]*v[2],
+                       m[1][0]*v[0] + m[1][1]*v[1] + m[1][2]*v[2],
+                       m[2][0]*v[0] + m[2][1]*v[1] + m[2][2]*v[2]);
+    }
+    // normals go through the transpose, so call this on the inverse of the matrix that moves the points
+    Vector3 normal(const Vector3& n) const {
+        return Vector3(m[0][0]*n[0] + m[1][0]*n[1] + m[2][0]*n[2],
+                       m[0][1]*n[0] + m[1][1]*n[1] + m[2][1]*n[2],
+                       m[0][2]*n[0] + m[1][2]*n[1] + m[2][2]*n[2]);
+    }
+    Vector3 translationPart() const { return Vector3(m[0][3], m[1][3], m[2][3]); }
+    bool isTranslation() const;
+    Matrix34 inverse() const;
+    AABB transformBox(const AABB& box) const;
+};
+
+Matrix34 Matrix34::identity() {
+    Matrix34 r;
+    for (int i = 0; i < 3; i++) {
+        for (int j = 0; j < 4; j++)
+            r.m[i][j] = i == j ? 1 : 0;
+    }
+    return r;
+}
+
+Matrix34 Matrix34::translation(const Vector3& offset) {
+    Matrix34 r = identity();
+    for (int i = 0; i < 3; i++)
+        r.m[i][3] = offset[i];
+    return r;
+}
+
+Matrix34 Matrix34::scaling(const Vector3& scale) {
+    Matrix34 r = identity();
+    for (int i = 0; i < 3; i++)
+        r.m[i][i] = scale[i];
+    return r;
+}
+
+// right-handed rotation about x, y or z; rotation(1, angle) matches what RotateY always did
+Matrix34 Matrix34::rotation(int axis, float degrees) {
+    float radians = (M_PI / 180) * degrees;
+    float s = sin(radians);
+    float c = cos(radians);
+    int a = (axis + 1) % 3;
+    int b = (axis + 2) % 3;
+    Matrix34 r = identity();
+    r.m[a][a] = c;
+    r.m[a][b] = -s;
+    r.m[b][a] = s;
+    r.m[b][b] = c;
+    return r;
+}
+
+// a * b applies b first
+inline Matrix34 operator*(const Matrix34& a, const Matrix34& b) {
+    Matrix34 r;
+    for (int i = 0; i < 3; i++) {
+        for (int j = 0; j < 4; j++) {
+            r.m[i][j] = a.m[i][0]*b.m[0][j] + a.m[i][1]*b.m[1][j] + a.m[i][2]*b.m[2][j];
+            if (j == 3)
+                r.m[i][j] += a.m[i][3];
+        }
+    }
+    return r;
+}
+
+bool Matrix34::isTranslation() const {
+    for (int i = 0; i < 3; i++) {
+        for (int j = 0; j < 3; j++) {
+            if (m[i][j] != (i == j ? 1 : 0))
+                return false;
+        }
+    }
+    return true;
+}
+
+Matrix34 Matrix34::inverse() const {
+    // inverse of the linear part from its cofactors, then undo the translation
+    float c00 = m[1][1]*m[2][2] - m[1][2]*m[2][1];
+    float c01 = m[1][2]*m[2][0] - m[1][0]*m[2][2];
+    float c02 = m[1][0]*m[2][1] - m[1][1]*m[2][0];
+    float det = m[0][0]*c00 + m[0][1]*c01 + m[0][2]*c02;
+    if (det == 0)
+        std::cerr << "singular matrix in Matrix34::inverse\n";
+    float invDet = 1 / det;
+    Matrix34 r;
+    r.m[0][0] = c00 * invDet;
+    r.m[1][0] = c01 * invDet;
+    r.m[2][0] = c02 * invDet;
+    r.m[0][1] = (m[0][2]*m[2][1] - m[0][1]*m[2][2]) * invDet;
+    r.m[1][1] = (m[0][0]*m[2][2] - m[0][2]*m[2][0]) * invDet;
+    r.m[2][1] = (m[0][1]*m[2][0] - m[0][0]*m[2][1]) * invDet;
+    r.m[0][2] = (m[0][1]*m[1][2] - m[0][2]*m[1][1]) * invDet;
+    r.m[1][2] = (m[0][2]*m[1][0] - m[0][0]*m[1][2]) * invDet;
+    r.m[2][2] = (m[0][0]*m[1][1] - m[0][1]*m[1][0]) * invDet;
+    for (int i = 0; i < 3; i++)
+        r.m[i][3] = -(r.m[i][0]*m[0][3] + r.m[i][1]*m[1][3] + r.m[i][2]*m[2][3]);
+    return r;
+}
+
+// tight box around the transformed box: each output axis takes the smaller and larger product per input axis
+AABB Matrix34::transformBox(const AABB& box) const {
+    Vector3 lo, hi;
+    for (int i = 0; i < 3; i++) {
+        lo[i] = hi[i] = m[i][3];
+        for (int j = 0; j < 3; j++) {
+            float a = m[i][j] * box.min()[j];
+            float b = m[i][j] * box.max()[j];
+            lo[i] += ffmin(a, b);
+            hi[i] += ffmax(a, b);
+        }
+    }
+    return AABB(lo, hi);
+}
+
+/*
+    Instance of ptr placed by toWorld. A Transform built around another
+    Transform takes over its child and the combined matrix, so a stack of
+    placements costs one ray transform however it was written. An animated
+    one has its matrices replaced between frames, so it is never folded
+    into its contents.
+*/
+class Transform : public Hitable {
+    public:
+        Transform(Hitable *p, const Matrix34& m);
+        virtual bool hit(const Ray& r, float tMin, float tMax, HitRecord& rec) const;
+        virtual void computeSurfaceInteraction(const Ray& r, HitRecord& rec) const;
+        virtual bool hitInterval(const Ray& r, float tMin, float tMax, float& tEnter, float& tExit) const {
+            Ray localR(toLocal.point(r.origin()), toLocal.vector(r.direction()), r.time());
+            return ptr->hitInterval(localR, tMin, tMax, tEnter, tExit);
+        }
+        virtual bool boundingBox(float t0, float t1, AABB& box) const;
+
+        void toWorldRecord(HitRecord& rec) const {
+            rec.p = toWorld.point(rec.p);
+            rec.normal = unitVector(toLocal.normal(rec.normal));
+            rec.dpdu = toWorld.vector(rec.dpdu);
+            rec.dpdv = toWorld.vector(rec.dpdv);
+        }
+        void setMatrix(const Matrix34& m) {
+            toWorld = m;
+            toLocal = m.inverse();
+        }
+
+        Hitable *ptr;
+        Matrix34 toWorld;
+        Matrix34 toLocal;
+        bool animated;
+};
+
+Transform::Transform(Hitable *p, const Matrix34& m) : ptr(p), toWorld(m), animated(false) {
+    Transform *inner = dynamic_cast<Transform*>(p);
+    if (inner && !inner->animated) {
+        ptr = inner->ptr;
+        toWorld = m * inner->toWorld;
+    }
+    toLocal = toWorld.inverse();
+}
+
+bool Transform::hit(const Ray& r, float tMin, float tMax, HitRecord& rec) const {
+    STAT_INC(primitiveTests[STAT_INSTANCE]);
+    // the direction is not renormalised, so t means the same thing in both spaces
+    Ray localR(toLocal.point(r.origin()), toLocal.vector(r.direction()), r.time());
+    int depth = rec.instanceDepth;
+    if (depth == HitRecord::maxInstanceDepth) {
+        if (!ptr->hit(localR, tMin, tMax, rec))
+            return false;
+        completeHit(localR, rec);
+        toWorldRecord(rec);
+        return true;
+    }
+    rec.instanceDepth = depth + 1;
+    bool hitAnything = ptr->hit(localR, tMin, tMax, rec);
+    rec.instanceDepth = depth;
+    if (!hitAnything)
+        return false;
+    if (rec.object) {
+        // completed only if this stays the closest hit; flipped carries through unchanged
+        rec.instances[depth] = rec.object;
+        rec.object = this;
+    } else {
+        toWorldRecord(rec);
+    }
+    return true;
+}
+
+void Transform::computeSurfaceInteraction(const Ray& r, HitRecord& rec) const {
+    Ray localR(toLocal.point(r.origin()), toLocal.vector(r.direction()), r.time());
+    int depth = rec.instanceDepth;
+    rec.instanceDepth = depth + 1;
+    rec.instances[depth]->computeSurfaceInteraction(localR, rec);
+    rec.instanceDepth = depth;
+    toWorldRecord(rec);
+}
+
+bool Transform::boundingBox(float t0, float t1, AABB& box) const {
+    if (!ptr->boundingBox(t0, t1, box))
+        return false;
+    box = toWorld.transformBox(box);
+    return true;
+}
+
+class Translate : public Transform {
+    public:
+        Translate(Hitable *p, const Vector3& displacement) : Transform(p, Matrix34::translation(displacement)) {}
+};
+
+class RotateY : public Transform {
+    public:
+        RotateY(Hitable *p, float angle) : Transform(p, Matrix34::rotation(1, angle)) {}
+};
+
+#endif
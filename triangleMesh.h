@@ -0,0 +1,338 @@
+#ifndef TRIANGLEMESHH
+#define TRIANGLEMESHH
+
+#include <memory>
+#include <vector>
+#if defined(__AVX2__) && defined(__FMA__)
+#include <immintrin.h>
+#endif
+
+#include "hitable.h"
+#include "leafBVH.h"
+#include "material.h"
+#include "sceneCache.h"
+
+/*
+    The watertight ray/triangle test of Woop, Benthin and Wald (2013). The
+    vertices are sheared into a space where the ray runs from the origin
+    along +z, and each edge test becomes a 2D cross product of two of those
+    vertices. Triangles sharing an edge compute it from the same two floats,
+    only with the sign flipped, so a ray through the edge hits at least one
+    of them however it rounds. Edge values of exactly zero are redone in
+    double, as in the paper. This needs -ffp-contract=off (see the Makefile):
+    a fused multiply-add would round the two sides of an edge differently.
+*/
+struct WatertightRay {
+    int kx, ky, kz;    // kz is the largest component of the direction
+    float sx, sy, sz;
+};
+
+inline WatertightRay watertightRay(const Vector3& d) {
+    WatertightRay w;
+    float x = fabs(d.x()), y = fabs(d.y()), z = fabs(d.z());
+    w.kz = x > y ? (x > z ? 0 : 2) : (y > z ? 1 : 2);
+    w.kx = (w.kz + 1) % 3;
+    w.ky = (w.kx + 1) % 3;
+    // keeps the winding the same for rays going either way along kz
+    if (d[w.kz] < 0)
+        std::swap(w.kx, w.ky);
+    w.sx = d[w.kx] / d[w.kz];
+    w.sy = d[w.ky] / d[w.kz];
+    w.sz = 1.0f / d[w.kz];
+    return w;
+}
+
+inline void watertightEdges(float ax, float ay, float bx, float by, float cx, float cy, float& u, float& v, float& w) {
+    u = cx*by - cy*bx;
+    v = ax*cy - ay*cx;
+    w = bx*ay - by*ax;
+    if (u == 0 || v == 0 || w == 0) {
+        u = float(double(cx)*by - double(cy)*bx);
+        v = float(double(ax)*cy - double(ay)*cx);
+        w = float(double(bx)*ay - double(by)*ax);
+    }
+}
+
+/*
+    Indexed triangle mesh with shared vertex, normal and UV buffers. The mesh
+    sits in the scene BVH as one Hitable and keeps its own BVH whose leaves are
+    ranges of up to 8 triangles, tested together with AVX2 and FMA when they
+    are available.
+*/
+class TriangleMesh: public Hitable {
+    public:
+        static const int leafSize = 8;
+
+        TriangleMesh() : matPtr(NULL) {}
+        TriangleMesh(Material *m) : matPtr(m) {}
+        void build();
+        int triangleCount() const { return int(indices.size() / 3); }
+        int vertexCount() const { return externalVertices ? nExternalVertices : int(vertices.size()); }
+        const Vector3* vertexData() const { return externalVertices ? externalVertices : vertices.data(); }
+        void shareVertices(const Vector3 *v, int n, const std::shared_ptr<const void>& owner);
+        void storeCached(SceneCache& cache, int key) const;
+        bool loadCached(const SceneCache& cache, int key);
+        virtual bool hit(const Ray& r, float tMin, float tMax, HitRecord& rec) const;
+        virtual void computeSurfaceInteraction(const Ray& r, HitRecord& rec) const;
+        virtual bool boundingBox(float t0, float t1, AABB& box) const;
+
+        std::vector<Vector3> vertices;
+        std::vector<Vector3> normals; // optional, one per vertex
+        std::vector<float> uvs;       // optional, two per vertex
+        std::vector<int> indices;     // three per triangle
+        Material *matPtr;
+
+        // positions read in place from someone else's buffer, kept alive by vertexOwner
+        const Vector3 *externalVertices = NULL;
+        int nExternalVertices = 0;
+        std::shared_ptr<const void> vertexOwner;
+
+    private:
+        bool hitTriangle(const Ray& r, const WatertightRay& w, int i, float& t, float& b1, float& b2) const;
+        bool hitLeaf(const Ray& r, const WatertightRay& w, int offset, int count, float tMin, float& tMax,
+                     int& closest, float& bu, float& bv) const;
+
+        // leaf-ordered copies of each triangle's vertices: corner[vertex][axis][i]
+        std::vector<float> corner[3][3];
+        std::vector<int> triangle;
+        QuantizedBVH bvh;
+};
+
+void TriangleMesh::shareVertices(const Vector3 *v, int n, const std::shared_ptr<const void>& owner) {
+    vertices.clear();
+    externalVertices = v;
+    nExternalVertices = n;
+    vertexOwner = owner;
+}
+
+void TriangleMesh::build() {
+    const Vector3 *vtx = vertexData();
+    int n = triangleCount();
+    std::vector<AABB> boxes(n);
+    for (int i = 0; i < n; i++) {
+        const Vector3& a = vtx[indices[3*i]];
+        const Vector3& b = vtx[indices[3*i+1]];
+        const Vector3& c = vtx[indices[3*i+2]];
+        Vector3 lo(ffmin(a.x(), ffmin(b.x(), c.x())), ffmin(a.y(), ffmin(b.y(), c.y())), ffmin(a.z(), ffmin(b.z(), c.z())));
+        Vector3 hi(ffmax(a.x(), ffmax(b.x(), c.x())), ffmax(a.y(), ffmax(b.y(), c.y())), ffmax(a.z(), ffmax(b.z(), c.z())));
+        // pad like the rects so axis-aligned triangles keep a non-empty box
+        boxes[i] = AABB(lo - Vector3(0.0001, 0.0001, 0.0001), hi + Vector3(0.0001, 0.0001, 0.0001));
+    }
+    std::vector<LeafBVHNode> nodes;
+    buildLeafBVH(boxes, leafSize, nodes, triangle);
+    bvh.build(nodes);
+
+    for (int k = 0; k < 3; k++) {
+        for (int a = 0; a < 3; a++)
+            corner[k][a].assign(n + leafSize, 0);
+    }
+    for (int i = 0; i < n; i++) {
+        for (int k = 0; k < 3; k++) {
+            const Vector3& v = vtx[indices[3*triangle[i] + k]];
+            for (int a = 0; a < 3; a++)
+                corner[k][a][i] = v[a];
+        }
+    }
+}
+
+// the built mesh, BVH included; loadCached maps the positions in place and copies the rest
+void TriangleMesh::storeCached(SceneCache& cache, int key) const {
+    const Vector3 *vtx = vertexData();
+    cache.put(CACHE_MESH, key, 0, vtx, vertexCount()*sizeof(Vector3));
+    cache.put(CACHE_MESH, key, 1, normals);
+    cache.put(CACHE_MESH, key, 2, uvs);
+    cache.put(CACHE_MESH, key, 3, indices);
+    cache.put(CACHE_MESH, key, 4, bvh.nodes);
+    cache.put(CACHE_MESH, key, 5, triangle);
+    for (int k = 0; k < 9; k++)
+        cache.put(CACHE_MESH, key, 6 + k, corner[k/3][k%3]);
+    cache.put(CACHE_MESH, key, 15, &bvh.bounds, sizeof(AABB));
+}
+
+bool TriangleMesh::loadCached(const SceneCache& cache, int key) {
+    const Vector3 *vtx;
+    size_t nVertices;
+    if (!cache.get(CACHE_MESH, key, 0, vtx, nVertices))
+        return false;
+    std::vector<AABB> bounds;
+    bool ok = cache.get(CACHE_MESH, key, 1, normals) && cache.get(CACHE_MESH, key, 2, uvs) &&
+              cache.get(CACHE_MESH, key, 3, indices) && cache.get(CACHE_MESH, key, 4, bvh.nodes) &&
+              cache.get(CACHE_MESH, key, 5, triangle) && cache.get(CACHE_MESH, key, 15, bounds) && bounds.size() == 1;
+    for (int k = 0; ok && k < 9; k++)
+        ok = cache.get(CACHE_MESH, key, 6 + k, corner[k/3][k%3]);
+    if (!ok)
+        return false;
+    bvh.bounds = bounds[0];
+    shareVertices(vtx, int(nVertices), cache.owner());
+    return true;
+}
+
+// t and the weights of the second and third vertex where r hits the triangle at leaf slot i
+bool TriangleMesh::hitTriangle(const Ray& r, const WatertightRay& w, int i, float& t, float& b1, float& b2) const {
+    float x[3], y[3], z[3];
+    for (int k = 0; k < 3; k++) {
+        float pz = corner[k][w.kz][i] - r.origin()[w.kz];
+        x[k] = (corner[k][w.kx][i] - r.origin()[w.kx]) - w.sx*pz;
+        y[k] = (corner[k][w.ky][i] - r.origin()[w.ky]) - w.sy*pz;
+        z[k] = w.sz*pz;
+    }
+    float u, v, e;
+    watertightEdges(x[0], y[0], x[1], y[1], x[2], y[2], u, v, e);
+    if ((u < 0 || v < 0 || e < 0) && (u > 0 || v > 0 || e > 0))
+        return false;
+    float det = u + v + e;
+    if (det == 0)
+        return false;
+    t = (u*z[0] + v*z[1] + e*z[2]) / det;
+    b1 = v / det;
+    b2 = e / det;
+    return true;
+}
+
+bool TriangleMesh::hitLeaf(const Ray& r, const WatertightRay& w, int offset, int count, float tMin, float& tMax,
+                           int& closest, float& bu, float& bv) const {
+    STAT_ADD(primitiveTests[STAT_TRIANGLE], count);
+    bool hitAnything = false;
+#if defined(__AVX2__) && defined(__FMA__)
+    const __m256 zero = _mm256_setzero_ps();
+    const __m256 sx = _mm256_set1_ps(w.sx), sy = _mm256_set1_ps(w.sy), sz = _mm256_set1_ps(w.sz);
+    const __m256 ox = _mm256_set1_ps(r.origin()[w.kx]), oy = _mm256_set1_ps(r.origin()[w.ky]), oz = _mm256_set1_ps(r.origin()[w.kz]);
+    const __m256 lanes = _mm256_castsi256_ps(_mm256_cmpgt_epi32(_mm256_set1_epi32(count), _mm256_setr_epi32(0,1,2,3,4,5,6,7)));
+
+    __m256 x[3], y[3], z[3];
+    for (int k = 0; k < 3; k++) {
+        __m256 pz = _mm256_sub_ps(_mm256_loadu_ps(&corner[k][w.kz][offset]), oz);
+        x[k] = _mm256_sub_ps(_mm256_sub_ps(_mm256_loadu_ps(&corner[k][w.kx][offset]), ox), _mm256_mul_ps(sx, pz));
+        y[k] = _mm256_sub_ps(_mm256_sub_ps(_mm256_loadu_ps(&corner[k][w.ky][offset]), oy), _mm256_mul_ps(sy, pz));
+        z[k] = _mm256_mul_ps(sz, pz);
+    }
+    __m256 u = _mm256_sub_ps(_mm256_mul_ps(x[2], y[1]), _mm256_mul_ps(y[2], x[1]));
+    __m256 v = _mm256_sub_ps(_mm256_mul_ps(x[0], y[2]), _mm256_mul_ps(y[0], x[2]));
+    __m256 e = _mm256_sub_ps(_mm256_mul_ps(x[1], y[0]), _mm256_mul_ps(y[1], x[0]));
+
+    __m256 onEdge = _mm256_or_ps(_mm256_cmp_ps(u, zero, _CMP_EQ_OQ),
+                                 _mm256_or_ps(_mm256_cmp_ps(v, zero, _CMP_EQ_OQ), _mm256_cmp_ps(e, zero, _CMP_EQ_OQ)));
+    int redo = _mm256_movemask_ps(_mm256_and_ps(lanes, onEdge));
+    if (redo) {
+        float xs[3][8], ys[3][8], us[8], vs[8], es[8];
+        for (int k = 0; k < 3; k++) {
+            _mm256_storeu_ps(xs[k], x[k]);
+            _mm256_storeu_ps(ys[k], y[k]);
+        }
+        _mm256_storeu_ps(us, u);
+        _mm256_storeu_ps(vs, v);
+        _mm256_storeu_ps(es, e);
+        for (int i = 0; i < 8; i++) {
+            if (redo & (1 << i))
+                watertightEdges(xs[0][i], ys[0][i], xs[1][i], ys[1][i], xs[2][i], ys[2][i], us[i], vs[i], es[i]);
+        }
+        u = _mm256_loadu_ps(us);
+        v = _mm256_loadu_ps(vs);
+        e = _mm256_loadu_ps(es);
+    }
+
+    __m256 anyNegative = _mm256_or_ps(_mm256_cmp_ps(u, zero, _CMP_LT_OQ),
+                                      _mm256_or_ps(_mm256_cmp_ps(v, zero, _CMP_LT_OQ), _mm256_cmp_ps(e, zero, _CMP_LT_OQ)));
+    __m256 anyPositive = _mm256_or_ps(_mm256_cmp_ps(u, zero, _CMP_GT_OQ),
+                                      _mm256_or_ps(_mm256_cmp_ps(v, zero, _CMP_GT_OQ), _mm256_cmp_ps(e, zero, _CMP_GT_OQ)));
+    __m256 valid = _mm256_andnot_ps(_mm256_and_ps(anyNegative, anyPositive), lanes);
+    __m256 det = _mm256_add_ps(_mm256_add_ps(u, v), e);
+    valid = _mm256_and_ps(valid, _mm256_cmp_ps(det, zero, _CMP_NEQ_OQ));
+    if (_mm256_movemask_ps(valid) == 0)
+        return false;
+    __m256 t = _mm256_div_ps(_mm256_fmadd_ps(u, z[0], _mm256_fmadd_ps(v, z[1], _mm256_mul_ps(e, z[2]))), det);
+    valid = _mm256_and_ps(valid, _mm256_cmp_ps(t, _mm256_set1_ps(tMin), _CMP_GT_OQ));
+    valid = _mm256_and_ps(valid, _mm256_cmp_ps(t, _mm256_set1_ps(tMax), _CMP_LT_OQ));
+    int mask = _mm256_movemask_ps(valid);
+    if (mask == 0)
+        return false;
+
+    float ts[8], ds[8], vs[8], es[8];
+    _mm256_storeu_ps(ts, t);
+    _mm256_storeu_ps(ds, det);
+    _mm256_storeu_ps(vs, v);
+    _mm256_storeu_ps(es, e);
+    for (int i = 0; i < 8; i++) {
+        if ((mask & (1 << i)) && ts[i] < tMax) {
+            tMax = ts[i];
+            bu = vs[i] / ds[i];
+            bv = es[i] / ds[i];
+            closest = offset + i;
+            hitAnything = true;
+        }
+    }
+#else
+    for (int i = offset; i < offset + count; i++) {
+        float t, b1, b2;
+        if (hitTriangle(r, w, i, t, b1, b2) && t > tMin && t < tMax) {
+            tMax = t;
+            bu = b1;
+            bv = b2;
+            closest = i;
+            hitAnything = true;
+        }
+    }
+#endif
+    return hitAnything;
+}
+
+bool TriangleMesh::hit(const Ray& r, float tMin, float tMax, HitRecord& rec) const {
+    int closest = -1;
+    float bu = 0, bv = 0;
+    WatertightRay w = watertightRay(r.direction());
+    bool hitAnything = traverseLeafBVH(bvh, r, tMin, tMax, [&](int offset, int count, float t0, float& t1) {
+        return hitLeaf(r, w, offset, count, t0, t1, closest, bu, bv);
+    });
+    if (!hitAnything)
+        return false;
+    rec.t = tMax;
+    rec.primitive = triangle[closest];
+    rec.b0 = bu;
+    rec.b1 = bv;
+    rec.object = this;
+    rec.flipped = false;
+    return true;
+}
+
+void TriangleMesh::computeSurfaceInteraction(const Ray& r, HitRecord& rec) const {
+    const Vector3 *vtx = vertexData();
+    int tri = rec.primitive;
+    int i0 = indices[3*tri], i1 = indices[3*tri+1], i2 = indices[3*tri+2];
+    float bu = rec.b0, bv = rec.b1;
+    float bw = 1 - bu - bv;
+    rec.p = r.pointAtParameter(rec.t);
+    if (!normals.empty())
+        rec.normal = unitVector(bw*normals[i0] + bu*normals[i1] + bv*normals[i2]);
+    else
+        rec.normal = unitVector(cross(vtx[i1] - vtx[i0], vtx[i2] - vtx[i0]));
+    if (!uvs.empty()) {
+        rec.u = bw*uvs[2*i0] + bu*uvs[2*i1] + bv*uvs[2*i2];
+        rec.v = bw*uvs[2*i0+1] + bu*uvs[2*i1+1] + bv*uvs[2*i2+1];
+        // solve the two edges against their uv deltas
+        float du02 = uvs[2*i0] - uvs[2*i2], dv02 = uvs[2*i0+1] - uvs[2*i2+1];
+        float du12 = uvs[2*i1] - uvs[2*i2], dv12 = uvs[2*i1+1] - uvs[2*i2+1];
+        float det = du02*dv12 - dv02*du12;
+        if (det != 0) {
+            Vector3 dp02 = vtx[i0] - vtx[i2], dp12 = vtx[i1] - vtx[i2];
+            rec.dpdu = (dv12*dp02 - dv02*dp12) / det;
+            rec.dpdv = (du02*dp12 - du12*dp02) / det;
+        } else {
+            rec.dpdu = rec.dpdv = Vector3(0,0,0);
+        }
+    } else {
+        rec.u = bu;
+        rec.v = bv;
+        rec.dpdu = vtx[i1] - vtx[i0];
+        rec.dpdv = vtx[i2] - vtx[i0];
+    }
+    rec.matPtr = matPtr;
+}
+
+bool TriangleMesh::boundingBox(float t0, float t1, AABB& box) const {
+    if (bvh.empty())
+        return false;
+    box = bvh.bounds;
+    return true;
+}
+
+#endif